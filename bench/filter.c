@@ -0,0 +1,489 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Filter benchmark.
+ *
+ * Filters a generated corpus of path-like items with every filter mode,
+ * and compares the specialized kernels against a generic loop that calls
+ * the substring function through a pointer for every token of every item.
+ * Also types a fuzzy query keystroke by keystroke, with and without narrowing down previous results.
+ * Runs on a single thread, so numbers reflect the kernels only.
+ * Then types a query with idle time between keystrokes on two threads, with and without speculation.
+ * Then edits tokens of a query, and types queries, with and without the token cache.
+ * Every filter is also typed keystroke by keystroke, checking that narrowing lists the same items as filtering from scratch.
+ * Last, compares memory and filter time of sorted items stored plainly and front coded.
+ *
+ * usage: bemenu-bench [items] [rounds]
+ */
+
+static const char *dirs[] = {
+    "usr", "lib", "share", "doc", "local", "bin", "include", "python3", "site-packages", "src",
+    "home", "user", "projects", "bemenu", "renderers", "wayland", "x11", "curses", "client", "common",
+};
+
+static const char *exts[] = { ".c", ".h", ".py", ".txt", ".so", ".md", "", ".conf" };
+
+static uint32_t
+next_random(uint32_t *state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+static double
+get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static struct bm_menu*
+generate(uint32_t count)
+{
+    struct bm_menu *menu;
+    if (!(menu = bm_menu_new("curses")))
+        return NULL;
+
+    bm_menu_set_thread_count(menu, 1);
+
+    uint32_t state = 1;
+    char path[256];
+    for (uint32_t i = 0; i < count; ++i) {
+        int len = 0;
+        const uint32_t depth = 2 + next_random(&state) % 5;
+        for (uint32_t d = 0; d < depth; ++d)
+            len += snprintf(path + len, sizeof(path) - len, "/%s", dirs[next_random(&state) % (sizeof(dirs) / sizeof(dirs[0]))]);
+
+        snprintf(path + len, sizeof(path) - len, "/File%uName%s", next_random(&state) % 100000, exts[next_random(&state) % (sizeof(exts) / sizeof(exts[0]))]);
+
+        struct bm_item *item;
+        if (!(item = bm_item_new(path)) || !bm_menu_add_item(menu, item)) {
+            bm_menu_free(menu);
+            return NULL;
+        }
+    }
+
+    return menu;
+}
+
+/**
+ * Generic filter like the one kernels replaced: tokens matched through a function pointer per item.
+ */
+static uint32_t
+filter_generic(struct bm_menu *menu, const char *filter, char* (*fstrstr)(const char *hay, size_t hay_len, const char *needle, size_t len))
+{
+    char *copy;
+    if (!(copy = bm_strdup(BM_MEMORY_OTHER, filter)))
+        return 0;
+
+    const char *tokv[16];
+    size_t tokl[16];
+    uint32_t tokc = 0;
+    for (char *s = strtok(copy, " "); s && tokc < 16; s = strtok(NULL, " ")) {
+        tokv[tokc] = s;
+        tokl[tokc++] = strlen(s);
+    }
+
+    uint32_t count;
+    uint32_t matches = 0;
+    struct bm_item **items = bm_menu_get_items(menu, &count);
+    for (uint32_t i = 0; i < count; ++i) {
+        const char *text = bm_item_get_text(items[i]);
+        const size_t len = strlen(text);
+
+        uint32_t t;
+        for (t = 0; t < tokc && fstrstr(text, len, tokv[t], tokl[t]); ++t);
+        matches += (t == tokc);
+    }
+
+    bm_free(copy);
+    return matches;
+}
+
+/**
+ * Type filter one character at a time, filtering after each keystroke.
+ *
+ * @param incremental Narrow down results of previous keystroke, otherwise every keystroke filters all items.
+ * @return Milliseconds all keystrokes took.
+ */
+static double
+type_filter(struct bm_menu *menu, const char *filter, bool incremental)
+{
+    char typed[256] = {0};
+    bm_menu_set_filter(menu, NULL);
+    bm_menu_filter(menu);
+
+    const double start = get_time_ms();
+    for (size_t i = 0; filter[i] && i + 1 < sizeof(typed); ++i) {
+        typed[i] = filter[i];
+
+        if (!incremental) {
+            bm_menu_set_filter(menu, NULL);
+            bm_menu_filter(menu);
+        }
+
+        bm_menu_set_filter(menu, typed);
+        bm_menu_filter(menu);
+    }
+    return get_time_ms() - start;
+}
+
+/**
+ * Type filter one character at a time, waiting idle_ms before each keystroke like a person typing.
+ *
+ * @return Milliseconds spent filtering, idle time excluded.
+ */
+static double
+type_filter_idle(struct bm_menu *menu, const char *filter, uint32_t idle_ms)
+{
+    char typed[256] = {0};
+    bm_menu_set_filter(menu, NULL);
+    bm_menu_filter(menu);
+
+    double total = 0;
+    const struct timespec idle = { idle_ms / 1000, (idle_ms % 1000) * 1000000 };
+    for (size_t i = 0; filter[i] && i + 1 < sizeof(typed); ++i) {
+        /* menu loop speculates when it renders, and then waits for input */
+        bm_menu_speculate(menu);
+        nanosleep(&idle, NULL);
+
+        typed[i] = filter[i];
+        bm_menu_set_filter(menu, typed);
+
+        const double start = get_time_ms();
+        bm_menu_filter(menu);
+        total += get_time_ms() - start;
+    }
+    return total;
+}
+
+/**
+ * Apply edits to filter one after another, each edit being the whole new filter.
+ *
+ * @return Milliseconds all edits took.
+ */
+static double
+edit_filter(struct bm_menu *menu, const char **edits, size_t count)
+{
+    bm_menu_set_filter(menu, NULL);
+    bm_menu_filter(menu);
+
+    const double start = get_time_ms();
+    for (size_t i = 0; i < count; ++i) {
+        bm_menu_set_filter(menu, edits[i]);
+        bm_menu_filter(menu);
+    }
+    return get_time_ms() - start;
+}
+
+/**
+ * Type filter and check that narrowing down lists the same items, in the same order, as filtering all items.
+ *
+ * @return true if both list the same items.
+ */
+static bool
+check_narrowing(struct bm_menu *menu, const char *filter)
+{
+    type_filter(menu, filter, true);
+
+    uint32_t count;
+    struct bm_item **filtered = bm_menu_get_filtered_items(menu, &count);
+
+    struct bm_item **narrowed;
+    if (!(narrowed = calloc(count + 1, sizeof(struct bm_item*))))
+        return false;
+
+    memcpy(narrowed, filtered, sizeof(struct bm_item*) * count);
+
+    bm_menu_set_filter(menu, NULL);
+    bm_menu_filter(menu);
+    bm_menu_set_filter(menu, filter);
+    bm_menu_filter(menu);
+
+    uint32_t scratch_count;
+    struct bm_item **scratch = bm_menu_get_filtered_items(menu, &scratch_count);
+    const bool same = (count == scratch_count && (count == 0 || !memcmp(narrowed, scratch, sizeof(struct bm_item*) * count)));
+
+    free(narrowed);
+    return same;
+}
+
+struct bench_case {
+    const char *name;
+    enum bm_filter_mode mode;
+    const char *filter;
+
+    /**
+     * Substring function of generic loop, **NULL** if mode has no generic counterpart.
+     */
+    char* (*fstrstr)(const char *hay, size_t hay_len, const char *needle, size_t len);
+};
+
+static int
+compare_texts(const void *a, const void *b)
+{
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+/**
+ * Memory of items and their filter metadata.
+ */
+static size_t
+get_items_memory(void)
+{
+    return bm_get_memory_usage(BM_MEMORY_ITEMS) + bm_get_memory_usage(BM_MEMORY_FILTER);
+}
+
+/**
+ * Filter corpus through a menu of its own, best of rounds.
+ */
+static double
+filter_corpus(struct bm_corpus *corpus, const char *filter, uint32_t rounds)
+{
+    struct bm_menu *menu;
+    if (!(menu = bm_menu_new("curses")))
+        return 0;
+
+    bm_menu_set_thread_count(menu, 1);
+    bm_menu_set_token_cache_limit(menu, 0);
+    bm_menu_set_filter_mode(menu, BM_FILTER_MODE_DMENU_CASE_INSENSITIVE);
+    bm_menu_set_corpus(menu, corpus);
+
+    double best = 0;
+    for (uint32_t r = 0; r < rounds; ++r) {
+        bm_menu_set_filter(menu, NULL);
+        bm_menu_filter(menu);
+        bm_menu_set_filter(menu, filter);
+
+        const double start = get_time_ms();
+        bm_menu_filter(menu);
+        const double ms = get_time_ms() - start;
+        best = (r == 0 || ms < best ? ms : best);
+    }
+
+    bm_menu_free(menu);
+    return best;
+}
+
+int
+main(int argc, char **argv)
+{
+    const uint32_t count = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000);
+    const uint32_t rounds = (argc > 2 ? strtoul(argv[2], NULL, 10) : 5);
+
+    if (!bm_set_allocator(NULL, true) || !bm_init())
+        return EXIT_FAILURE;
+
+    struct bm_menu *menu;
+    if (!(menu = generate(count))) {
+        fprintf(stderr, "failed to generate items\n");
+        return EXIT_FAILURE;
+    }
+
+    /* rounds repeat the same filters, which token cache would answer without running kernels */
+    const size_t token_cache_limit = bm_menu_get_token_cache_limit(menu);
+    bm_menu_set_token_cache_limit(menu, 0);
+
+    static const struct bench_case cases[] = {
+        { "dmenu", BM_FILTER_MODE_DMENU, "File4", bm_strnstr },
+        { "dmenu", BM_FILTER_MODE_DMENU, "lib src File4", bm_strnstr },
+        { "dmenu -i", BM_FILTER_MODE_DMENU_CASE_INSENSITIVE, "file4", bm_strnupstr },
+        { "dmenu -i", BM_FILTER_MODE_DMENU_CASE_INSENSITIVE, "lib src file4", bm_strnupstr },
+        { "path", BM_FILTER_MODE_PATH, "File4", bm_strnstr },
+        { "path", BM_FILTER_MODE_PATH, "lib src File4", bm_strnstr },
+        { "path -i", BM_FILTER_MODE_PATH_CASE_INSENSITIVE, "file4", bm_strnupstr },
+        { "path -i", BM_FILTER_MODE_PATH_CASE_INSENSITIVE, "lib src file4", bm_strnupstr },
+        { "acronym", BM_FILTER_MODE_ACRONYM, "fn", NULL },
+        { "acronym", BM_FILTER_MODE_ACRONYM, "usf", NULL },
+        { "acronym", BM_FILTER_MODE_ACRONYM, "li", NULL },
+        { "fuzzy", BM_FILTER_MODE_FUZZY, "lsf4n", NULL },
+        { "fuzzy", BM_FILTER_MODE_FUZZY, "lib src f4n", NULL },
+    };
+
+    printf("%u items, best of %u rounds, 1 thread\n\n", count, rounds);
+    printf("%-10s %-14s %10s %12s %12s %8s\n", "mode", "filter", "matches", "kernel ms", "generic ms", "speedup");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        const struct bench_case *bc = &cases[c];
+        bm_menu_set_filter_mode(menu, bc->mode);
+        bm_menu_set_filter(menu, bc->filter);
+
+        /* builds item store, so that only filtering is measured */
+        bm_menu_filter(menu);
+
+        double kernel = 0, generic = 0;
+        uint32_t matches = 0;
+        for (uint32_t r = 0; r < rounds; ++r) {
+            /* empty filter drops previous results, so the next filter scans all items */
+            bm_menu_set_filter(menu, NULL);
+            bm_menu_filter(menu);
+            bm_menu_set_filter(menu, bc->filter);
+
+            const double start = get_time_ms();
+            bm_menu_filter(menu);
+            const double ms = get_time_ms() - start;
+            kernel = (r == 0 || ms < kernel ? ms : kernel);
+            bm_menu_get_filtered_items(menu, &matches);
+
+            if (!bc->fstrstr)
+                continue;
+
+            const double gstart = get_time_ms();
+            filter_generic(menu, bc->filter, bc->fstrstr);
+            const double gms = get_time_ms() - gstart;
+            generic = (r == 0 || gms < generic ? gms : generic);
+        }
+
+        if (bc->fstrstr) {
+            printf("%-10s %-14s %10u %12.1f %12.1f %7.1fx\n", bc->name, bc->filter, matches, kernel, generic, generic / kernel);
+        } else {
+            printf("%-10s %-14s %10u %12.1f %12s %8s\n", bc->name, bc->filter, matches, kernel, "-", "-");
+        }
+    }
+
+    /* every plan, narrowing included, must list ties in item order */
+    bool consistent = true;
+    bm_menu_set_token_cache_limit(menu, token_cache_limit);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        bm_menu_set_filter_mode(menu, cases[c].mode);
+        if (!check_narrowing(menu, cases[c].filter)) {
+            fprintf(stderr, "%s: typing %s lists different items than filtering it from scratch\n", cases[c].name, cases[c].filter);
+            consistent = false;
+        }
+    }
+    bm_menu_set_token_cache_limit(menu, 0);
+
+    /* typing a long fuzzy query should cost about one scan, and little for every further keystroke */
+    static const char *typed = "libsrcfile4name";
+    bm_menu_set_filter_mode(menu, BM_FILTER_MODE_FUZZY);
+
+    double incremental = 0, scratch = 0;
+    for (uint32_t r = 0; r < rounds; ++r) {
+        const double ims = type_filter(menu, typed, true);
+        const double sms = type_filter(menu, typed, false);
+        incremental = (r == 0 || ims < incremental ? ims : incremental);
+        scratch = (r == 0 || sms < scratch ? sms : scratch);
+    }
+
+    printf("\ntyping %s in fuzzy mode, %zu keystrokes\n", typed, strlen(typed));
+    printf("%-14s %12.1f ms\n%-14s %12.1f ms\n", "incremental", incremental, "from scratch", scratch);
+
+    /* speculation hides filtering in idle time between keystrokes, when it guesses the next one right */
+    static const char *spoken = "file4name";
+    static const uint32_t idle_ms = 100;
+    bm_menu_set_filter_mode(menu, BM_FILTER_MODE_DMENU_CASE_INSENSITIVE);
+    bm_menu_set_thread_count(menu, 2);
+
+    double plain = 0, speculated = 0;
+    for (uint32_t r = 0; r < rounds; ++r) {
+        bm_menu_set_speculation(menu, 0);
+        const double pms = type_filter_idle(menu, spoken, idle_ms);
+        bm_menu_set_speculation(menu, 4);
+        const double sms = type_filter_idle(menu, spoken, idle_ms);
+        plain = (r == 0 || pms < plain ? pms : plain);
+        speculated = (r == 0 || sms < speculated ? sms : speculated);
+    }
+
+    struct bm_speculation_stats stats;
+    bm_menu_get_speculation_stats(menu, &stats);
+    printf("\ntyping %s in dmenu -i mode, %u ms between keystrokes, 2 threads\n", spoken, idle_ms);
+    printf("%-14s %12.1f ms\n%-14s %12.1f ms\n", "filtering", plain, "speculating", speculated);
+    printf("%u hits, %u misses, %u of %u speculations cancelled\n", stats.hits, stats.misses, stats.cancelled, stats.started);
+
+    /* editing one token of a query matches only that token against items matching the cached others */
+    static const char *edits[] = {
+        "lib src file4", "lib src file", "lib src fil", "lib src fi", "lib src f", "lib src",
+        "lib", "lib src file5", "lib file5", "src file5", "lib src file5", "lib src file7",
+    };
+    static const size_t nedits = sizeof(edits) / sizeof(edits[0]);
+    bm_menu_set_speculation(menu, 0);
+    bm_menu_set_thread_count(menu, 1);
+
+    double uncached = 0, cached = 0;
+    for (uint32_t r = 0; r < rounds; ++r) {
+        bm_menu_set_token_cache_limit(menu, 0);
+        const double ums = edit_filter(menu, edits, nedits);
+        bm_menu_set_token_cache_limit(menu, token_cache_limit);
+        const double cms = edit_filter(menu, edits, nedits);
+        uncached = (r == 0 || ums < uncached ? ums : uncached);
+        cached = (r == 0 || cms < cached ? cms : cached);
+    }
+
+    printf("\nediting tokens of %s in dmenu -i mode, %zu edits\n", edits[0], nedits);
+    printf("%-14s %12.1f ms\n%-14s %12.1f ms\n", "scanning", uncached, "token cache", cached);
+
+    /* token cache must not slow down typing, where appended characters narrow down previous results */
+    static const char *queries[] = { "usr/lib/file4", "lib src file4" };
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); ++q) {
+        double scanned = 0, planned = 0;
+        for (uint32_t r = 0; r < rounds; ++r) {
+            bm_menu_set_token_cache_limit(menu, 0);
+            const double sms = type_filter(menu, queries[q], true);
+            bm_menu_set_token_cache_limit(menu, token_cache_limit);
+            const double pms = type_filter(menu, queries[q], true);
+            scanned = (r == 0 || sms < scanned ? sms : scanned);
+            planned = (r == 0 || pms < planned ? pms : planned);
+        }
+
+        printf("\ntyping %s in dmenu -i mode, %zu keystrokes\n", queries[q], strlen(queries[q]));
+        printf("%-14s %12.1f ms\n%-14s %12.1f ms\n", "no cache", scanned, "token cache", planned);
+    }
+
+    /* front coding pays off for sorted items, which share long prefixes with their neighbours */
+    uint32_t nmemb;
+    struct bm_item **items = bm_menu_get_items(menu, &nmemb);
+    const char **texts;
+    if (!(texts = calloc(nmemb, sizeof(char*)))) {
+        bm_menu_free(menu);
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < nmemb; ++i)
+        texts[i] = bm_item_get_text(items[i]);
+
+    qsort(texts, nmemb, sizeof(char*), compare_texts);
+
+    static const char *sought = "lib src file4";
+    struct bm_corpus *plain_corpus = NULL, *packed_corpus = NULL;
+
+    size_t base = get_items_memory();
+    struct bm_item **copies;
+    if ((copies = calloc(nmemb, sizeof(struct bm_item*)))) {
+        uint32_t i;
+        for (i = 0; i < nmemb && (copies[i] = bm_item_new(texts[i])); ++i);
+        if (i < nmemb || !(plain_corpus = bm_corpus_new(copies, nmemb))) {
+            while (i > 0)
+                bm_item_free(copies[--i]);
+        }
+        free(copies);
+    }
+    const size_t plain_memory = get_items_memory() - base;
+
+    base = get_items_memory();
+    packed_corpus = bm_corpus_new_packed(texts, nmemb);
+    const size_t packed_memory = get_items_memory() - base;
+
+    if (plain_corpus && packed_corpus) {
+        const double plain_ms = filter_corpus(plain_corpus, sought, rounds);
+        const double packed_ms = filter_corpus(packed_corpus, sought, rounds);
+        printf("\nsorted items, filtering %s in dmenu -i mode\n", sought);
+        printf("%-14s %12s %12s\n", "storage", "memory MiB", "filter ms");
+        printf("%-14s %12.1f %12.1f\n", "plain", plain_memory / 1048576.0, plain_ms);
+        printf("%-14s %12.1f %12.1f\n", "front coded", packed_memory / 1048576.0, packed_ms);
+    } else {
+        fprintf(stderr, "failed to build corpora\n");
+    }
+
+    bm_corpus_unref(plain_corpus);
+    bm_corpus_unref(packed_corpus);
+    free(texts);
+    bm_menu_free(menu);
+    return (consistent ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
@@ -156,7 +156,8 @@ item_cb(const struct client *client, struct bm_item *item)
 {
     if (client->no_exec) {
         const char *text = bm_item_get_text(item);
-        printf("%s\n", (text ? text : ""));
+        fputs((text ? text : ""), stdout);
+        fputc((client->print0 ? '\0' : '\n'), stdout);
     } else {
         launch(client, bm_item_get_text(item));
     }
@@ -183,7 +184,7 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
 
     read_items_to_menu_from_path(menu);
-    const enum bm_run_result status = run_menu(&client, menu, item_cb);
+    const enum bm_run_result status = run_menu(&client, menu, item_cb, NULL);
     bm_menu_free(menu);
     return (status == BM_RUN_RESULT_SELECTED ? EXIT_SUCCESS : EXIT_FAILURE);
 }
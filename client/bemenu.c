@@ -1,14 +1,132 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
 #include <assert.h>
 #include "common/common.h"
 
 static struct client client = {
     .filter_mode = BM_FILTER_MODE_DMENU,
     .title = "bemenu",
+    .debounce = 100,
 };
 
+/**
+ * Command that produces items for the current filter, see --source.
+ */
+struct source {
+    /**
+     * Filter the command was last requested for, **NULL** before first run.
+     */
+    char *filter;
+
+    /**
+     * Output of command that is not yet a complete item.
+     */
+    char *buffer;
+    size_t len, allocated;
+
+    /**
+     * Time in milliseconds when command should be started, if pending.
+     */
+    uint64_t deadline;
+    bool pending;
+
+    /**
+     * Commands that were stopped or closed their output, but are not reaped yet.
+     * Only these are waited for, children of libbemenu are reaped by it.
+     */
+    pid_t *stopped;
+    size_t nstopped, stopped_allocated;
+
+    pid_t pid;
+    int fd;
+};
+
+static struct source source = { .fd = -1 };
+
+/**
+ * Bytes read from source per iteration of menu loop, so input stays responsive while output streams in.
+ */
+static const size_t source_read_limit = 1 << 16;
+
+/**
+ * Open addressing hash set of lines inside the input buffer.
+ * Lines are referenced by their offset, so the text is never copied.
+ */
+struct line_set {
+    struct line {
+        uint64_t hash;
+        size_t offset; /* offset + 1, 0 for empty slot */
+    } *lines;
+    size_t allocated;
+    size_t count;
+};
+
+static uint64_t
+hash_line(const char *line, size_t len)
+{
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ (unsigned char)line[i]) * 0x100000001b3;
+    return hash;
+}
+
+static bool
+line_set_grow(struct line_set *set)
+{
+    const size_t nsize = (set->allocated ? set->allocated * 2 : 1024);
+
+    struct line *lines;
+    if (!(lines = calloc(nsize, sizeof(struct line))))
+        return false;
+
+    for (size_t i = 0; i < set->allocated; ++i) {
+        if (!set->lines[i].offset)
+            continue;
+
+        size_t slot = set->lines[i].hash & (nsize - 1);
+        while (lines[slot].offset)
+            slot = (slot + 1) & (nsize - 1);
+        lines[slot] = set->lines[i];
+    }
+
+    free(set->lines);
+    set->lines = lines;
+    set->allocated = nsize;
+    return true;
+}
+
+/**
+ * Insert null terminated line to set.
+ *
+ * @return true if the line was not seen before, or if out of memory.
+ */
+static bool
+line_set_insert(struct line_set *set, const char *buffer, size_t offset, size_t len)
+{
+    if (set->count * 2 >= set->allocated && !line_set_grow(set))
+        return true;
+
+    const uint64_t hash = hash_line(buffer + offset, len);
+    size_t slot = hash & (set->allocated - 1);
+    for (; set->lines[slot].offset; slot = (slot + 1) & (set->allocated - 1)) {
+        const struct line *line = &set->lines[slot];
+        if (line->hash == hash && !strcmp(buffer + line->offset - 1, buffer + offset))
+            return false;
+    }
+
+    set->lines[slot] = (struct line){ hash, offset + 1 };
+    set->count++;
+    return true;
+}
+
 static void
 read_items_to_menu_from_stdin(struct bm_menu *menu)
 {
@@ -42,28 +160,290 @@ read_items_to_menu_from_stdin(struct bm_menu *menu)
 
     buffer[end] = 0;
 
+    size_t duplicates = 0;
+    struct line_set set = {0};
+
+    const char **lines = NULL;
+    uint32_t nlines = 0, allocated_lines = 0;
+
     char *s = buffer;
-    while ((size_t)(s - buffer) < end && *s != 0) {
-        const size_t pos = strcspn(s, "\n");
+    const char *separator = (client.read0 ? "" : "\n");
+    while ((size_t)(s - buffer) < end && (client.read0 || *s != 0)) {
+        const size_t pos = strcspn(s, separator);
         s[pos] = 0;
 
-        struct bm_item *item;
-        if (!(item = bm_item_new(s)))
-            break;
+        if (client.unique && !line_set_insert(&set, buffer, s - buffer, pos)) {
+            s += pos + 1;
+            duplicates++;
+            continue;
+        }
+
+        if (nlines >= allocated_lines) {
+            void *tmp;
+            const uint32_t nsize = (allocated_lines ? allocated_lines * 2 : 1024);
+            if (!(tmp = realloc(lines, sizeof(const char*) * nsize)))
+                break;
+            lines = tmp;
+            allocated_lines = nsize;
+        }
 
-        bm_menu_add_item(menu, item);
+        lines[nlines++] = s;
         s += pos + 1;
     }
 
+    /* lines are added at once, so their items are allocated in bulk and freed without visiting each */
+    if (client.pack) {
+        struct bm_corpus *corpus;
+        if ((corpus = bm_corpus_new_packed(lines, nlines))) {
+            bm_menu_set_corpus(menu, corpus);
+            bm_corpus_unref(corpus);
+        } else {
+            fprintf(stderr, "Out of memory\n");
+        }
+    } else if (!bm_menu_add_texts(menu, lines, nlines)) {
+        fprintf(stderr, "Out of memory\n");
+    }
+
+    if (client.unique && getenv("BEMENU_DEBUG"))
+        fprintf(stderr, "bemenu: %zu unique lines, %zu duplicates, hash set used %zu bytes\n", set.count, duplicates, set.allocated * sizeof(struct line));
+
+    free(lines);
+    free(set.lines);
     free(buffer);
 }
 
+static uint64_t
+get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool
+source_add_item(struct bm_menu *menu, const char *text)
+{
+    struct bm_item *item;
+    if (!(item = bm_item_new(text)))
+        return false;
+
+    if (!bm_menu_add_item(menu, item)) {
+        bm_item_free(item);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Reap stopped commands that have exited.
+ */
+static void
+source_reap(void)
+{
+    for (size_t i = 0; i < source.nstopped;) {
+        if (waitpid(source.stopped[i], NULL, WNOHANG) == 0) {
+            ++i;
+            continue;
+        }
+
+        source.stopped[i] = source.stopped[--source.nstopped];
+    }
+}
+
+/**
+ * Stop reading from running command and drop its unread output.
+ *
+ * @param terminate Should the command be terminated, or only left to be reaped once it exits.
+ */
+static void
+source_stop(struct bm_menu *menu, bool terminate)
+{
+    if (source.pid > 0) {
+        if (terminate)
+            kill(-source.pid, SIGTERM);
+
+        if (source.nstopped >= source.stopped_allocated) {
+            void *tmp;
+            const size_t nsize = (source.stopped_allocated ? source.stopped_allocated * 2 : 4);
+            if ((tmp = realloc(source.stopped, sizeof(pid_t) * nsize))) {
+                source.stopped = tmp;
+                source.stopped_allocated = nsize;
+            }
+        }
+
+        if (source.nstopped < source.stopped_allocated)
+            source.stopped[source.nstopped++] = source.pid;
+    }
+
+    if (source.fd >= 0) {
+        bm_menu_remove_watch_fd(menu, source.fd);
+        close(source.fd);
+    }
+
+    source.pid = 0;
+    source.fd = -1;
+    source.len = 0;
+}
+
+static void
+source_start(const struct client *client, struct bm_menu *menu)
+{
+    bm_menu_set_items(menu, NULL, 0);
+
+    int fds[2];
+    if (pipe(fds) == -1)
+        return;
+
+    pid_t pid;
+    if ((pid = fork()) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+
+    if (pid == 0) {
+        /* own process group, so the whole pipeline gets terminated when filter changes */
+        setpgid(0, 0);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        int null;
+        if ((null = open("/dev/null", O_RDONLY)) != -1) {
+            dup2(null, STDIN_FILENO);
+            close(null);
+        }
+
+        execl("/bin/sh", "sh", "-c", client->source, "sh", source.filter, (char*)NULL);
+        _exit(EXIT_FAILURE);
+    }
+
+    /* also set by parent, so the group exists even if killed before the child got to run */
+    setpgid(pid, pid);
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+    source.pid = pid;
+
+    if (!bm_menu_add_watch_fd(menu, fds[0])) {
+        close(fds[0]);
+        source_stop(menu, true);
+        return;
+    }
+
+    source.fd = fds[0];
+}
+
+/**
+ * Read available output of command to items, keeping incomplete last item buffered.
+ *
+ * @return true if items were added.
+ */
+static bool
+source_read(const struct client *client, struct bm_menu *menu)
+{
+    const char separator = (client->read0 ? '\0' : '\n');
+
+    bool added = false;
+    for (size_t total = 0; total < source_read_limit;) {
+        if (source.allocated - source.len < 4096) {
+            void *tmp;
+            const size_t nsize = (source.allocated ? source.allocated * 2 : 8192);
+            if (!(tmp = realloc(source.buffer, nsize))) {
+                fprintf(stderr, "Out of memory\n");
+                source_stop(menu, true);
+                return added;
+            }
+            source.buffer = tmp;
+            source.allocated = nsize;
+        }
+
+        const ssize_t ret = read(source.fd, source.buffer + source.len, source.allocated - source.len - 1);
+
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return added;
+
+        if (ret <= 0) {
+            if (source.len > 0) {
+                source.buffer[source.len] = 0;
+                added |= source_add_item(menu, source.buffer);
+            }
+
+            /* command may still run after closing its output, leave it be */
+            source_stop(menu, false);
+            return added;
+        }
+
+        size_t start = 0;
+        for (size_t i = source.len; i < source.len + ret; ++i) {
+            if (source.buffer[i] != separator)
+                continue;
+
+            source.buffer[i] = 0;
+            added |= source_add_item(menu, source.buffer + start);
+            start = i + 1;
+        }
+
+        source.len += ret - start;
+        memmove(source.buffer, source.buffer + start, source.len);
+        total += ret;
+    }
+
+    return added;
+}
+
+/**
+ * Called on every iteration of menu loop.
+ * Restarts command after filter has settled, and streams its output to items.
+ */
+static void
+source_update(const struct client *client, struct bm_menu *menu)
+{
+    source_reap();
+
+    const char *filter = bm_menu_get_filter(menu);
+    filter = (filter ? filter : "");
+
+    if (!source.filter || strcmp(source.filter, filter)) {
+        source_stop(menu, true);
+
+        char *copy;
+        if (!(copy = strdup(filter)))
+            return;
+
+        /* first run does not need to wait for typing */
+        source.deadline = get_time_ms() + (source.filter ? client->debounce : 0);
+        source.pending = true;
+        free(source.filter);
+        source.filter = copy;
+    }
+
+    if (source.pending) {
+        const uint64_t now = get_time_ms();
+        if (now >= source.deadline) {
+            source.pending = false;
+            source_start(client, menu);
+        } else {
+            bm_menu_set_poll_timeout(menu, source.deadline - now);
+        }
+    }
+
+    if (!source.pending)
+        bm_menu_set_poll_timeout(menu, -1);
+
+    /* menu filters after input, so match items that arrived since, appended items are merged to current matches */
+    if (source.fd >= 0 && source_read(client, menu))
+        bm_menu_filter(menu);
+}
+
 static void
 item_cb(const struct client *client, struct bm_item *item)
 {
-    (void)client;
     const char *text = bm_item_get_text(item);
-    printf("%s\n", (text ? text : ""));
+    fputs((text ? text : ""), stdout);
+    fputc((client->print0 ? '\0' : '\n'), stdout);
 }
 
 int
@@ -78,8 +458,26 @@ main(int argc, char **argv)
     if (!(menu = menu_with_options(&client)))
         return EXIT_FAILURE;
 
-    read_items_to_menu_from_stdin(menu);
-    const enum bm_run_result status = run_menu(&client, menu, item_cb);
+    if (!client.source)
+        read_items_to_menu_from_stdin(menu);
+
+    const enum bm_run_result status = run_menu(&client, menu, item_cb, (client.source ? source_update : NULL));
+
+    if (client.source) {
+        source_stop(menu, true);
+        source_reap();
+        free(source.stopped);
+        free(source.filter);
+        free(source.buffer);
+    }
+
+    if (client.fast_exit) {
+        /* selection is printed, freeing memory is left to the system so whoever waits for us continues now */
+        bm_menu_set_visible(menu, false);
+        fflush(stdout);
+        _exit(status == BM_RUN_RESULT_SELECTED ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     bm_menu_free(menu);
     return (status == BM_RUN_RESULT_SELECTED ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <signal.h>
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <assert.h>
@@ -172,9 +173,23 @@ usage(FILE *out, const char *name)
           " -l, --list            list items vertically with the given number of lines.\n"
           " -p, --prompt          defines the prompt text to be displayed.\n"
           " -P, --prefix          text to show before highlighted item.\n"
+          " --preview             command whose output for highlighted item is shown beside items.\n"
           " -I, --index           select item at index automatically.\n"
           " --scrollbar           display scrollbar. (always, autohide)\n"
+          " --sort                sort matches. (none, length, alphabetical)\n"
+          " --filter-mode         how items are matched. (dmenu, acronym, path, fuzzy)\n"
+          " --speculate           number of likely next characters filtered ahead while idle, at most 8. (default: 0)\n"
           " --ifne                only display menu if there are items.\n"
+          " --unique              discard duplicate items. (bemenu)\n"
+          " --pack                keep items front coded, for large sorted lists, not with fields. (bemenu)\n"
+          " --fast-exit           exit right after printing selection, without freeing items. (bemenu)\n"
+          " -0, --read0           read items delimited by NUL instead of newline. (bemenu)\n"
+          " --print0              print selected items delimited by NUL instead of newline.\n"
+          " --delimiter           characters that split items to fields. (default: tab)\n"
+          " --match-field         fields to match, N, N-M or N-. (bemenu)\n"
+          " --display-field       fields to display, N, N-M or N-. (bemenu)\n"
+          " --source              command whose output replaces items when filter changes. (bemenu)\n"
+          " --debounce            milliseconds to wait for typing before running source. (bemenu)\n"
           " --fork                always fork. (bemenu-run)\n"
           " --no-exec             do not execute command. (bemenu-run)\n\n"
 
@@ -211,6 +226,73 @@ usage(FILE *out, const char *name)
     exit((out == stderr ? EXIT_FAILURE : EXIT_SUCCESS));
 }
 
+static bool
+parse_field_number(const char *str, char **out_end, uint32_t *out_field)
+{
+    assert(str && out_end && out_field);
+
+    if (*str < '0' || *str > '9')
+        return false;
+
+    errno = 0;
+    const unsigned long field = strtoul(str, out_end, 10);
+    if (errno || field < 1 || field > UINT32_MAX)
+        return false;
+
+    *out_field = field;
+    return true;
+}
+
+/**
+ * Parse whole string as decimal number of at most max.
+ */
+static bool
+parse_number(const char *str, uint32_t max, uint32_t *out_number)
+{
+    assert(str && out_number);
+
+    if (*str < '0' || *str > '9')
+        return false;
+
+    char *end;
+    errno = 0;
+    const unsigned long number = strtoul(str, &end, 10);
+    if (errno || *end || number > max)
+        return false;
+
+    *out_number = number;
+    return true;
+}
+
+/**
+ * Parse field range of form N, N-M or N-.
+ */
+static bool
+parse_fields(const char *spec, uint32_t out_fields[2])
+{
+    assert(spec && out_fields);
+
+    char *end;
+    uint32_t first, last;
+    if (!parse_field_number(spec, &end, &first))
+        return false;
+
+    if (*end == '-' && !*(end + 1)) {
+        last = 0;
+    } else if (*end == '-') {
+        if (!parse_field_number(end + 1, &end, &last) || *end || last < first)
+            return false;
+    } else if (!*end) {
+        last = first;
+    } else {
+        return false;
+    }
+
+    out_fields[0] = first;
+    out_fields[1] = last;
+    return true;
+}
+
 static void
 do_getopt(struct client *client, int *argc, char **argv[])
 {
@@ -230,6 +312,20 @@ do_getopt(struct client *client, int *argc, char **argv[])
         { "ifne",        no_argument,       0, 0x115 },
         { "fork",        no_argument,       0, 0x116 },
         { "no-exec",     no_argument,       0, 0x117 },
+        { "sort",        required_argument, 0, 0x118 },
+        { "unique",      no_argument,       0, 0x119 },
+        { "delimiter",   required_argument, 0, 0x120 },
+        { "match-field", required_argument, 0, 0x121 },
+        { "display-field", required_argument, 0, 0x122 },
+        { "read0",       no_argument,       0, '0' },
+        { "print0",      no_argument,       0, 0x123 },
+        { "filter-mode", required_argument, 0, 0x124 },
+        { "source",      required_argument, 0, 0x125 },
+        { "debounce",    required_argument, 0, 0x126 },
+        { "preview",     required_argument, 0, 0x127 },
+        { "speculate",   required_argument, 0, 0x128 },
+        { "pack",        no_argument,       0, 0x129 },
+        { "fast-exit",   no_argument,       0, 0x12a },
 
         { "bottom",      no_argument,       0, 'b' },
         { "grab",        no_argument,       0, 'f' },
@@ -260,7 +356,7 @@ do_getopt(struct client *client, int *argc, char **argv[])
 
     for (optind = 0;;) {
         int32_t opt;
-        if ((opt = getopt_long(*argc, *argv, "hviwl:I:p:P:I:bfm:H:n", opts, NULL)) < 0)
+        if ((opt = getopt_long(*argc, *argv, "hviwl:I:p:P:I:bfm:H:n0", opts, NULL)) < 0)
             break;
 
         switch (opt) {
@@ -272,7 +368,7 @@ do_getopt(struct client *client, int *argc, char **argv[])
                 break;
 
             case 'i':
-                client->filter_mode = BM_FILTER_MODE_DMENU_CASE_INSENSITIVE;
+                client->ignorecase = true;
                 break;
             case 'w':
                 client->wrap = true;
@@ -301,6 +397,81 @@ do_getopt(struct client *client, int *argc, char **argv[])
             case 0x117:
                 client->no_exec = true;
                 break;
+            case 0x118:
+                if (!strcmp(optarg, "none")) {
+                    client->sort_mode = BM_SORT_MODE_NONE;
+                } else if (!strcmp(optarg, "length")) {
+                    client->sort_mode = BM_SORT_MODE_LENGTH;
+                } else if (!strcmp(optarg, "alphabetical")) {
+                    client->sort_mode = BM_SORT_MODE_ALPHABETICAL;
+                } else {
+                    fprintf(stderr, "unknown sort mode: %s\n", optarg);
+                    usage(stderr, *argv[0]);
+                }
+                break;
+            case 0x119:
+                client->unique = true;
+                break;
+            case 0x120:
+                client->delimiter = optarg;
+                break;
+            case 0x121:
+                if (!parse_fields(optarg, client->match_fields)) {
+                    fprintf(stderr, "invalid field range: %s\n", optarg);
+                    usage(stderr, *argv[0]);
+                }
+                break;
+            case 0x122:
+                if (!parse_fields(optarg, client->display_fields)) {
+                    fprintf(stderr, "invalid field range: %s\n", optarg);
+                    usage(stderr, *argv[0]);
+                }
+                break;
+            case '0':
+                client->read0 = true;
+                break;
+            case 0x123:
+                client->print0 = true;
+                break;
+            case 0x124:
+                if (!strcmp(optarg, "dmenu")) {
+                    client->filter_mode = BM_FILTER_MODE_DMENU;
+                } else if (!strcmp(optarg, "acronym")) {
+                    client->filter_mode = BM_FILTER_MODE_ACRONYM;
+                } else if (!strcmp(optarg, "path")) {
+                    client->filter_mode = BM_FILTER_MODE_PATH;
+                } else if (!strcmp(optarg, "fuzzy")) {
+                    client->filter_mode = BM_FILTER_MODE_FUZZY;
+                } else {
+                    fprintf(stderr, "unknown filter mode: %s\n", optarg);
+                    usage(stderr, *argv[0]);
+                }
+                break;
+            case 0x125:
+                client->source = optarg;
+                break;
+            case 0x126:
+                if (!parse_number(optarg, UINT32_MAX, &client->debounce)) {
+                    fprintf(stderr, "invalid debounce: %s\n", optarg);
+                    usage(stderr, *argv[0]);
+                }
+                break;
+            case 0x127:
+                client->preview = optarg;
+                break;
+            case 0x128:
+                /* library speculates at most 8 characters, see man page */
+                if (!parse_number(optarg, 8, &client->speculate)) {
+                    fprintf(stderr, "invalid speculate count: %s\n", optarg);
+                    usage(stderr, *argv[0]);
+                }
+                break;
+            case 0x129:
+                client->pack = true;
+                break;
+            case 0x12a:
+                client->fast_exit = true;
+                break;
 
             case 'b':
                 client->bottom = true;
@@ -380,9 +551,22 @@ parse_args(struct client *client, int *argc, char **argv[])
     int num_opts;
     char **opts;
     const char *env;
+    const char *name = (*argv)[0];
     if ((env = getenv("BEMENU_OPTS")) && (opts = tokenize_quoted_to_argv(env, (*argv)[0], &num_opts)))
         do_getopt(client, &num_opts, &opts);
     do_getopt(client, argc, argv);
+
+    /* items come from source, there is no stdin to deduplicate or check for emptiness */
+    if (client->source && (client->unique || client->ifne)) {
+        fprintf(stderr, "--source can not be combined with --unique or --ifne\n");
+        usage(stderr, name);
+    }
+
+    /* packed items can't be split to fields, keep them plain rather than fail over a memory hint */
+    if (client->pack && (client->delimiter || client->match_fields[0] || client->display_fields[0])) {
+        fprintf(stderr, "--pack has no effect with --delimiter, --match-field or --display-field\n");
+        client->pack = false;
+    }
 }
 
 struct bm_menu*
@@ -398,7 +582,21 @@ menu_with_options(struct client *client)
     bm_menu_set_line_height(menu, client->line_height);
     bm_menu_set_title(menu, client->title);
     bm_menu_set_prefix(menu, client->prefix);
-    bm_menu_set_filter_mode(menu, client->filter_mode);
+    bm_menu_set_preview(menu, client->preview);
+    enum bm_filter_mode filter_mode = client->filter_mode;
+    if (client->ignorecase && filter_mode == BM_FILTER_MODE_DMENU)
+        filter_mode = BM_FILTER_MODE_DMENU_CASE_INSENSITIVE;
+    else if (client->ignorecase && filter_mode == BM_FILTER_MODE_PATH)
+        filter_mode = BM_FILTER_MODE_PATH_CASE_INSENSITIVE;
+
+    bm_menu_set_filter_mode(menu, filter_mode);
+    bm_menu_set_sort_mode(menu, client->sort_mode);
+    bm_menu_set_speculation(menu, client->speculate);
+    bm_menu_set_match_fields(menu, client->match_fields[0], client->match_fields[1]);
+    bm_menu_set_display_fields(menu, client->display_fields[0], client->display_fields[1]);
+
+    if (client->delimiter || client->match_fields[0] || client->display_fields[0])
+        bm_menu_set_field_delimiter(menu, (client->delimiter ? client->delimiter : "\t"));
     bm_menu_set_lines(menu, client->lines);
     bm_menu_set_wrap(menu, client->wrap);
     bm_menu_set_bottom(menu, client->bottom);
@@ -420,7 +618,7 @@ menu_with_options(struct client *client)
 }
 
 enum bm_run_result
-run_menu(const struct client *client, struct bm_menu *menu, void (*item_cb)(const struct client *client, struct bm_item *item))
+run_menu(const struct client *client, struct bm_menu *menu, void (*item_cb)(const struct client *client, struct bm_item *item), void (*idle_cb)(const struct client *client, struct bm_menu *menu))
 {
     bm_menu_set_highlighted_index(menu, client->selected);
     bm_menu_grab_keyboard(menu, true);
@@ -432,6 +630,9 @@ run_menu(const struct client *client, struct bm_menu *menu, void (*item_cb)(cons
     enum bm_key key;
     enum bm_run_result status = BM_RUN_RESULT_RUNNING;
     do {
+        if (idle_cb)
+            idle_cb(client, menu);
+
         bm_menu_render(menu);
         key = bm_menu_poll_key(menu, &unicode);
     } while ((status = bm_menu_run_with_key(menu, key, unicode)) == BM_RUN_RESULT_RUNNING);
@@ -6,19 +6,32 @@
 
 struct client {
     enum bm_filter_mode filter_mode;
+    enum bm_sort_mode sort_mode;
     enum bm_scrollbar_mode scrollbar;
     const char *colors[BM_COLOR_LAST];
     const char *title;
     const char *prefix;
+    const char *preview;
     const char *font;
+    const char *delimiter;
+    const char *source;
+    uint32_t match_fields[2];
+    uint32_t display_fields[2];
     uint32_t line_height;
     uint32_t lines;
     uint32_t selected;
     uint32_t monitor;
+    uint32_t debounce;
+    uint32_t speculate;
     bool bottom;
     bool grab;
     bool wrap;
+    bool ignorecase;
     bool ifne;
+    bool unique;
+    bool pack;
+    bool fast_exit;
+    bool read0, print0;
     bool no_overlap;
     bool force_fork, fork;
     bool no_exec;
@@ -28,7 +41,7 @@ char* cstrcopy(const char *str, size_t size);
 char** tokenize_quoted_to_argv(const char *str, char *argv0, int *out_argc);
 void parse_args(struct client *client, int *argc, char **argv[]);
 struct bm_menu* menu_with_options(struct client *client);
-enum bm_run_result run_menu(const struct client *client, struct bm_menu *menu, void (*item_cb)(const struct client *client, struct bm_item *item));
+enum bm_run_result run_menu(const struct client *client, struct bm_menu *menu, void (*item_cb)(const struct client *client, struct bm_item *item), void (*idle_cb)(const struct client *client, struct bm_menu *menu));
 
 #endif /* _BM_COMMON_H_ */
 
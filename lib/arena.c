@@ -0,0 +1,140 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Size of the first block, later blocks double up to arena_block_max.
+ */
+static const size_t arena_block_min = 1 << 16;
+static const size_t arena_block_max = 1 << 24;
+
+/**
+ * Types allocations of arena are aligned for.
+ */
+union arena_align {
+    long double d;
+    uint64_t u;
+    void *p;
+};
+
+/**
+ * Chunk of memory allocations of arena are carved from.
+ */
+struct arena_block {
+    struct arena_block *next;
+    size_t used, size;
+    union arena_align data[];
+};
+
+/**
+ * Bump allocator, whose allocations are only released all at once.
+ * Blocks grow geometrically, so releasing millions of allocations takes a handful of frees.
+ */
+struct bm_arena {
+    /**
+     * Newest block first, only it has room left.
+     */
+    struct arena_block *blocks;
+};
+
+/**
+ * Create empty arena, blocks are allocated on first use.
+ *
+ * @return bm_arena for success, **NULL** on failure.
+ */
+struct bm_arena*
+bm_arena_new(void)
+{
+    return bm_calloc(BM_MEMORY_ITEMS, 1, sizeof(struct bm_arena));
+}
+
+/**
+ * Release arena and everything allocated from it.
+ *
+ * @param arena bm_arena to free, may be **NULL**.
+ */
+void
+bm_arena_free(struct bm_arena *arena)
+{
+    if (!arena)
+        return;
+
+    for (struct arena_block *block = arena->blocks, *next; block; block = next) {
+        next = block->next;
+        bm_free(block);
+    }
+
+    bm_free(arena);
+}
+
+/**
+ * Carve size bytes aligned to align from the newest block, starting a new block if it has no room.
+ */
+static void*
+carve(struct bm_arena *arena, size_t size, size_t align)
+{
+    struct arena_block *block = arena->blocks;
+    size_t offset = (block ? (block->used + align - 1) / align * align : 0);
+
+    if (!block || offset > block->size || block->size - offset < size) {
+        size_t nsize = (block ? block->size * 2 : arena_block_min);
+        if (nsize > arena_block_max)
+            nsize = arena_block_max;
+
+        /* allocations larger than a block get a block of their own */
+        if (nsize < size)
+            nsize = size;
+
+        if (!(block = bm_malloc(BM_MEMORY_ITEMS, sizeof(struct arena_block) + nsize)))
+            return NULL;
+
+        block->used = 0;
+        block->size = nsize;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        offset = 0;
+    }
+
+    block->used = offset + size;
+    return (char*)block->data + offset;
+}
+
+/**
+ * Allocate memory from arena, aligned for any type.
+ *
+ * @param arena bm_arena to allocate from.
+ * @param size Number of bytes.
+ * @return Pointer to uninitialized memory owned by arena, **NULL** on failure.
+ */
+void*
+bm_arena_alloc(struct bm_arena *arena, size_t size)
+{
+    assert(arena);
+    return carve(arena, size, sizeof(union arena_align));
+}
+
+/**
+ * Copy string to arena.
+ *
+ * @param arena bm_arena to allocate from.
+ * @param s Text to copy, does not need to be null terminated.
+ * @param len Length of text in bytes.
+ * @return Null terminated copy owned by arena, **NULL** on failure.
+ */
+char*
+bm_arena_strndup(struct bm_arena *arena, const char *s, size_t len)
+{
+    assert(arena && s);
+
+    char *copy;
+    /* texts are packed byte by byte, alignment would pad each of them */
+    if (!(copy = carve(arena, len + 1, 1)))
+        return NULL;
+
+    memcpy(copy, s, len);
+    copy[len] = 0;
+    return copy;
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
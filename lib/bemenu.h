@@ -10,9 +10,11 @@
 struct bm_renderer;
 struct bm_menu;
 struct bm_item;
+struct bm_corpus;
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 /**
  * @defgroup Library
@@ -35,6 +37,13 @@ struct bm_item;
  * Contains properties for visual representation of item.
  */
 
+/**
+ * @defgroup Corpus
+ * @brief Shared item container.
+ *
+ * Holds items and their preprocessed data once for many menus.
+ */
+
 /**
  * @addtogroup Library
  * @{ */
@@ -78,6 +87,76 @@ const char* bm_version(void);
 
 /**  @} Library Version */
 
+/**
+ * @name Library Memory
+ * @{ */
+
+/**
+ * Allocation hooks used by bemenu.
+ * Memory allocated by renderer toolkits (X11, Wayland, curses, pango) does not go through these.
+ */
+struct bm_allocator {
+    /**
+     * Allocate size bytes, like malloc.
+     */
+    void* (*malloc_fun)(size_t size, void *context);
+
+    /**
+     * Resize memory to size bytes, like realloc.
+     */
+    void* (*realloc_fun)(void *ptr, size_t size, void *context);
+
+    /**
+     * Release memory, like free.
+     */
+    void (*free_fun)(void *ptr, void *context);
+
+    /**
+     * Opaque pointer passed to hooks.
+     */
+    void *context;
+};
+
+/**
+ * Parts of bemenu that memory usage is counted for.
+ *
+ * - @link ::bm_memory_domain BM_MEMORY_ITEMS @endlink holds items, their text and item lists.
+ * - @link ::bm_memory_domain BM_MEMORY_FILTER @endlink holds filter text, item metadata used for matching, and filtered and selected item lists.
+ * - @link ::bm_memory_domain BM_MEMORY_RENDER @endlink holds buffers and state of renderers.
+ * - @link ::bm_memory_domain BM_MEMORY_OTHER @endlink holds everything else, such as menu properties and loaded renderer names.
+ *
+ * @link ::bm_memory_domain BM_MEMORY_LAST @endlink is provided for enumerating memory domains.
+ */
+enum bm_memory_domain {
+    BM_MEMORY_ITEMS,
+    BM_MEMORY_FILTER,
+    BM_MEMORY_RENDER,
+    BM_MEMORY_OTHER,
+    BM_MEMORY_LAST
+};
+
+/**
+ * Set allocation hooks and memory accounting.
+ *
+ * Must be called before bm_init, or after everything allocated by bemenu was freed.
+ * Accounting stores size of every allocation and adds small overhead to each.
+ *
+ * @param allocator Pointer to bm_allocator with all hooks set, **NULL** to use malloc, realloc and free.
+ * @param accounting true to count memory held in each bm_memory_domain.
+ * @return true if set was successful, false if bemenu still holds memory or hooks were missing.
+ */
+bool bm_set_allocator(const struct bm_allocator *allocator, bool accounting);
+
+/**
+ * Get number of bytes bemenu currently holds in memory domain.
+ *
+ * @param domain bm_memory_domain constant.
+ * @return Number of bytes, always 0 if accounting is not enabled with bm_set_allocator.
+ */
+size_t bm_get_memory_usage(enum bm_memory_domain domain);
+
+/**  @} Library Memory */
+
 /**  @} Library */
 
 /**
@@ -125,15 +204,50 @@ enum bm_priorty bm_renderer_get_priorty(const struct bm_renderer *renderer);
 /**
  * Filter mode constants for bm_menu instance filter mode.
  *
+ * - @link ::bm_filter_mode BM_FILTER_MODE_ACRONYM @endlink matches query characters against starts of words,
+ *   words being separated by non-alphanumeric characters and camelCase boundaries. These hits are listed first,
+ *   followed by case-insensitive substring hits. `gcs` thus finds both `google-cloud-sdk` and `GetCurrentSession`.
+ * - @link ::bm_filter_mode BM_FILTER_MODE_PATH @endlink treats items as file paths. Items whose last path component
+ *   equals or contains the last token are listed before items that only match in directories.
+ *   Renderers abbreviate long paths from the left, so the last component stays visible.
+ * - @link ::bm_filter_mode BM_FILTER_MODE_FUZZY @endlink matches characters of each token case-insensitively in order,
+ *   allowing gaps between them. Items are ranked by score, consecutive characters and characters at word starts
+ *   score higher. Extending the filter only matches the appended characters against remaining items.
+ *
  * @link ::bm_filter_mode BM_FILTER_MODE_LAST @endlink is provided for enumerating filter modes.
  * Using it as filter mode however provides exactly same functionality as BM_FILTER_MODE_DMENU.
  */
 enum bm_filter_mode {
     BM_FILTER_MODE_DMENU,
     BM_FILTER_MODE_DMENU_CASE_INSENSITIVE,
+    BM_FILTER_MODE_ACRONYM,
+    BM_FILTER_MODE_PATH,
+    BM_FILTER_MODE_PATH_CASE_INSENSITIVE,
+    BM_FILTER_MODE_FUZZY,
     BM_FILTER_MODE_LAST
 };
 
+/**
+ * Sort mode constants for bm_menu instance filtered items.
+ *
+ * - @link ::bm_sort_mode BM_SORT_MODE_NONE @endlink keeps the order produced by filter, exact and prefix matches first.
+ * - @link ::bm_sort_mode BM_SORT_MODE_LENGTH @endlink sorts shortest items first.
+ * - @link ::bm_sort_mode BM_SORT_MODE_ALPHABETICAL @endlink sorts items lexicographically by their bytes.
+ * - @link ::bm_sort_mode BM_SORT_MODE_KEY @endlink sorts items by key set with bm_item_set_sort_key, smallest first.
+ *
+ * Sorting is stable, items that compare equal keep their filtered order.
+ *
+ * @link ::bm_sort_mode BM_SORT_MODE_LAST @endlink is provided for enumerating sort modes.
+ * Using it as sort mode however provides exactly same functionality as BM_SORT_MODE_NONE.
+ */
+enum bm_sort_mode {
+    BM_SORT_MODE_NONE,
+    BM_SORT_MODE_LENGTH,
+    BM_SORT_MODE_ALPHABETICAL,
+    BM_SORT_MODE_KEY,
+    BM_SORT_MODE_LAST
+};
+
 /**
  * Scrollbar display mode constants for bm_menu instance scrollbar.
  *
@@ -167,6 +281,7 @@ enum bm_run_result {
 /**
  * Key constants.
  *
+ * @link ::bm_key BM_KEY_PASTE @endlink means that text was pasted, renderer inserts all of it to filter with one key.
  * @link ::bm_key BM_KEY_LAST @endlink is provided for enumerating keys.
  */
 enum bm_key {
@@ -193,6 +308,7 @@ enum bm_key {
     BM_KEY_SHIFT_RETURN,
     BM_KEY_CONTROL_RETURN,
     BM_KEY_UNICODE,
+    BM_KEY_PASTE,
     BM_KEY_LAST
 };
 
@@ -217,6 +333,36 @@ enum bm_color {
     BM_COLOR_LAST
 };
 
+/**
+ * Counters of speculative filtering.
+ */
+struct bm_speculation_stats {
+    /**
+     * Times speculation was started for a filter.
+     */
+    uint32_t started;
+
+    /**
+     * Times speculation was cancelled by input before all speculated filters finished.
+     */
+    uint32_t cancelled;
+
+    /**
+     * Speculated filters that finished.
+     */
+    uint32_t computed;
+
+    /**
+     * Appended characters whose results were speculated.
+     */
+    uint32_t hits;
+
+    /**
+     * Appended characters whose results were not speculated, or had not finished.
+     */
+    uint32_t misses;
+};
+
 /**
  * @name Menu Memory
  * @{ */
@@ -241,6 +387,7 @@ void bm_menu_free(struct bm_menu *menu);
 
 /**
  * Release items inside bm_menu instance.
+ * Items added with bm_menu_add_texts are released at once with their arena.
  *
  * @param menu bm_menu instance which items will be freed from memory.
  */
@@ -294,6 +441,28 @@ void bm_menu_set_prefix(struct bm_menu *menu, const char *prefix);
  */
 const char* bm_menu_get_prefix(struct bm_menu *menu);
 
+/**
+ * Set preview command.
+ * Output of the command for highlighted item is shown next to the items.
+ * This is shown on vertical list mode only.
+ *
+ * Command is ran with sh in the background, with text of the item as $1, and killed if it runs for too long.
+ * Output is cached, so returning to an item shows its preview at once.
+ *
+ * @param menu bm_menu instance where to set preview command.
+ * @param command Null terminated C "string" of command. May be set **NULL** to disable preview.
+ * @return true on success, false if out of memory.
+ */
+bool bm_menu_set_preview(struct bm_menu *menu, const char *command);
+
+/**
+ * Is preview enabled for bm_menu instance?
+ *
+ * @param menu bm_menu instance to query.
+ * @return true if preview command is set.
+ */
+bool bm_menu_has_preview(const struct bm_menu *menu);
+
 /**
  * Set filter text to bm_menu instance.
  *
@@ -328,6 +497,152 @@ void bm_menu_set_filter_mode(struct bm_menu *menu, enum bm_filter_mode mode);
  */
 enum bm_filter_mode bm_menu_get_filter_mode(const struct bm_menu *menu);
 
+/**
+ * Set sort mode for filtered items of bm_menu instance.
+ *
+ * Filtered items are only sorted again when the filter result changes.
+ *
+ * @param menu bm_menu instance where to set sort mode.
+ * @param mode bm_sort_mode constant.
+ */
+void bm_menu_set_sort_mode(struct bm_menu *menu, enum bm_sort_mode mode);
+
+/**
+ * Get sort mode from bm_menu instance.
+ *
+ * @param menu bm_menu instance where to get sort mode.
+ * @return bm_sort_mode constant.
+ */
+enum bm_sort_mode bm_menu_get_sort_mode(const struct bm_menu *menu);
+
+/**
+ * Set maximum number of threads bm_menu instance uses for filtering and sorting.
+ *
+ * Threads are started when the first large item list is filtered, and stopped by bm_menu_free.
+ *
+ * @param menu bm_menu instance where to set thread count.
+ * @param count Maximum number of threads including the calling thread, 1 disables threading. 0 uses the number of online CPUs.
+ */
+void bm_menu_set_thread_count(struct bm_menu *menu, uint32_t count);
+
+/**
+ * Get maximum number of threads from bm_menu instance.
+ *
+ * @param menu bm_menu instance where to get thread count.
+ * @return Maximum number of threads, 0 if the number of online CPUs is used.
+ */
+uint32_t bm_menu_get_thread_count(const struct bm_menu *menu);
+
+/**
+ * Set number of likely next characters bm_menu instance filters ahead while waiting for input.
+ *
+ * Characters are picked from the text of current results, and filtered on threads of the menu.
+ * Input cancels speculation, and typing a speculated character takes its results instead of filtering.
+ * Speculation needs more than one thread, and is not done for @link ::bm_filter_mode BM_FILTER_MODE_FUZZY @endlink.
+ *
+ * @param menu bm_menu instance where to set speculation.
+ * @param count Number of characters, at most 8. 0 disables speculation.
+ * @return true if set was successful, false if out of memory.
+ */
+bool bm_menu_set_speculation(struct bm_menu *menu, uint32_t count);
+
+/**
+ * Get number of likely next characters bm_menu instance filters ahead.
+ *
+ * @param menu bm_menu instance where to get speculation.
+ * @return Number of characters, 0 if speculation is disabled.
+ */
+uint32_t bm_menu_get_speculation(const struct bm_menu *menu);
+
+/**
+ * Get counters of speculative filtering from bm_menu instance.
+ *
+ * @param menu bm_menu instance where to get counters.
+ * @param out_stats Reference to bm_speculation_stats where counters are stored, zeroed if speculation is disabled.
+ */
+void bm_menu_get_speculation_stats(const struct bm_menu *menu, struct bm_speculation_stats *out_stats);
+
+/**
+ * Set most memory bm_menu instance uses for caching items that match tokens of filter.
+ *
+ * When all items are filtered with a filter of several tokens, items matching each token are kept as a set,
+ * so editing one token later only matches items that are in sets of the other tokens.
+ * Sets are kept for @link ::bm_filter_mode BM_FILTER_MODE_DMENU @endlink and @link ::bm_filter_mode BM_FILTER_MODE_PATH @endlink
+ * modes and their case insensitive variants. Least recently used sets are dropped to stay under the limit,
+ * and all of them when items change. Defaults to 64 MiB.
+ *
+ * @param menu bm_menu instance where to set limit.
+ * @param bytes Most bytes sets may take, 0 disables caching.
+ * @return true if set was successful.
+ */
+bool bm_menu_set_token_cache_limit(struct bm_menu *menu, size_t bytes);
+
+/**
+ * Get most memory bm_menu instance uses for caching items that match tokens of filter.
+ *
+ * @param menu bm_menu instance where to get limit.
+ * @return Most bytes, 0 if caching is disabled.
+ */
+size_t bm_menu_get_token_cache_limit(const struct bm_menu *menu);
+
+/**
+ * Set characters that split item text to fields.
+ *
+ * Fields are used to restrict matching and displaying to parts of the item text,
+ * the selected items are still returned with their whole text.
+ *
+ * @param menu bm_menu instance where to set field delimiter.
+ * @param delimiter Null terminated C "string", any of its characters separates fields. May be set **NULL** to disable fields.
+ * @return true if set was succesful, false if out of memory.
+ */
+bool bm_menu_set_field_delimiter(struct bm_menu *menu, const char *delimiter);
+
+/**
+ * Get characters that split item text to fields.
+ *
+ * @param menu bm_menu instance where to get field delimiter.
+ * @return Const pointer to current field delimiter, may be **NULL** if fields are disabled.
+ */
+const char* bm_menu_get_field_delimiter(const struct bm_menu *menu);
+
+/**
+ * Set range of fields that are matched by filter.
+ * Fields are counted from 1. Has no effect unless field delimiter is set.
+ *
+ * @param menu bm_menu instance where to set matched fields.
+ * @param first First field to match, 0 to match the whole text.
+ * @param last Last field to match, 0 to match all fields after first.
+ */
+void bm_menu_set_match_fields(struct bm_menu *menu, uint32_t first, uint32_t last);
+
+/**
+ * Get range of fields that are matched by filter.
+ *
+ * @param menu bm_menu instance where to get matched fields.
+ * @param out_first Reference to uint32_t where first matched field will be stored.
+ * @param out_last Reference to uint32_t where last matched field will be stored.
+ */
+void bm_menu_get_match_fields(const struct bm_menu *menu, uint32_t *out_first, uint32_t *out_last);
+
+/**
+ * Set range of fields that are shown by renderers.
+ * Fields are counted from 1. Has no effect unless field delimiter is set.
+ *
+ * @param menu bm_menu instance where to set displayed fields.
+ * @param first First field to show, 0 to show the whole text.
+ * @param last Last field to show, 0 to show all fields after first.
+ */
+void bm_menu_set_display_fields(struct bm_menu *menu, uint32_t first, uint32_t last);
+
+/**
+ * Get range of fields that are shown by renderers.
+ *
+ * @param menu bm_menu instance where to get displayed fields.
+ * @param out_first Reference to uint32_t where first displayed field will be stored.
+ * @param out_last Reference to uint32_t where last displayed field will be stored.
+ */
+void bm_menu_get_display_fields(const struct bm_menu *menu, uint32_t *out_first, uint32_t *out_last);
+
 /**
  * Set amount of max vertical lines to be shown.
  * Some renderers such as ncurses may ignore this when it does not make sense.
@@ -499,6 +814,33 @@ void bm_menu_grab_keyboard(struct bm_menu *menu, bool grab);
  */
 bool bm_menu_is_keyboard_grabbed(struct bm_menu *menu);
 
+/**
+ * Hide or show menu.
+ * Hidden menu keeps its renderer, windows, items and cached data, so showing it again is cheap.
+ * Keyboard grab is released while hidden, and taken again when shown.
+ *
+ * Use bm_menu_reset to clear the filter and selection between uses.
+ *
+ * @param menu bm_menu instance to hide or show.
+ * @param visible true to show, false to hide.
+ */
+void bm_menu_set_visible(struct bm_menu *menu, bool visible);
+
+/**
+ * Is bm_menu shown?
+ *
+ * @param menu bm_menu instance where to check visibility from.
+ * @return true if shown, false if hidden.
+ */
+bool bm_menu_is_visible(const struct bm_menu *menu);
+
+/**
+ * Reset filter, highlight and selection of bm_menu, as if it was freshly created with its items.
+ *
+ * @param menu bm_menu instance to reset.
+ */
+void bm_menu_reset(struct bm_menu *menu);
+
 /**
  * Tell the renderer to position the menu that it can overlap panels.
  */
@@ -529,6 +871,21 @@ bool bm_menu_add_item_at(struct bm_menu *menu, struct bm_item *item, uint32_t in
  */
 bool bm_menu_add_item(struct bm_menu *menu, struct bm_item *item);
 
+/**
+ * Add items with texts to bm_menu instance.
+ * Items and copies of their texts are allocated in bulk from an arena of the menu,
+ * so adding and freeing millions of them takes a handful of allocations.
+ *
+ * The items belong to the menu, calling bm_item_free on them does nothing.
+ * They are freed by bm_menu_free_items or bm_menu_free, also when removed from menu before, and must not be added to other menus.
+ *
+ * @param menu bm_menu instance where items will be added.
+ * @param texts Array of null terminated C "strings", **NULL** entries are added as items without text.
+ * @param nmemb Number of texts.
+ * @return true on successful add, false on failure in which case items of texts before the failure were added.
+ */
+bool bm_menu_add_texts(struct bm_menu *menu, const char **texts, uint32_t nmemb);
+
 /**
  * Remove item from bm_menu instance at specific index.
  *
@@ -581,6 +938,7 @@ struct bm_item* bm_menu_get_highlighted_item(const struct bm_menu *menu);
 
 /**
  * Set selected items to bm_menu instance.
+ * Items that are not part of the menu are ignored.
  *
  * @param menu bm_menu instance where items will be set.
  * @param items Array of bm_item pointers to set.
@@ -624,6 +982,27 @@ bool bm_menu_set_items(struct bm_menu *menu, const struct bm_item **items, uint3
  */
 struct bm_item** bm_menu_get_items(const struct bm_menu *menu, uint32_t *out_nmemb);
 
+/**
+ * Attach bm_menu instance to bm_corpus, replacing its items with the items of corpus.
+ * Old items of menu are freed, and menu keeps a reference to the corpus until detached or freed.
+ *
+ * While attached, items can't be added or removed, and match and display fields of the menu are not applied.
+ * bm_menu_set_items and bm_menu_free_items detach the menu.
+ *
+ * @param menu bm_menu instance to attach.
+ * @param corpus bm_corpus instance to attach to, **NULL** to detach.
+ * @return true on success, false on failure.
+ */
+bool bm_menu_set_corpus(struct bm_menu *menu, struct bm_corpus *corpus);
+
+/**
+ * Get bm_corpus bm_menu instance is attached to.
+ *
+ * @param menu bm_menu instance where to get corpus from.
+ * @return bm_corpus instance, **NULL** if menu owns its items.
+ */
+struct bm_corpus* bm_menu_get_corpus(const struct bm_menu *menu);
+
 /**
  * Get filtered (displayed) items from bm_menu instance.
  *
@@ -683,6 +1062,43 @@ enum bm_key bm_menu_poll_key(struct bm_menu *menu, uint32_t *out_unicode);
  */
 enum bm_run_result bm_menu_run_with_key(struct bm_menu *menu, enum bm_key key, uint32_t unicode);
 
+/**
+ * Watch file descriptor while renderer waits for input.
+ *
+ * When watched file descriptor becomes readable, bm_menu_render and bm_menu_poll_key return without input,
+ * and bm_menu_poll_key returns BM_KEY_NONE or BM_KEY_UNICODE with zero unicode.
+ * This lets the caller read its own data sources without threads.
+ *
+ * @param menu bm_menu instance where to add file descriptor.
+ * @param fd File descriptor to watch.
+ * @return true if added successfully, false if out of memory.
+ */
+bool bm_menu_add_watch_fd(struct bm_menu *menu, int fd);
+
+/**
+ * Stop watching file descriptor.
+ *
+ * @param menu bm_menu instance where to remove file descriptor.
+ * @param fd File descriptor to remove, nothing happens if it was not watched.
+ */
+void bm_menu_remove_watch_fd(struct bm_menu *menu, int fd);
+
+/**
+ * Set how long renderer waits for input, before returning without input like with watched file descriptors.
+ *
+ * @param menu bm_menu instance where to set timeout.
+ * @param timeout Timeout in milliseconds, -1 waits until there is input.
+ */
+void bm_menu_set_poll_timeout(struct bm_menu *menu, int32_t timeout);
+
+/**
+ * Get how long renderer waits for input.
+ *
+ * @param menu bm_menu instance where to get timeout.
+ * @return Timeout in milliseconds, -1 if renderer waits until there is input.
+ */
+int32_t bm_menu_get_poll_timeout(const struct bm_menu *menu);
+
 /**  @} Menu Logic */
 
 /**  @} Menu */
@@ -750,10 +1166,86 @@ bool bm_item_set_text(struct bm_item *item, const char *text);
  */
 const char* bm_item_get_text(const struct bm_item *item);
 
+/**
+ * Set sort key to bm_item instance.
+ * Used when menu is sorted with BM_SORT_MODE_KEY.
+ *
+ * @param item bm_item instance where to set sort key.
+ * @param key Sort key, smaller keys are shown first.
+ */
+void bm_item_set_sort_key(struct bm_item *item, uint64_t key);
+
+/**
+ * Get sort key from bm_item instance.
+ *
+ * @param item bm_item instance where to get sort key from.
+ * @return Sort key, 0 if none was set.
+ */
+uint64_t bm_item_get_sort_key(const struct bm_item *item);
+
 /**  @} Item Properties */
 
 /**  @} Item */
 
+/**
+ * @addtogroup Corpus
+ * @{ */
+
+/**
+ * Create new bm_corpus instance from items.
+ *
+ * Text of items is hashed, signed and indexed once here, and shared by every bm_menu attached to the corpus.
+ * Items must not be changed or freed afterwards, the corpus owns them.
+ *
+ * @param items Array of bm_item pointers, the array itself is copied.
+ * @param nmemb Total count of items in array.
+ * @return bm_corpus with one reference for success, **NULL** on failure in which case caller still owns the items.
+ */
+struct bm_corpus* bm_corpus_new(struct bm_item **items, uint32_t nmemb);
+
+/**
+ * Create new bm_corpus instance from texts, keeping them front coded.
+ *
+ * Each text is stored as the length of prefix it shares with the previous text and the rest of it,
+ * so sorted lists with long common prefixes, such as paths, take a fraction of their size.
+ * Filters decode texts block by block while they scan, and items copy their text out only when it is asked for,
+ * for example by bm_item_get_text or by renderers. Alphabetical sort asks for text of every sorted item.
+ *
+ * Items match and display their whole text, and must not be changed or freed. Userdata and sort key may be set.
+ *
+ * @param texts Array of null terminated C "strings", **NULL** entries become empty items. Texts are copied.
+ * @param nmemb Total count of texts in array.
+ * @return bm_corpus with one reference for success, **NULL** on failure.
+ */
+struct bm_corpus* bm_corpus_new_packed(const char **texts, uint32_t nmemb);
+
+/**
+ * Take reference to bm_corpus instance.
+ *
+ * @param corpus bm_corpus instance to reference.
+ * @return The same bm_corpus instance.
+ */
+struct bm_corpus* bm_corpus_ref(struct bm_corpus *corpus);
+
+/**
+ * Drop reference to bm_corpus instance.
+ * Corpus and its items are freed when the last reference is dropped.
+ *
+ * @param corpus bm_corpus instance to release, may be **NULL**.
+ */
+void bm_corpus_unref(struct bm_corpus *corpus);
+
+/**
+ * Get items of bm_corpus instance.
+ *
+ * @param corpus bm_corpus instance from where to get items.
+ * @param out_nmemb Reference to uint32_t where total count of returned items will be stored.
+ * @return Pointer to array of bm_item pointers.
+ */
+struct bm_item** bm_corpus_get_items(const struct bm_corpus *corpus, uint32_t *out_nmemb);
+
+/**  @} Corpus */
+
 #endif /* _BEMENU_H_ */
 
 /* vim: set ts=8 sw=4 tw=0 :*/
@@ -0,0 +1,428 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Most tokens kept in cache, however small their sets are.
+ */
+static const uint32_t token_cache_entries = 256;
+
+/**
+ * Set of item indices.
+ * Sparse sets are kept as sorted indices, dense ones as bitmap, whichever takes less memory.
+ */
+struct bm_bitset {
+    /**
+     * Sorted indices of members, **NULL** if set is kept as bitmap.
+     */
+    uint32_t *indices;
+
+    /**
+     * Bit for each index of universe, **NULL** if set is kept as indices.
+     */
+    uint64_t *words;
+
+    /**
+     * Number of members, and number of indices members are from.
+     */
+    uint32_t count, universe;
+};
+
+/**
+ * Set of items matching one token.
+ */
+struct token_entry {
+    char *token;
+    size_t len;
+    uint64_t hash;
+    bool nocase;
+    struct bm_bitset *set;
+
+    /**
+     * Clock of cache when entry was last used, least recently used entries are evicted first.
+     */
+    uint64_t used;
+};
+
+struct bm_token_cache {
+    struct token_entry *entries;
+    uint32_t count;
+
+    /**
+     * Generation of item store the sets describe.
+     */
+    uint64_t generation;
+
+    /**
+     * Bytes taken by sets, and most bytes they may take.
+     */
+    size_t size, limit;
+
+    uint64_t clock;
+};
+
+static inline uint32_t
+words_for(uint32_t universe)
+{
+    return (universe + 63) / 64;
+}
+
+static size_t
+bitset_size(const struct bm_bitset *set)
+{
+    return sizeof(struct bm_bitset) + (set->words ? words_for(set->universe) * sizeof(uint64_t) : set->count * sizeof(uint32_t));
+}
+
+/**
+ * Create set from sorted indices.
+ *
+ * @param indices Sorted indices of members, may be **NULL** if count is 0.
+ * @param count Number of members.
+ * @param universe Number of indices members are from.
+ * @return bm_bitset for success, **NULL** on failure.
+ */
+struct bm_bitset*
+bm_bitset_new(const uint32_t *indices, uint32_t count, uint32_t universe)
+{
+    assert((indices || count == 0) && count <= universe);
+
+    struct bm_bitset *set;
+    if (!(set = bm_calloc(BM_MEMORY_FILTER, 1, sizeof(struct bm_bitset))))
+        return NULL;
+
+    set->count = count;
+    set->universe = universe;
+
+    if ((size_t)count * sizeof(uint32_t) < words_for(universe) * sizeof(uint64_t)) {
+        if (count > 0 && !(set->indices = bm_malloc(BM_MEMORY_FILTER, count * sizeof(uint32_t))))
+            goto fail;
+
+        if (count > 0)
+            memcpy(set->indices, indices, count * sizeof(uint32_t));
+    } else {
+        if (!(set->words = bm_calloc(BM_MEMORY_FILTER, words_for(universe), sizeof(uint64_t))))
+            goto fail;
+
+        for (uint32_t i = 0; i < count; ++i)
+            set->words[indices[i] / 64] |= (uint64_t)1 << (indices[i] % 64);
+    }
+
+    return set;
+
+fail:
+    bm_bitset_free(set);
+    return NULL;
+}
+
+/**
+ * Release set.
+ *
+ * @param set bm_bitset to free, may be **NULL**.
+ */
+void
+bm_bitset_free(struct bm_bitset *set)
+{
+    if (!set)
+        return;
+
+    bm_free(set->indices);
+    bm_free(set->words);
+    bm_free(set);
+}
+
+/**
+ * Get number of members in set.
+ *
+ * @param set bm_bitset to count.
+ * @return Number of members.
+ */
+uint32_t
+bm_bitset_get_count(const struct bm_bitset *set)
+{
+    assert(set);
+    return set->count;
+}
+
+/**
+ * Intersect sets of same universe.
+ *
+ * When the smallest set is sparse, its members are looked up in the others.
+ * When all sets are dense, bitmaps are ANDed a word at a time, which compilers vectorize.
+ *
+ * @param sets Array of sets to intersect.
+ * @param nsets Number of sets, at least one.
+ * @param out_indices Reference to sorted indices of members in all sets, **NULL** if there are none.
+ * @param out_count Reference to number of members in all sets.
+ * @return true on success, false if out of memory.
+ */
+bool
+bm_bitset_intersect(const struct bm_bitset **sets, uint32_t nsets, uint32_t **out_indices, uint32_t *out_count)
+{
+    assert(sets && nsets > 0 && out_indices && out_count);
+    *out_indices = NULL;
+    *out_count = 0;
+
+    const struct bm_bitset *smallest = sets[0];
+    for (uint32_t s = 1; s < nsets; ++s) {
+        assert(sets[s]->universe == smallest->universe);
+        if (sets[s]->count < smallest->count)
+            smallest = sets[s];
+    }
+
+    if (smallest->count == 0)
+        return true;
+
+    uint32_t *indices;
+    if (!(indices = bm_malloc(BM_MEMORY_FILTER, smallest->count * sizeof(uint32_t))))
+        return false;
+
+    uint32_t n = 0;
+    if (smallest->indices) {
+        uint32_t *cursors;
+        if (!(cursors = bm_calloc(BM_MEMORY_FILTER, nsets, sizeof(uint32_t)))) {
+            bm_free(indices);
+            return false;
+        }
+
+        /* members are sorted, so cursors of sparse sets only move forward */
+        for (uint32_t i = 0; i < smallest->count; ++i) {
+            const uint32_t index = smallest->indices[i];
+
+            uint32_t s;
+            for (s = 0; s < nsets; ++s) {
+                const struct bm_bitset *set = sets[s];
+                if (set == smallest)
+                    continue;
+
+                if (set->words) {
+                    if (!(set->words[index / 64] & ((uint64_t)1 << (index % 64))))
+                        break;
+                } else {
+                    for (; cursors[s] < set->count && set->indices[cursors[s]] < index; ++cursors[s]);
+                    if (cursors[s] >= set->count || set->indices[cursors[s]] != index)
+                        break;
+                }
+            }
+
+            if (s == nsets)
+                indices[n++] = index;
+        }
+
+        bm_free(cursors);
+    } else {
+        const uint32_t nwords = words_for(smallest->universe);
+        for (uint32_t w = 0; w < nwords; ++w) {
+            uint64_t word = sets[0]->words[w];
+            for (uint32_t s = 1; s < nsets; ++s)
+                word &= sets[s]->words[w];
+
+            for (; word; word &= word - 1)
+                indices[n++] = w * 64 + __builtin_ctzll(word);
+        }
+    }
+
+    if (n == 0) {
+        bm_free(indices);
+        return true;
+    }
+
+    *out_indices = indices;
+    *out_count = n;
+    return true;
+}
+
+/**
+ * Estimate work of intersecting sets of same universe with bm_bitset_intersect.
+ *
+ * @param sets Array of sets to intersect.
+ * @param nsets Number of sets, at least one.
+ * @return Number of members and words visited.
+ */
+uint64_t
+bm_bitset_intersect_cost(const struct bm_bitset **sets, uint32_t nsets)
+{
+    assert(sets && nsets > 0);
+
+    const struct bm_bitset *smallest = sets[0];
+    for (uint32_t s = 1; s < nsets; ++s) {
+        if (sets[s]->count < smallest->count)
+            smallest = sets[s];
+    }
+
+    if (!smallest->indices)
+        return (uint64_t)words_for(smallest->universe) * nsets;
+
+    /* each member of smallest is probed in every set, and cursors walk sparse sets once */
+    uint64_t cost = (uint64_t)smallest->count * nsets;
+    for (uint32_t s = 0; s < nsets; ++s) {
+        if (sets[s] != smallest && sets[s]->indices)
+            cost += sets[s]->count;
+    }
+
+    return cost;
+}
+
+/**
+ * Create cache of token sets.
+ *
+ * @param limit Most bytes sets may take.
+ * @return bm_token_cache for success, **NULL** on failure.
+ */
+struct bm_token_cache*
+bm_token_cache_new(size_t limit)
+{
+    struct bm_token_cache *cache;
+    if (!(cache = bm_calloc(BM_MEMORY_FILTER, 1, sizeof(struct bm_token_cache))))
+        return NULL;
+
+    cache->limit = limit;
+    return cache;
+}
+
+static void
+entry_release(struct bm_token_cache *cache, struct token_entry *entry)
+{
+    cache->size -= bitset_size(entry->set);
+    bm_bitset_free(entry->set);
+    bm_free(entry->token);
+}
+
+/**
+ * Drop all sets of cache.
+ *
+ * @param cache bm_token_cache to clear.
+ */
+void
+bm_token_cache_clear(struct bm_token_cache *cache)
+{
+    assert(cache);
+
+    for (uint32_t i = 0; i < cache->count; ++i)
+        entry_release(cache, &cache->entries[i]);
+
+    cache->count = 0;
+}
+
+/**
+ * Release cache and its sets.
+ *
+ * @param cache bm_token_cache to free, may be **NULL**.
+ */
+void
+bm_token_cache_free(struct bm_token_cache *cache)
+{
+    if (!cache)
+        return;
+
+    bm_token_cache_clear(cache);
+    bm_free(cache->entries);
+    bm_free(cache);
+}
+
+/**
+ * Sets of older generation describe items that changed since.
+ */
+static void
+sync_generation(struct bm_token_cache *cache, uint64_t generation)
+{
+    if (cache->generation == generation)
+        return;
+
+    bm_token_cache_clear(cache);
+    cache->generation = generation;
+}
+
+static struct token_entry*
+find_entry(struct bm_token_cache *cache, uint64_t hash, bool nocase, const char *token, size_t len)
+{
+    for (uint32_t i = 0; i < cache->count; ++i) {
+        struct token_entry *entry = &cache->entries[i];
+        if (entry->hash == hash && entry->nocase == nocase && entry->len == len && !memcmp(entry->token, token, len))
+            return entry;
+    }
+
+    return NULL;
+}
+
+/**
+ * Get set of items matching token.
+ *
+ * @param cache bm_token_cache to look from.
+ * @param generation Generation of item store that is filtered.
+ * @param nocase Whether token is matched case insensitively.
+ * @param token Token, does not need to be null terminated.
+ * @param len Length of token in bytes.
+ * @return Set owned by cache, valid until next put or clear. **NULL** if token is not cached.
+ */
+const struct bm_bitset*
+bm_token_cache_get(struct bm_token_cache *cache, uint64_t generation, bool nocase, const char *token, size_t len)
+{
+    assert(cache && token);
+    sync_generation(cache, generation);
+
+    struct token_entry *entry;
+    if (!(entry = find_entry(cache, bm_hash(token, len), nocase, token, len)))
+        return NULL;
+
+    entry->used = ++cache->clock;
+    return entry->set;
+}
+
+static void
+evict(struct bm_token_cache *cache, uint32_t i)
+{
+    entry_release(cache, &cache->entries[i]);
+    cache->entries[i] = cache->entries[--cache->count];
+}
+
+/**
+ * Keep set of items matching token, evicting least recently used sets to stay under limit of cache.
+ *
+ * @param cache bm_token_cache to keep set in.
+ * @param generation Generation of item store set was found from.
+ * @param nocase Whether token was matched case insensitively.
+ * @param token Token, does not need to be null terminated.
+ * @param len Length of token in bytes.
+ * @param set bm_bitset that cache takes, freed right away if it does not fit.
+ */
+void
+bm_token_cache_put(struct bm_token_cache *cache, uint64_t generation, bool nocase, const char *token, size_t len, struct bm_bitset *set)
+{
+    assert(cache && token && set);
+    sync_generation(cache, generation);
+
+    const uint64_t hash = bm_hash(token, len);
+    const size_t size = bitset_size(set);
+    if (size > cache->limit || find_entry(cache, hash, nocase, token, len))
+        goto drop;
+
+    while (cache->count > 0 && (cache->size + size > cache->limit || cache->count >= token_cache_entries)) {
+        uint32_t oldest = 0;
+        for (uint32_t i = 1; i < cache->count; ++i) {
+            if (cache->entries[i].used < cache->entries[oldest].used)
+                oldest = i;
+        }
+
+        evict(cache, oldest);
+    }
+
+    if (!cache->entries && !(cache->entries = bm_calloc(BM_MEMORY_FILTER, token_cache_entries, sizeof(struct token_entry))))
+        goto drop;
+
+    char *copy;
+    if (!(copy = bm_malloc(BM_MEMORY_FILTER, len + 1)))
+        goto drop;
+
+    memcpy(copy, token, len);
+    copy[len] = 0;
+
+    cache->entries[cache->count++] = (struct token_entry){ copy, len, hash, nocase, set, ++cache->clock };
+    cache->size += size;
+    return;
+
+drop:
+    bm_bitset_free(set);
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
@@ -0,0 +1,135 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Build store of corpus items.
+ */
+static bool
+build_store(struct bm_corpus *corpus)
+{
+    /* corpus is built once, so threads are only kept for the duration of the build */
+    struct bm_pool *pool = bm_pool_new(0);
+    const bool built = bm_item_store_build(&corpus->store, corpus->items, corpus->count, pool);
+    bm_pool_free(pool);
+
+    return (built && bm_item_store_build_initials(&corpus->store));
+}
+
+struct bm_corpus*
+bm_corpus_new(struct bm_item **items, uint32_t nmemb)
+{
+    assert(items || nmemb == 0);
+
+    struct bm_corpus *corpus;
+    if (!(corpus = bm_calloc(BM_MEMORY_ITEMS, 1, sizeof(struct bm_corpus))))
+        return NULL;
+
+    if (nmemb > 0 && !(corpus->items = bm_calloc(BM_MEMORY_ITEMS, nmemb, sizeof(struct bm_item*))))
+        goto fail;
+
+    if (nmemb > 0)
+        memcpy(corpus->items, items, sizeof(struct bm_item*) * nmemb);
+
+    corpus->count = nmemb;
+
+    if (!build_store(corpus))
+        goto fail;
+
+    corpus->refs = 1;
+    return corpus;
+
+fail:
+    bm_item_store_release(&corpus->store);
+    bm_free(corpus->items);
+    bm_free(corpus);
+    return NULL;
+}
+
+struct bm_corpus*
+bm_corpus_new_packed(const char **texts, uint32_t nmemb)
+{
+    assert(texts || nmemb == 0);
+
+    struct bm_corpus *corpus;
+    if (!(corpus = bm_calloc(BM_MEMORY_ITEMS, 1, sizeof(struct bm_corpus))))
+        return NULL;
+
+    if (!(corpus->pack = bm_pack_new(texts, nmemb)))
+        goto fail;
+
+    if (nmemb > 0 && !(corpus->items = bm_calloc(BM_MEMORY_ITEMS, nmemb, sizeof(struct bm_item*))))
+        goto fail;
+
+    if (nmemb > 0 && !(corpus->packed = bm_calloc(BM_MEMORY_ITEMS, nmemb, sizeof(struct bm_item))))
+        goto fail;
+
+    for (uint32_t i = 0; i < nmemb; ++i) {
+        struct bm_item *item = &corpus->packed[i];
+        item->len = (texts[i] ? strlen(texts[i]) : 0);
+        item->match = item->display = (struct span){ 0, item->len };
+        item->pack = corpus->pack;
+        item->pack_index = i;
+        corpus->items[i] = item;
+    }
+
+    corpus->count = nmemb;
+    corpus->store.pack = corpus->pack;
+
+    if (!build_store(corpus))
+        goto fail;
+
+    corpus->refs = 1;
+    return corpus;
+
+fail:
+    bm_item_store_release(&corpus->store);
+    bm_pack_free(corpus->pack);
+    bm_free(corpus->packed);
+    bm_free(corpus->items);
+    bm_free(corpus);
+    return NULL;
+}
+
+struct bm_corpus*
+bm_corpus_ref(struct bm_corpus *corpus)
+{
+    assert(corpus);
+    __atomic_add_fetch(&corpus->refs, 1, __ATOMIC_RELAXED);
+    return corpus;
+}
+
+void
+bm_corpus_unref(struct bm_corpus *corpus)
+{
+    if (!corpus || __atomic_sub_fetch(&corpus->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    if (corpus->packed) {
+        for (uint32_t i = 0; i < corpus->count; ++i)
+            bm_free(corpus->packed[i].text);
+    } else {
+        for (uint32_t i = 0; i < corpus->count; ++i)
+            bm_item_free(corpus->items[i]);
+    }
+
+    bm_item_store_release(&corpus->store);
+    bm_pack_free(corpus->pack);
+    bm_free(corpus->packed);
+    bm_free(corpus->items);
+    bm_free(corpus);
+}
+
+struct bm_item**
+bm_corpus_get_items(const struct bm_corpus *corpus, uint32_t *out_nmemb)
+{
+    assert(corpus);
+
+    if (out_nmemb)
+        *out_nmemb = corpus->count;
+
+    return corpus->items;
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
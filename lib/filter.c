@@ -2,36 +2,35 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <ctype.h>
 
 /**
- * Shrink struct bm_item** list pointer.
+ * Shrink uint32_t* index list pointer.
  *
  * Useful helper function for filter functions.
  *
- * @param in_out_list Pointer to pointer to list of bm_item pointers.
+ * @param in_out_list Pointer to pointer to list of indices.
  * @param osize Current size of the list.
  * @param nsize New size the list will be shrinked to.
- * @return Pointer to list of bm_item pointers.
+ * @return Pointer to list of indices.
  */
-static struct bm_item**
-shrink_list(struct bm_item ***in_out_list, size_t osize, size_t nsize)
+static uint32_t*
+shrink_list(uint32_t **in_out_list, size_t osize, size_t nsize)
 {
     assert(in_out_list);
 
     if (nsize == 0) {
-        free(*in_out_list);
+        bm_free(*in_out_list);
         return (*in_out_list = NULL);
     }
 
     if (nsize >= osize)
         return *in_out_list;
 
-    void *tmp = malloc(sizeof(struct bm_item*) * nsize);
+    void *tmp = bm_realloc(BM_MEMORY_FILTER, *in_out_list, sizeof(uint32_t) * nsize);
     if (!tmp)
         return *in_out_list;
 
-    memcpy(tmp, *in_out_list, sizeof(struct bm_item*) * nsize);
-    free(*in_out_list);
     return (*in_out_list = tmp);
 }
 
@@ -40,143 +39,1052 @@ shrink_list(struct bm_item ***in_out_list, size_t osize, size_t nsize)
  *
  * @param menu bm_menu instance which filter to tokenize.
  * @param out_tokv char pointer reference to list of tokens, this should be freed after use.
+ * @param out_tokl size_t pointer reference to list of token lengths, this should be freed after use.
  * @param out_tokc uint32_t reference to number of tokens.
  * @return Pointer to buffer that contains tokenized string, this should be freed after use.
  */
 static char*
-tokenize(struct bm_menu *menu, char ***out_tokv, uint32_t *out_tokc)
+tokenize(struct bm_menu *menu, char ***out_tokv, size_t **out_tokl, uint32_t *out_tokc)
 {
-    assert(menu && out_tokv && out_tokc);
+    assert(menu && out_tokv && out_tokl && out_tokc);
     *out_tokv = NULL;
+    *out_tokl = NULL;
     *out_tokc = 0;
 
     char **tokv = NULL, *buffer = NULL;
-    if (!(buffer = bm_strdup(menu->filter)))
+    size_t *tokl = NULL;
+    if (!(buffer = bm_strdup(BM_MEMORY_FILTER, menu->filter)))
         goto fail;
 
     char *s;
     for (s = buffer; *s && *s == ' '; ++s);
 
-    char **tmp = NULL;
     size_t pos = 0, next;
     uint32_t tokc = 0, tokn = 0;
-    for (; (pos = bm_strip_token(s, " ", &next)) > 0; tokv = tmp) {
-        if (++tokc > tokn && !(tmp = realloc(tokv, ++tokn * sizeof(char*))))
-            goto fail;
+    for (; (pos = bm_strip_token(s, " ", &next)) > 0;) {
+        if (++tokc > tokn) {
+            void *tmp;
+            if (!(tmp = bm_realloc(BM_MEMORY_FILTER, tokv, (tokn + 1) * sizeof(char*))))
+                goto fail;
+
+            tokv = tmp;
+
+            if (!(tmp = bm_realloc(BM_MEMORY_FILTER, tokl, (tokn + 1) * sizeof(size_t))))
+                goto fail;
 
-        tmp[tokc - 1] = s;
+            tokl = tmp;
+            ++tokn;
+        }
+
+        tokv[tokc - 1] = s;
+        tokl[tokc - 1] = pos;
         s += next;
         for (; *s && *s == ' '; ++s);
     }
 
-    *out_tokv = tmp;
+    *out_tokv = tokv;
+    *out_tokl = tokl;
     *out_tokc = tokc;
     return buffer;
 
 fail:
-    free(buffer);
-    free(tokv);
+    bm_free(buffer);
+    bm_free(tokv);
+    bm_free(tokl);
     return NULL;
 }
 
 /**
- * Dmenu filterer that accepts substring function.
+ * Tokenized filter, shared by the specialized filter kernels.
+ */
+struct filter_query {
+    char **tokv;
+    size_t *tokl;
+    uint32_t tokc;
+
+    /**
+     * Union of token signatures, items missing any of these characters can't match.
+     */
+    uint64_t signature;
+
+    /**
+     * Case folded hash of the first token, used to reject exact matches early.
+     */
+    uint64_t hash;
+
+    /**
+     * Last token, which ranks hits in last path component.
+     */
+    const char *name_token;
+    size_t name_len;
+
+    /**
+     * Fuzzy match progress by item index, extended with fuzzy_text.
+     * Progress is reset before extending, unless only fuzzy_text was appended to the filter it was matched with.
+     */
+    struct fuzzy_match *fuzzy;
+    const char *fuzzy_text;
+    size_t fuzzy_len;
+    bool fuzzy_extend;
+
+    /**
+     * Best possible fuzzy score of the whole filter, scores are ranked relative to it.
+     */
+    int32_t fuzzy_max;
+};
+
+/**
+ * Rank of filtered item, lower ranks are listed first.
+ */
+enum filter_rank {
+    FILTER_RANK_EXACT,
+    FILTER_RANK_PREFIX,
+    FILTER_RANK_OTHER,
+    FILTER_RANK_LAST
+};
+
+static inline bool
+equal_case(const char *a, const char *b, size_t len)
+{
+    return !memcmp(a, b, len);
+}
+
+static inline bool
+equal_nocase(const char *a, const char *b, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (toupper((unsigned char)a[i]) != toupper((unsigned char)b[i]))
+            return false;
+    }
+    return true;
+}
+
+static inline bool
+match_case(const char *hay, size_t hay_len, const char *needle, size_t len)
+{
+    if (len > hay_len)
+        return false;
+
+    for (const char *s = hay, *end = hay + hay_len - len + 1; (s = memchr(s, *needle, end - s)); ++s) {
+        if (!memcmp(s + 1, needle + 1, len - 1))
+            return true;
+    }
+
+    return false;
+}
+
+static inline bool
+match_nocase(const char *hay, size_t hay_len, const char *needle, size_t len)
+{
+    if (len > hay_len)
+        return false;
+
+    const int first = toupper((unsigned char)*needle);
+    for (size_t i = 0; i + len <= hay_len; ++i) {
+        if (toupper((unsigned char)hay[i]) == first && equal_nocase(hay + i + 1, needle + 1, len - 1))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Ranks dmenu style: exact matches of first token, then prefixes, then the rest.
+ * Expands inside a filter kernel, where text, text_len, index, store and query are in scope.
+ */
+#define DMENU_RANK(fmatch, fequal) \
+    (text_len == query->tokl[0] && store->hash[index] == query->hash && fequal(text, query->tokv[0], query->tokl[0]) ? FILTER_RANK_EXACT : \
+     (text_len >= query->tokl[0] && fequal(text, query->tokv[0], query->tokl[0]) ? FILTER_RANK_PREFIX : FILTER_RANK_OTHER))
+
+/**
+ * Ranks by where the last token hits: whole last path component, inside it, or only in directories.
+ * Leading tokens usually narrow down directories, so they don't affect the rank.
+ */
+#define PATH_RANK(fmatch, fequal) \
+    (text_len - store->basename[index] == query->name_len && fequal(text + store->basename[index], query->name_token, query->name_len) ? FILTER_RANK_EXACT : \
+     (fmatch(text + store->basename[index], text_len - store->basename[index], query->name_token, query->name_len) ? FILTER_RANK_PREFIX : FILTER_RANK_OTHER))
+
+/**
+ * Ranks nothing, for kernels that only find items matching a token.
+ */
+#define NO_RANK(fmatch, fequal) FILTER_RANK_OTHER
+
+/**
+ * Define filter kernel for one ranking, case sensitivity and token count.
+ *
+ * Matching and comparison are inlined into the loop instead of being called through pointers.
+ * Kernel filters range [begin, end) of source, writes matching item indices to out and their ranks to ranks,
+ * and returns the match count. Query must have at least one token.
+ */
+#define DEFINE_FILTER_KERNEL(name, rank, fmatch, fequal, single) \
+static uint32_t \
+name(const struct bm_item_store *store, const uint32_t *source, uint32_t begin, uint32_t end, const struct filter_query *query, uint32_t *out, uint8_t *ranks) \
+{ \
+    struct bm_pack_reader reader; \
+    bm_pack_reader_init(&reader, store->pack); \
+    uint32_t f = 0; \
+    for (uint32_t i = begin; i < end; ++i) { \
+        const uint32_t index = (source ? source[i] : i); \
+        if ((store->signature[index] & query->signature) != query->signature) \
+            continue; \
+        const char *text = (store->pack ? bm_pack_read(&reader, index, NULL) : store->text[index]); \
+        const uint32_t text_len = store->len[index]; \
+        if (!text) \
+            continue; \
+        if (single) { \
+            if (!fmatch(text, text_len, query->tokv[0], query->tokl[0])) \
+                continue; \
+        } else { \
+            uint32_t t; \
+            for (t = 0; t < query->tokc && fmatch(text, text_len, query->tokv[t], query->tokl[t]); ++t); \
+            if (t < query->tokc) \
+                continue; \
+        } \
+        ranks[f] = rank(fmatch, fequal); \
+        out[f++] = index; \
+    } \
+    return f; \
+}
+
+DEFINE_FILTER_KERNEL(dmenu_kernel_case_single, DMENU_RANK, match_case, equal_case, true)
+DEFINE_FILTER_KERNEL(dmenu_kernel_case_multi, DMENU_RANK, match_case, equal_case, false)
+DEFINE_FILTER_KERNEL(dmenu_kernel_nocase_single, DMENU_RANK, match_nocase, equal_nocase, true)
+DEFINE_FILTER_KERNEL(dmenu_kernel_nocase_multi, DMENU_RANK, match_nocase, equal_nocase, false)
+DEFINE_FILTER_KERNEL(path_kernel_case_single, PATH_RANK, match_case, equal_case, true)
+DEFINE_FILTER_KERNEL(path_kernel_case_multi, PATH_RANK, match_case, equal_case, false)
+DEFINE_FILTER_KERNEL(path_kernel_nocase_single, PATH_RANK, match_nocase, equal_nocase, true)
+DEFINE_FILTER_KERNEL(path_kernel_nocase_multi, PATH_RANK, match_nocase, equal_nocase, false)
+DEFINE_FILTER_KERNEL(token_kernel_case, NO_RANK, match_case, equal_case, true)
+DEFINE_FILTER_KERNEL(token_kernel_nocase, NO_RANK, match_nocase, equal_nocase, true)
+
+#undef DEFINE_FILTER_KERNEL
+#undef NO_RANK
+#undef PATH_RANK
+#undef DMENU_RANK
+
+typedef uint32_t (*filter_kernel)(const struct bm_item_store *store, const uint32_t *source, uint32_t begin, uint32_t end, const struct filter_query *query, uint32_t *out, uint8_t *ranks);
+
+/**
+ * Lists smaller than this are filtered on the calling thread only.
+ */
+static const uint32_t parallel_threshold = 1 << 15;
+
+/**
+ * Kernel ran over chunks of the filtered list.
+ * Each chunk writes its matches to the start of its own range of out and ranks.
+ */
+struct filter_job {
+    const struct bm_item_store *store;
+    const uint32_t *source;
+    const struct filter_query *query;
+    filter_kernel kernel;
+    uint32_t begin, count, chunk;
+    uint32_t *out;
+    uint8_t *ranks;
+
+    /**
+     * Number of matches in each chunk.
+     */
+    uint32_t *matches;
+};
+
+static void
+filter_chunks(void *data, uint32_t begin, uint32_t end)
+{
+    struct filter_job *job = data;
+
+    for (uint32_t c = begin; c < end; ++c) {
+        const uint32_t first = c * job->chunk;
+        const uint32_t last = (job->count - first > job->chunk ? first + job->chunk : job->count);
+        job->matches[c] = job->kernel(job->store, job->source, job->begin + first, job->begin + last, job->query, job->out + first, job->ranks + first);
+    }
+}
+
+/**
+ * Run kernel over range [begin, end) of source, split to chunks for the menu's thread pool if the range is large.
+ *
+ * @return Number of matches, packed to the start of out and ranks. UINT32_MAX if out of memory.
+ */
+static uint32_t
+run_kernel(struct bm_menu *menu, filter_kernel kernel, const uint32_t *source, uint32_t begin, uint32_t end, const struct filter_query *query, uint32_t *out, uint8_t *ranks)
+{
+    const uint32_t count = end - begin;
+    const uint32_t threads = bm_pool_get_thread_count(menu->pool);
+    if (threads < 2 || count < parallel_threshold)
+        return kernel(&menu->store, source, begin, end, query, out, ranks);
+
+    const uint32_t chunk = (count + threads * 4 - 1) / (threads * 4);
+    const uint32_t nchunks = (count + chunk - 1) / chunk;
+
+    uint32_t *matches;
+    if (!(matches = bm_calloc(BM_MEMORY_FILTER, nchunks, sizeof(uint32_t))))
+        return UINT32_MAX;
+
+    struct filter_job job = { &menu->store, source, query, kernel, begin, count, chunk, out, ranks, matches };
+    bm_pool_parallel_for(menu->pool, nchunks, 1, filter_chunks, &job);
+
+    uint32_t f = matches[0];
+    for (uint32_t c = 1; c < nchunks; ++c) {
+        memmove(out + f, out + c * chunk, matches[c] * sizeof(uint32_t));
+        memmove(ranks + f, ranks + c * chunk, matches[c] * sizeof(uint8_t));
+        f += matches[c];
+    }
+
+    bm_free(matches);
+    return f;
+}
+
+/**
+ * Group filter results by rank with stable counting sort.
+ *
+ * @param in_out_filtered Reference to item indices, replaced with grouped list.
+ * @param ranks Ranks of indices, grouped along with them.
+ * @param count Number of indices.
+ * @param nranks Number of distinct ranks, at most 256.
+ * @return true on success, false if out of memory.
+ */
+bool
+bm_filter_group_by_rank(uint32_t **in_out_filtered, uint8_t *ranks, uint32_t count, uint32_t nranks)
+{
+    assert(in_out_filtered && nranks <= 256);
+
+    if (count == 0)
+        return true;
+
+    uint32_t *ranked;
+    if (!(ranked = bm_calloc(BM_MEMORY_FILTER, count, sizeof(uint32_t))))
+        return false;
+
+    uint32_t offsets[256] = {0};
+    for (uint32_t i = 0; i < count; ++i)
+        offsets[ranks[i]]++;
+
+    for (uint32_t r = 0, sum = 0; r < nranks; ++r) {
+        const uint32_t n = offsets[r];
+        offsets[r] = sum;
+        sum += n;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+        ranked[offsets[ranks[i]]++] = (*in_out_filtered)[i];
+
+    /* ranked is grouped by rank now, offsets hold the end of each group */
+    for (uint32_t r = 0, i = 0; r < nranks; ++r) {
+        for (; i < offsets[r]; ++i)
+            ranks[i] = r;
+    }
+
+    bm_free(*in_out_filtered);
+    *in_out_filtered = ranked;
+    return true;
+}
+
+/**
+ * Put narrowed down matches back to item order, previous results are ordered by ranks that changed since.
+ * Grouping by rank then leaves ties in item order, the same as filtering all items.
+ * Sorted with LSD radix sort of 11-bit digits, as narrowed down results may still hold most items.
+ *
+ * @param filtered Item indices to sort.
+ * @param ranks Ranks of indices, sorted along with them.
+ * @param count Number of indices.
+ * @return true on success, false if out of memory.
+ */
+bool
+bm_filter_sort_by_index(uint32_t *filtered, uint8_t *ranks, uint32_t count)
+{
+    assert(filtered && (ranks || count == 0));
+
+    uint32_t sorted;
+    for (sorted = 1; sorted < count && filtered[sorted - 1] < filtered[sorted]; ++sorted);
+
+    /* results narrowed down from item order are still in item order */
+    if (sorted >= count)
+        return true;
+
+    uint64_t *keys;
+    if (!(keys = bm_calloc(BM_MEMORY_FILTER, count, sizeof(uint64_t) * 2)))
+        return false;
+
+    uint32_t *histograms;
+    if (!(histograms = bm_calloc(BM_MEMORY_FILTER, 3 * 2048, sizeof(uint32_t)))) {
+        bm_free(keys);
+        return false;
+    }
+
+    /* rank is carried in the low byte, index is sorted from the bits above it */
+    for (uint32_t i = 0; i < count; ++i) {
+        keys[i] = ((uint64_t)filtered[i] << 8) | ranks[i];
+        for (uint32_t d = 0; d < 3; ++d)
+            histograms[d * 2048 + ((keys[i] >> (8 + d * 11)) & 2047)]++;
+    }
+
+    uint64_t *src = keys, *dst = keys + count;
+    for (uint32_t d = 0; d < 3; ++d) {
+        uint32_t *histogram = histograms + d * 2048;
+
+        bool trivial = false;
+        for (uint32_t b = 0, offset = 0; b < 2048; ++b) {
+            const uint32_t n = histogram[b];
+            trivial = trivial || (n == count);
+            histogram[b] = offset;
+            offset += n;
+        }
+
+        if (trivial)
+            continue;
+
+        for (uint32_t i = 0; i < count; ++i)
+            dst[histogram[(src[i] >> (8 + d * 11)) & 2047]++] = src[i];
+
+        uint64_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        filtered[i] = src[i] >> 8;
+        ranks[i] = src[i] & 0xff;
+    }
+
+    bm_free(histograms);
+    bm_free(keys);
+    return true;
+}
+
+/**
+ * Keep set of items that matched token in menu's token cache.
+ *
+ * @return true on success, false if out of memory.
+ */
+static bool
+cache_token(struct bm_menu *menu, bool nocase, const char *token, size_t len, const uint32_t *matches, uint32_t count)
+{
+    struct bm_bitset *set;
+    if (!(set = bm_bitset_new(matches, count, menu->store.count)))
+        return false;
+
+    bm_token_cache_put(menu->tokens, menu->store.generation, nocase, token, len, set);
+    return true;
+}
+
+/**
+ * Filter all items of menu with help of its token cache.
+ *
+ * Items in sets of all cached tokens are the only candidates, and kernel only matches them.
+ * Without cached tokens, each token is matched against all items on its own and its set is cached,
+ * so editing one token later only matches that token against items matching the others.
+ * Single token is matched once, its matches are its set.
+ *
+ * @return Number of matches, packed to the start of out and ranks. UINT32_MAX if out of memory.
+ */
+static uint32_t
+filter_cached(struct bm_menu *menu, bool nocase, filter_kernel kernel, const struct filter_query *query, uint32_t *out, uint8_t *ranks)
+{
+    const struct bm_item_store *store = &menu->store;
+
+    const struct bm_bitset **sets;
+    if (!(sets = bm_calloc(BM_MEMORY_FILTER, query->tokc, sizeof(struct bm_bitset*))))
+        return UINT32_MAX;
+
+    uint32_t nsets = 0;
+    for (uint32_t t = 0; t < query->tokc; ++t) {
+        if ((sets[nsets] = bm_token_cache_get(menu->tokens, store->generation, nocase, query->tokv[t], query->tokl[t])))
+            ++nsets;
+    }
+
+    uint32_t f;
+    if (nsets == 0 && query->tokc == 1) {
+        if ((f = run_kernel(menu, kernel, NULL, 0, store->count, query, out, ranks)) != UINT32_MAX)
+            cache_token(menu, nocase, query->tokv[0], query->tokl[0], out, f);
+
+        bm_free(sets);
+        return f;
+    }
+
+    struct bm_bitset **scanned = NULL;
+    if (nsets == 0) {
+        if (!(scanned = bm_calloc(BM_MEMORY_FILTER, query->tokc, sizeof(struct bm_bitset*))))
+            goto fail;
+
+        /* out and ranks hold all items, so they are scratch for matches of each token */
+        const filter_kernel token_kernel = (nocase ? token_kernel_nocase : token_kernel_case);
+        for (uint32_t t = 0; t < query->tokc; ++t) {
+            struct filter_query token = {0};
+            token.tokv = query->tokv + t;
+            token.tokl = query->tokl + t;
+            token.tokc = 1;
+            token.signature = bm_signature(query->tokv[t], query->tokl[t]);
+            if ((f = run_kernel(menu, token_kernel, NULL, 0, store->count, &token, out, ranks)) == UINT32_MAX)
+                goto fail;
+
+            if (!(scanned[t] = bm_bitset_new(out, f, store->count)))
+                goto fail;
+
+            sets[nsets++] = scanned[t];
+        }
+    }
+
+    uint32_t *candidates, ncandidates;
+    if (!bm_bitset_intersect(sets, nsets, &candidates, &ncandidates))
+        goto fail;
+
+    f = run_kernel(menu, kernel, candidates, 0, ncandidates, query, out, ranks);
+    bm_free(candidates);
+
+    /* cache drops sets it does not keep, and may evict the looked up sets */
+    if (scanned) {
+        for (uint32_t t = 0; t < query->tokc; ++t)
+            bm_token_cache_put(menu->tokens, store->generation, nocase, query->tokv[t], query->tokl[t], scanned[t]);
+    }
+
+    bm_free(scanned);
+    bm_free(sets);
+    return f;
+
+fail:
+    if (scanned) {
+        for (uint32_t t = 0; t < query->tokc; ++t)
+            bm_bitset_free(scanned[t]);
+    }
+
+    bm_free(scanned);
+    bm_free(sets);
+    return UINT32_MAX;
+}
+
+/**
+ * Ranking filterer that runs the kernel picked for token count.
  *
  * @param menu bm_menu instance to filter.
- * @param addition This will be 1, if filter is same as previous filter with something appended.
- * @param fstrstr Substring function used to match items.
+ * @param source Item indices to filter, **NULL** to filter items directly.
+ * @param begin First entry of source, or first item, to filter.
+ * @param end One past last entry of source, or last item, to filter.
+ * @param nocase Whether kernels match case insensitively.
+ * @param single Kernel used when filter has exactly one token.
+ * @param multi Kernel used when filter has more tokens.
+ * @param out_ranks Reference to array where rank of each filtered item is stored, may be **NULL**.
  * @param out_nmemb uint32_t reference to filtered items count.
- * @return Pointer to array of bm_item pointers.
+ * @return Pointer to array of item indices, stable sorted by rank.
  */
-struct bm_item**
-filter_dmenu_fun(struct bm_menu *menu, char addition, char* (*fstrstr)(const char *a, const char *b), int (*fstrncmp)(const char *a, const char *b, size_t len), uint32_t *out_nmemb)
+static uint32_t*
+filter_ranked(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, bool nocase, filter_kernel single, filter_kernel multi, uint8_t **out_ranks, uint32_t *out_nmemb)
 {
-    assert(menu && fstrstr && fstrncmp && out_nmemb);
+    assert(menu && begin <= end && single && multi && out_nmemb);
     *out_nmemb = 0;
 
-    uint32_t count;
-    struct bm_item **items;
+    if (out_ranks)
+        *out_ranks = NULL;
+
+    const uint32_t count = end - begin;
+
+    struct filter_query query = {0};
+    char *buffer = NULL;
+    uint8_t *ranks = NULL;
+    uint32_t *filtered = NULL;
+    if (!(filtered = bm_calloc(BM_MEMORY_FILTER, count, sizeof(uint32_t))))
+        goto fail;
+
+    if (!(ranks = bm_calloc(BM_MEMORY_FILTER, count, sizeof(uint8_t))))
+        goto fail;
+
+    if (!(buffer = tokenize(menu, &query.tokv, &query.tokl, &query.tokc)))
+        goto fail;
+
+    uint32_t f = 0;
+    if (query.tokc == 0) {
+        for (; f < count; ++f)
+            filtered[f] = (source ? source[begin + f] : begin + f);
+    } else {
+        for (uint32_t t = 0; t < query.tokc; ++t)
+            query.signature |= bm_signature(query.tokv[t], query.tokl[t]);
+
+        query.hash = bm_hash(query.tokv[0], query.tokl[0]);
+        query.name_token = query.tokv[query.tokc - 1];
+        query.name_len = query.tokl[query.tokc - 1];
+        /* token cache describes all items, so it only helps when all of them are filtered */
+        const filter_kernel kernel = (query.tokc == 1 ? single : multi);
+        const bool cached = (menu->plan.strategy == BM_PLAN_TOKENS || menu->plan.strategy == BM_PLAN_SPLIT);
+        if (cached && menu->tokens && !source && begin == 0 && end == menu->store.count) {
+            f = filter_cached(menu, nocase, kernel, &query, filtered, ranks);
+        } else {
+            f = run_kernel(menu, kernel, source, begin, end, &query, filtered, ranks);
+        }
+
+        if (f == UINT32_MAX)
+            goto fail;
+
+        /* every plan lists ties in item order, so results don't depend on how filter was typed */
+        if (source && f > 1 && !bm_filter_sort_by_index(filtered, ranks, f))
+            goto fail;
+
+        if (!bm_filter_group_by_rank(&filtered, ranks, f, FILTER_RANK_LAST))
+            goto fail;
+    }
 
-    if (addition) {
-        items = bm_menu_get_filtered_items(menu, &count);
+    bm_free(buffer);
+    bm_free(query.tokv);
+    bm_free(query.tokl);
+
+    if (out_ranks && f > 0) {
+        *out_ranks = ranks;
     } else {
-        items = bm_menu_get_items(menu, &count);
+        bm_free(ranks);
+    }
+
+    return shrink_list(&filtered, count, (*out_nmemb = f));
+
+fail:
+    bm_free(filtered);
+    bm_free(ranks);
+    bm_free(buffer);
+    bm_free(query.tokv);
+    bm_free(query.tokl);
+    return NULL;
+}
+
+/**
+ * Filter that mimics the vanilla dmenu filtering.
+ *
+ * @param menu bm_menu instance to filter.
+ * @param source Item indices to filter, **NULL** to filter items directly.
+ * @param begin First entry of source, or first item, to filter.
+ * @param end One past last entry of source, or last item, to filter.
+ * @param out_ranks Reference to array where rank of each filtered item is stored, may be **NULL**.
+ * @param out_nmemb uint32_t reference to filtered items count.
+ * @return Pointer to array of item indices.
+ */
+uint32_t*
+bm_filter_dmenu(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb)
+{
+    return filter_ranked(menu, source, begin, end, false, dmenu_kernel_case_single, dmenu_kernel_case_multi, out_ranks, out_nmemb);
+}
+
+/**
+ * Filter that mimics the vanilla case-insensitive dmenu filtering.
+ *
+ * @param menu bm_menu instance to filter.
+ * @param source Item indices to filter, **NULL** to filter items directly.
+ * @param begin First entry of source, or first item, to filter.
+ * @param end One past last entry of source, or last item, to filter.
+ * @param out_ranks Reference to array where rank of each filtered item is stored, may be **NULL**.
+ * @param out_nmemb uint32_t reference to filtered items count.
+ * @return Pointer to array of item indices.
+ */
+uint32_t*
+bm_filter_dmenu_case_insensitive(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb)
+{
+    return filter_ranked(menu, source, begin, end, true, dmenu_kernel_nocase_single, dmenu_kernel_nocase_multi, out_ranks, out_nmemb);
+}
+
+/**
+ * Filter that ranks hits in last path component first.
+ *
+ * @param menu bm_menu instance to filter.
+ * @param source Item indices to filter, **NULL** to filter items directly.
+ * @param begin First entry of source, or first item, to filter.
+ * @param end One past last entry of source, or last item, to filter.
+ * @param out_ranks Reference to array where rank of each filtered item is stored, may be **NULL**.
+ * @param out_nmemb uint32_t reference to filtered items count.
+ * @return Pointer to array of item indices.
+ */
+uint32_t*
+bm_filter_path(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb)
+{
+    return filter_ranked(menu, source, begin, end, false, path_kernel_case_single, path_kernel_case_multi, out_ranks, out_nmemb);
+}
+
+/**
+ * Case-insensitive filter that ranks hits in last path component first.
+ *
+ * @param menu bm_menu instance to filter.
+ * @param source Item indices to filter, **NULL** to filter items directly.
+ * @param begin First entry of source, or first item, to filter.
+ * @param end One past last entry of source, or last item, to filter.
+ * @param out_ranks Reference to array where rank of each filtered item is stored, may be **NULL**.
+ * @param out_nmemb uint32_t reference to filtered items count.
+ * @return Pointer to array of item indices.
+ */
+uint32_t*
+bm_filter_path_case_insensitive(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb)
+{
+    return filter_ranked(menu, source, begin, end, true, path_kernel_nocase_single, path_kernel_nocase_multi, out_ranks, out_nmemb);
+}
+
+/**
+ * Match needle against word initials in order, skipping initials as needed.
+ *
+ * @param initials Word initials of item as code points, ASCII upper cased.
+ * @param count Number of initials.
+ * @param needle Text to match, does not need to be null terminated.
+ * @param len Length of needle in bytes.
+ * @return true if every character of needle matched a word initial.
+ */
+static bool
+match_initials(const uint32_t *initials, uint32_t count, const char *needle, size_t len)
+{
+    uint32_t i = 0;
+    for (size_t n = 0, u8len; n < len; n += u8len) {
+        uint32_t rune = bm_utf8_rune_decode(needle + n, len - n, &u8len);
+        rune = (rune < 0x80 ? (uint32_t)toupper(rune) : rune);
+
+        for (; i < count && initials[i] != rune; ++i);
+
+        if (i++ >= count)
+            return false;
     }
 
+    return true;
+}
+
+/**
+ * Filter that matches query against word starts of items.
+ * Acronym hits are listed first, then case-insensitive substring hits, both in item order.
+ *
+ * @param menu bm_menu instance to filter.
+ * @param source Item indices to filter, **NULL** to filter items directly.
+ * @param begin First entry of source, or first item, to filter.
+ * @param end One past last entry of source, or last item, to filter.
+ * @param out_ranks Reference to array where rank of each filtered item is stored, may be **NULL**.
+ * @param out_nmemb uint32_t reference to filtered items count.
+ * @return Pointer to array of item indices.
+ */
+uint32_t*
+bm_filter_acronym(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb)
+{
+    assert(menu && begin <= end && out_nmemb);
+    *out_nmemb = 0;
+
+    if (out_ranks)
+        *out_ranks = NULL;
+
+    struct bm_item_store *store = &menu->store;
+    if (!bm_item_store_build_initials(store))
+        return NULL;
+
+    const uint32_t count = end - begin;
+
     char *buffer = NULL;
-    struct bm_item **filtered;
-    if (!(filtered = calloc(count, sizeof(struct bm_item*))))
+    uint32_t *filtered;
+    if (!(filtered = bm_calloc(BM_MEMORY_FILTER, count, sizeof(uint32_t))))
         goto fail;
 
     char **tokv;
+    size_t *tokl;
     uint32_t tokc;
-    if (!(buffer = tokenize(menu, &tokv, &tokc)))
+    if (!(buffer = tokenize(menu, &tokv, &tokl, &tokc)))
         goto fail;
 
-    size_t len = (tokc ? strlen(tokv[0]) : 0);
-    uint32_t i, f, e;
-    for (e = f = i = 0; i < count; ++i) {
-        struct bm_item *item = items[i];
-        if (!item->text && tokc != 0)
+    uint64_t signature = 0;
+    for (uint32_t t = 0; t < tokc; ++t)
+        signature |= bm_signature(tokv[t], tokl[t]);
+
+    struct bm_pack_reader reader;
+    bm_pack_reader_init(&reader, store->pack);
+
+    /* initials of packed texts are found as they are decoded */
+    uint32_t *decoded = NULL;
+    uint32_t decoded_allocated = 0;
+
+    /* acronym hits grow from the front, substring hits from the back */
+    uint32_t a = 0, s = 0;
+    for (uint32_t i = begin; i < end; ++i) {
+        const uint32_t index = (source ? source[i] : i);
+        if ((store->signature[index] & signature) != signature)
+            continue;
+
+        const char *text = (store->pack ? bm_pack_read(&reader, index, NULL) : store->text[index]);
+        if (!text && tokc != 0)
             continue;
 
-        if (tokc && item->text) {
-            uint32_t t;
-            for (t = 0; t < tokc && fstrstr(item->text, tokv[t]); ++t);
-            if (t < tokc)
-                continue;
+        const uint32_t *initials;
+        uint32_t ninitials;
+        if (store->pack) {
+            if (store->len[index] > decoded_allocated) {
+                void *tmp;
+                if (!(tmp = bm_realloc(BM_MEMORY_FILTER, decoded, sizeof(uint32_t) * store->len[index]))) {
+                    bm_free(decoded);
+                    bm_free(tokv);
+                    bm_free(tokl);
+                    goto fail;
+                }
+                decoded = tmp;
+                decoded_allocated = store->len[index];
+            }
+
+            ninitials = bm_initials(text, store->len[index], decoded);
+            initials = decoded;
+        } else {
+            initials = store->initials + store->initials_offset[index];
+            ninitials = store->initials_offset[index + 1] - store->initials_offset[index];
         }
 
-        if (tokc && item->text && !fstrncmp(tokv[0], item->text, len + 1)) { /* exact matches */
-            memmove(&filtered[1], filtered, f * sizeof(struct bm_item*));
-            filtered[0] = item;
-            e++; /* where do exact matches end */
-        } else if (tokc && item->text && !fstrncmp(tokv[0], item->text, len)) { /* prefixes */
-            memmove(&filtered[e + 1], &filtered[e], (f - e) * sizeof(struct bm_item*));
-            filtered[e] = item;
-            e++; /* where do exact matches end */
+        bool acronym = true;
+        uint32_t t;
+        for (t = 0; t < tokc; ++t) {
+            const bool initial = match_initials(initials, ninitials, tokv[t], tokl[t]);
+
+            if (!initial && !bm_strnupstr(text, store->len[index], tokv[t], tokl[t]))
+                break;
+
+            acronym = acronym && initial;
+        }
+
+        if (t < tokc)
+            continue;
+
+        if (acronym) {
+            filtered[a++] = index;
         } else {
-            filtered[f] = item;
+            filtered[count - ++s] = index;
         }
-        f++; /* where do all matches end */
     }
 
-    free(buffer);
-    free(tokv);
-    return shrink_list(&filtered, menu->items.count, (*out_nmemb = f));
+    for (uint32_t i = count - s, j = count - 1; i < j; ++i, --j) {
+        const uint32_t tmp = filtered[i];
+        filtered[i] = filtered[j];
+        filtered[j] = tmp;
+    }
+
+    memmove(&filtered[a], &filtered[count - s], s * sizeof(uint32_t));
+
+    bm_free(decoded);
+    bm_free(buffer);
+    bm_free(tokv);
+    bm_free(tokl);
+    buffer = NULL;
+
+    /* acronym hits rank before substring hits */
+    const uint32_t f = a + s;
+    uint8_t *ranks = NULL;
+    if ((out_ranks || source) && f > 0) {
+        if (!(ranks = bm_malloc(BM_MEMORY_FILTER, f)))
+            goto fail;
+
+        memset(ranks, 0, a);
+        memset(ranks + a, 1, s);
+    }
+
+    /* narrowed down hits follow previous results, put both groups back to item order */
+    if (source && f > 1 && (!bm_filter_sort_by_index(filtered, ranks, f) || !bm_filter_group_by_rank(&filtered, ranks, f, 2))) {
+        bm_free(ranks);
+        goto fail;
+    }
+
+    if (out_ranks && f > 0) {
+        *out_ranks = ranks;
+    } else {
+        bm_free(ranks);
+    }
+
+    return shrink_list(&filtered, count, (*out_nmemb = f));
 
 fail:
-    free(filtered);
-    free(buffer);
+    bm_free(filtered);
+    bm_free(buffer);
     return NULL;
 }
 
 /**
- * Filter that mimics the vanilla dmenu filtering.
+ * Score of each fuzzy matched rune, and bonuses for where it matched.
+ */
+static const int32_t fuzzy_score_match = 16;
+static const int32_t fuzzy_bonus_consecutive = 12;
+static const int32_t fuzzy_bonus_word = 8;
+
+/**
+ * Most characters skipped between two matches that are penalized.
+ */
+static const uint32_t fuzzy_max_gap = 8;
+
+static inline bool
+is_word_char(unsigned char c)
+{
+    return (c >= 0x80 || isalnum(c));
+}
+
+static inline bool
+is_word_start(const char *text, uint32_t i)
+{
+    const unsigned char c = text[i], prev = (i > 0 ? text[i - 1] : ' ');
+    return (!is_word_char(prev) || (islower(prev) && isupper(c)));
+}
+
+/**
+ * Extend fuzzy match of text with filter text appended to what it was matched with.
  *
- * @param menu bm_menu instance to filter.
- * @param addition This will be 1, if filter is same as previous filter with something appended.
- * @param outNmemb uint32_t reference to filtered items count.
- * @return Pointer to array of bm_item pointers.
+ * Each rune matches case-insensitively at its first occurrence after the previous match,
+ * a space starts a new token that is matched from the start of text again.
+ * Score only depends on the previous match, so extending gives the same result as matching the whole filter.
+ *
+ * @param text Matched text, does not need to be null terminated.
+ * @param text_len Length of text in bytes.
+ * @param filter Appended filter text, must start at rune boundary.
+ * @param len Length of filter in bytes.
+ * @param match Progress to extend.
+ * @return true if text still matches, false otherwise and match is left partially extended.
  */
-struct bm_item**
-bm_filter_dmenu(struct bm_menu *menu, bool addition, uint32_t *out_nmemb)
+static bool
+fuzzy_extend(const char *text, uint32_t text_len, const char *filter, size_t len, struct fuzzy_match *match)
 {
-    return filter_dmenu_fun(menu, addition, strstr, strncmp, out_nmemb);
+    for (size_t n = 0, u8len; n < len; n += u8len) {
+        if (filter[n] == ' ') {
+            u8len = 1;
+            match->pos = 0;
+            continue;
+        }
+
+        bm_utf8_rune_decode(filter + n, len - n, &u8len);
+
+        uint32_t i = match->pos;
+        if (u8len == 1) {
+            const int c = toupper((unsigned char)filter[n]);
+            for (; i < text_len && toupper((unsigned char)text[i]) != c; ++i);
+        } else {
+            for (; i + u8len <= text_len && (text[i] != filter[n] || memcmp(text + i + 1, filter + n + 1, u8len - 1)); ++i);
+        }
+
+        if (i + u8len > text_len)
+            return false;
+
+        int32_t score = fuzzy_score_match;
+        if (match->pos > 0 && i == match->pos) {
+            score += fuzzy_bonus_consecutive;
+        } else if (match->pos > 0) {
+            score -= (int32_t)(i - match->pos < fuzzy_max_gap ? i - match->pos : fuzzy_max_gap);
+        }
+
+        if (is_word_start(text, i))
+            score += fuzzy_bonus_word;
+
+        match->score += score;
+        match->pos = i + u8len;
+    }
+
+    return true;
 }
 
 /**
- * Filter that mimics the vanilla case-insensitive dmenu filtering.
+ * Kernel of fuzzy filter, ranks are score relative to best possible score of filter.
+ */
+static uint32_t
+fuzzy_kernel(const struct bm_item_store *store, const uint32_t *source, uint32_t begin, uint32_t end, const struct filter_query *query, uint32_t *out, uint8_t *ranks)
+{
+    struct bm_pack_reader reader;
+    bm_pack_reader_init(&reader, store->pack);
+
+    uint32_t f = 0;
+    for (uint32_t i = begin; i < end; ++i) {
+        const uint32_t index = (source ? source[i] : i);
+        if ((store->signature[index] & query->signature) != query->signature)
+            continue;
+
+        struct fuzzy_match *match = &query->fuzzy[index];
+        if (!query->fuzzy_extend)
+            *match = (struct fuzzy_match){0};
+
+        const char *text = (store->pack ? bm_pack_read(&reader, index, NULL) : store->text[index]);
+        if (!fuzzy_extend((text ? text : ""), (text ? store->len[index] : 0), query->fuzzy_text, query->fuzzy_len, match))
+            continue;
+
+        const int32_t score = (match->score < 0 ? 0 : match->score);
+        ranks[f] = (query->fuzzy_max > 0 ? (uint32_t)(query->fuzzy_max - score) * 255 / query->fuzzy_max : 0);
+        out[f++] = index;
+    }
+    return f;
+}
+
+/**
+ * Filter that matches runes of each token in order, with gaps allowed.
+ * Items are ranked by score, consecutive runes and runes at word starts score higher.
+ *
+ * Match progress of every filtered item is kept in the menu.
+ * When filtered items are narrowed down because characters were appended to the filter,
+ * only the appended characters are matched, continuing from the kept progress.
  *
  * @param menu bm_menu instance to filter.
- * @param addition This will be 1, if filter is same as previous filter with something appended.
- * @param outNmemb uint32_t reference to filtered items count.
- * @return Pointer to array of bm_item pointers.
+ * @param source Item indices to filter, **NULL** to filter items directly.
+ * @param begin First entry of source, or first item, to filter.
+ * @param end One past last entry of source, or last item, to filter.
+ * @param out_ranks Reference to array where rank of each filtered item is stored, may be **NULL**.
+ * @param out_nmemb uint32_t reference to filtered items count.
+ * @return Pointer to array of item indices.
  */
-struct bm_item**
-bm_filter_dmenu_case_insensitive(struct bm_menu *menu, bool addition, uint32_t *out_nmemb)
+uint32_t*
+bm_filter_fuzzy(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb)
 {
-    return filter_dmenu_fun(menu, addition, bm_strupstr, bm_strnupcmp, out_nmemb);
+    assert(menu && begin <= end && out_nmemb);
+    *out_nmemb = 0;
+
+    if (out_ranks)
+        *out_ranks = NULL;
+
+    if (menu->fuzzy_allocated < menu->items.count) {
+        void *tmp;
+        if (!(tmp = bm_realloc(BM_MEMORY_FILTER, menu->fuzzy, sizeof(struct fuzzy_match) * menu->items.count)))
+            return NULL;
+
+        menu->fuzzy = tmp;
+        menu->fuzzy_allocated = menu->items.count;
+    }
+
+    const char *filter = (menu->filter ? menu->filter : "");
+    const size_t len = strlen(filter);
+
+    struct filter_query query = {0};
+    query.fuzzy = menu->fuzzy;
+    query.fuzzy_text = filter;
+    query.fuzzy_len = len;
+
+    /* narrowing down results of a filter that was appended to, so its progress can be extended */
+    const size_t old_len = (source && menu->old_filter ? strlen(menu->old_filter) : 0);
+    if (old_len > 0 && old_len < len && !memcmp(menu->old_filter, filter, old_len) && ((unsigned char)filter[old_len] & 0xc0) != 0x80) {
+        query.fuzzy_text += old_len;
+        query.fuzzy_len -= old_len;
+        query.fuzzy_extend = true;
+    }
+
+    for (size_t n = 0, u8len; n < len; n += u8len) {
+        bm_utf8_rune_decode(filter + n, len - n, &u8len);
+        query.fuzzy_max += (filter[n] != ' ' ? fuzzy_score_match + fuzzy_bonus_consecutive + fuzzy_bonus_word : 0);
+    }
+
+    for (size_t i = 0; i < query.fuzzy_len; ++i) {
+        if (query.fuzzy_text[i] != ' ')
+            query.signature |= bm_signature(query.fuzzy_text + i, 1);
+    }
+
+    const uint32_t count = end - begin;
+
+    uint8_t *ranks = NULL;
+    uint32_t *filtered = NULL;
+    if (!(filtered = bm_calloc(BM_MEMORY_FILTER, count, sizeof(uint32_t))))
+        goto fail;
+
+    if (!(ranks = bm_calloc(BM_MEMORY_FILTER, count, sizeof(uint8_t))))
+        goto fail;
+
+    uint32_t f;
+    if ((f = run_kernel(menu, fuzzy_kernel, source, begin, end, &query, filtered, ranks)) == UINT32_MAX)
+        goto fail;
+
+    if (source && f > 1 && !bm_filter_sort_by_index(filtered, ranks, f))
+        goto fail;
+
+    if (!bm_filter_group_by_rank(&filtered, ranks, f, 256))
+        goto fail;
+
+    if (out_ranks && f > 0) {
+        *out_ranks = ranks;
+    } else {
+        bm_free(ranks);
+    }
+
+    return shrink_list(&filtered, count, (*out_nmemb = f));
+
+fail:
+    bm_free(filtered);
+    bm_free(ranks);
+    return NULL;
 }
 
 /* vim: set ts=8 sw=4 tw=0 :*/
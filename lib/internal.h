@@ -94,6 +94,17 @@ struct render_api {
      */
     void (*set_overlap)(const struct bm_menu *menu, bool overlap);
 
+    /**
+     * Unmap/map menu, keeping the renderer alive.
+     */
+    void (*set_visible)(const struct bm_menu *menu, bool visible);
+
+    /**
+     * Get text pasted when poll_key last returned BM_KEY_PASTE.
+     * Text is owned by the underlying renderer, and valid until next poll_key.
+     */
+    const char* (*get_paste)(const struct bm_menu *menu);
+
     /**
      * Version of the plugin.
      * Should match BM_PLUGIN_VERSION or failure.
@@ -138,6 +149,36 @@ struct bm_renderer {
     struct render_api api;
 };
 
+/**
+ * Byte range inside item text.
+ */
+struct span {
+    /**
+     * Offset from start of the text.
+     */
+    uint32_t offset;
+
+    /**
+     * Length of the range in bytes.
+     */
+    uint32_t len;
+};
+
+/**
+ * Range of fields, counting from 1.
+ */
+struct field_range {
+    /**
+     * First field in range, 0 for the whole text.
+     */
+    uint32_t first;
+
+    /**
+     * Last field in range, 0 for all fields after first.
+     */
+    uint32_t last;
+};
+
 /**
  * Internal bm_item struct that is not exposed to public.
  * Represents a single item in menu.
@@ -154,6 +195,315 @@ struct bm_item {
      * Matching will be done against this text as well.
      */
     char *text;
+
+    /**
+     * Length of text in bytes.
+     */
+    uint32_t len;
+
+    /**
+     * Index of text in pack.
+     */
+    uint32_t pack_index;
+
+    /**
+     * Part of text that is matched by filter.
+     */
+    struct span match;
+
+    /**
+     * Part of text that is shown by renderers.
+     */
+    struct span display;
+
+    /**
+     * Key used with BM_SORT_MODE_KEY.
+     */
+    uint64_t sort_key;
+
+    /**
+     * Menu the item was added to, **NULL** if not owned by a menu.
+     * Store of this menu is marked stale when text of the item changes.
+     */
+    struct bm_menu *menu;
+
+    /**
+     * Packed texts of corpus the item belongs to, **NULL** if item owns its text.
+     * Text of packed item is copied from the pack on first use, and is **NULL** until then.
+     */
+    const struct bm_pack *pack;
+
+    /**
+     * Arena of menu the item and its texts were allocated from, **NULL** if item was allocated alone.
+     * Arena items are released with their arena, never one by one.
+     */
+    struct bm_arena *arena;
+};
+
+/**
+ * Longest text that is decoded from a shared prefix, longer texts are packed whole.
+ */
+#define BM_PACK_SCRATCH_SIZE 4096
+
+/**
+ * Reads texts of bm_pack, decoding them to scratch.
+ * Kept on stack by the loop that reads, so every thread reads with its own.
+ */
+struct bm_pack_reader {
+    const struct bm_pack *pack;
+
+    /**
+     * Entry after the last read one.
+     */
+    const uint8_t *next;
+
+    /**
+     * Last read text and its length, points either to scratch or inside the pack.
+     */
+    const char *text;
+    uint32_t len;
+
+    /**
+     * Index of last read text, UINT32_MAX if nothing was read.
+     */
+    uint32_t index;
+
+    char scratch[BM_PACK_SCRATCH_SIZE];
+};
+
+/**
+ * Flag bits of items in bm_item_store.
+ */
+enum bm_item_flag {
+    BM_ITEM_FLAG_SELECTED = 1 << 0,
+    BM_ITEM_FLAG_INVALID_UTF8 = 1 << 1,
+};
+
+/**
+ * Metadata of menu items kept in parallel arrays.
+ * Entry i describes the item at index i of bm_menu::items,
+ * so the filter can walk dense arrays instead of dereferencing every item.
+ */
+struct bm_item_store {
+    /**
+     * Start of matched text of items, **NULL** for items without text.
+     * Not allocated for packed store, texts are then read from pack.
+     */
+    const char **text;
+
+    /**
+     * Packed texts of items, borrowed from corpus. **NULL** if text is used.
+     */
+    const struct bm_pack *pack;
+
+    /**
+     * Length of matched text in bytes.
+     */
+    uint32_t *len;
+
+    /**
+     * Case folded hash of matched text.
+     */
+    uint64_t *hash;
+
+    /**
+     * Case folded character signature of matched text.
+     */
+    uint64_t *signature;
+
+    /**
+     * Offset of last path component in matched text.
+     */
+    uint32_t *basename;
+
+    /**
+     * Combination of bm_item_flag bits.
+     */
+    uint8_t *flags;
+
+    /**
+     * First characters of words in matched text as code points, for all items back to back.
+     * ASCII letters are upper cased. Only built for acronym matching.
+     * Not kept for packed texts, acronym filter finds them from the texts it decodes anyway.
+     */
+    uint32_t *initials;
+
+    /**
+     * Offset of first initial of each item in initials, initials_count + 1 entries.
+     */
+    uint32_t *initials_offset;
+
+    /**
+     * Number of initials used and allocated.
+     */
+    size_t initials_len, initials_allocated;
+
+    /**
+     * Number of items initials are built for.
+     */
+    uint32_t initials_count;
+
+    /**
+     * Number of items in store.
+     */
+    uint32_t count;
+
+    /**
+     * Number of allocated entries.
+     */
+    uint32_t allocated;
+
+    /**
+     * Is the store in sync with items?
+     * Cleared by the menu when its items are changed, replaced or edited.
+     * Items appended after the store was built keep it valid, the store then only describes the first count items.
+     */
+    bool valid;
+
+    /**
+     * Unique number of the build that produced the store, caches of filter results are dropped when it changes.
+     * Shared store has generation of its corpus.
+     */
+    uint64_t generation;
+
+    /**
+     * Are arrays other than flags borrowed from a bm_corpus?
+     * Shared store is never rebuilt, corpus items are not owned by a menu and are never marked stale.
+     */
+    bool shared;
+};
+
+/**
+ * Immutable items and their store, shared by menus.
+ */
+struct bm_corpus {
+    /**
+     * Items owned by the corpus.
+     */
+    struct bm_item **items;
+
+    /**
+     * Number of items.
+     */
+    uint32_t count;
+
+    /**
+     * Front coded texts and the items reading them, allocated at once.
+     * **NULL** unless corpus was created packed.
+     */
+    struct bm_pack *pack;
+    struct bm_item *packed;
+
+    /**
+     * Metadata of items, built with initials when corpus is created.
+     * Flags only hold properties of items, each menu keeps its own copy for selection.
+     */
+    struct bm_item_store store;
+
+    /**
+     * Number of references, corpus is freed when this drops to zero.
+     */
+    uint32_t refs;
+};
+
+/**
+ * Progress of fuzzy matching an item, so matching can continue when characters are appended to the filter.
+ */
+struct fuzzy_match {
+    /**
+     * Offset in matched text after the last matched rune, 0 at the start of a token.
+     */
+    uint32_t pos;
+
+    /**
+     * Score so far, higher is better.
+     */
+    int32_t score;
+};
+
+/**
+ * List of indices to bm_menu::items.
+ */
+struct index_list {
+    /**
+     * Indices in the list.
+     */
+    uint32_t *indices;
+
+    /**
+     * Number of indices.
+     */
+    uint32_t count;
+
+    /**
+     * Number of allocated indices.
+     */
+    uint32_t allocated;
+};
+
+/**
+ * Strategies for filtering items.
+ */
+enum bm_plan_strategy {
+    /**
+     * Match all items.
+     */
+    BM_PLAN_SCAN,
+
+    /**
+     * Match previous results, when characters were appended to the filter.
+     */
+    BM_PLAN_NARROW,
+
+    /**
+     * Match items in cached sets of tokens.
+     */
+    BM_PLAN_TOKENS,
+
+    /**
+     * Match each token against all items on its own, and cache their sets.
+     */
+    BM_PLAN_SPLIT,
+
+    BM_PLAN_LAST
+};
+
+/**
+ * Strategy picked for filtering, and estimated costs it was picked by.
+ */
+struct bm_plan {
+    enum bm_plan_strategy strategy;
+
+    /**
+     * Estimated cost of each strategy, in items matched against a token. UINT64_MAX if strategy can't be used.
+     */
+    uint64_t cost[BM_PLAN_LAST];
+
+    /**
+     * Number of tokens in filter, and how many of them have cached sets.
+     */
+    uint32_t tokens, cached;
+
+    /**
+     * Microsecond filtering started at, for debug log.
+     */
+    uint64_t started;
+};
+
+/**
+ * Function ran by bm_pool over range [begin, end).
+ */
+typedef void (*bm_pool_fun)(void *data, uint32_t begin, uint32_t end);
+
+/**
+ * Work spawned to bm_pool that is waited for together.
+ * Zero initialize before spawning.
+ */
+struct bm_pool_group {
+    /**
+     * Number of spawned functions that have not finished.
+     */
+    uint32_t pending;
 };
 
 /**
@@ -204,14 +554,110 @@ struct bm_menu {
     struct list items;
 
     /**
-     * Filtered/displayed items contained in menu instance.
+     * Metadata of items, built lazily before filtering.
+     */
+    struct bm_item_store store;
+
+    /**
+     * Corpus items and store are borrowed from, **NULL** if menu owns its items.
+     */
+    struct bm_corpus *corpus;
+
+    /**
+     * Arena items added with bm_menu_add_texts live in, **NULL** until texts are added.
+     */
+    struct bm_arena *arena;
+
+    /**
+     * Number of items that are from arena, when all of them are, items are released without visiting them.
+     */
+    uint32_t arena_items;
+
+    /**
+     * Thread pool for parallel filtering and sorting, created lazily.
+     */
+    struct bm_pool *pool;
+
+    /**
+     * Maximum number of threads used by pool, 0 for number of online CPUs.
+     */
+    uint32_t max_threads;
+
+    /**
+     * Runs preview command for highlighted item, **NULL** if preview is disabled.
+     */
+    struct bm_preview *preview;
+
+    /**
+     * Filters results ahead with likely next characters while idle, **NULL** if speculation is disabled.
+     */
+    struct bm_speculation *speculation;
+
+    /**
+     * Sets of items matching tokens of earlier filters, **NULL** until menu filters or if cache is disabled.
+     * Only used by filters running on the menu's thread.
+     */
+    struct bm_token_cache *tokens;
+
+    /**
+     * Most bytes sets of token cache may take, 0 disables the cache.
+     */
+    size_t token_cache_limit;
+
+    /**
+     * Strategy of last filter, read by filters running on the menu's thread.
+     */
+    struct bm_plan plan;
+
+    /**
+     * Poll set of renderer input and watched file descriptors.
+     * First entry is reserved for renderer input, rest are watched.
+     */
+    struct pollfd *poll_fds;
+
+    /**
+     * Number of watched file descriptors.
+     */
+    uint32_t watch_count;
+
+    /**
+     * Milliseconds renderer waits for input, -1 for no timeout.
      */
-    struct list filtered;
+    int32_t poll_timeout;
 
     /**
-     * Selected items.
+     * Filtered/displayed items contained in menu instance, as indices to items.
      */
-    struct list selection;
+    struct index_list filtered;
+
+    /**
+     * Filter rank of each filtered item, so results for appended items can be merged in.
+     * **NULL** if not known.
+     */
+    uint8_t *filtered_ranks;
+
+    /**
+     * Fuzzy match progress by item index, entries of filtered items belong to old_filter.
+     * Only allocated in BM_FILTER_MODE_FUZZY.
+     */
+    struct fuzzy_match *fuzzy;
+
+    /**
+     * Number of allocated fuzzy entries.
+     */
+    uint32_t fuzzy_allocated;
+
+    /**
+     * Selected items, as indices to items.
+     * UINT32_MAX refers to filter_item.
+     */
+    struct index_list selection;
+
+    /**
+     * Pointer views of filtered and selection for public API.
+     * Built lazily and released when the index lists change.
+     */
+    struct bm_item **filtered_view, **selection_view;
 
     /**
      * Menu instance title.
@@ -239,6 +685,22 @@ struct bm_menu {
      */
     char *prefix;
 
+    /**
+     * Characters that separate fields of item text.
+     * **NULL** if items are not split to fields.
+     */
+    char *field_delimiter;
+
+    /**
+     * Fields of item text that are matched by filter.
+     */
+    struct field_range match_fields;
+
+    /**
+     * Fields of item text that are shown by renderers.
+     */
+    struct field_range display_fields;
+
     /**
      * Text used to filter matches.
      */
@@ -291,6 +753,11 @@ struct bm_menu {
      */
     enum bm_filter_mode filter_mode;
 
+    /**
+     * Current sorting method for filtered items.
+     */
+    enum bm_sort_mode sort_mode;
+
     /**
      * Current Scrollbar display mode.
      */
@@ -311,21 +778,115 @@ struct bm_menu {
      */
     bool grabbed;
 
+    /**
+     * Is menu hidden with bm_menu_set_visible?
+     */
+    bool hidden;
+
     /**
      * Should the menu overlap panels
      */
     bool overlap;
+
+    /**
+     * Is BEMENU_DEBUG set, so filters are logged to stderr?
+     */
+    bool debug;
 };
 
 /* library.c */
 bool bm_renderer_activate(struct bm_renderer *renderer, struct bm_menu *menu);
 
+/* item.c */
+void bm_item_set_fields(struct bm_item *item, const char *delimiter, struct field_range match, struct field_range display);
+const char* bm_item_get_display(const struct bm_item *item, uint32_t *out_len);
+
 /* menu.c */
-bool bm_menu_item_is_selected(const struct bm_menu *menu, const struct bm_item *item);
+bool bm_menu_is_path_mode(const struct bm_menu *menu);
+uint32_t bm_menu_get_filtered_count(const struct bm_menu *menu);
+struct bm_item* bm_menu_get_filtered_item(const struct bm_menu *menu, uint32_t index);
+bool bm_menu_filtered_item_is_selected(const struct bm_menu *menu, uint32_t index);
+bool bm_menu_wait_fd(const struct bm_menu *menu, int fd, int32_t renderer_timeout);
+void bm_menu_speculate(struct bm_menu *menu);
+
+/* arena.c */
+struct bm_arena* bm_arena_new(void);
+void bm_arena_free(struct bm_arena *arena);
+void* bm_arena_alloc(struct bm_arena *arena, size_t size);
+char* bm_arena_strndup(struct bm_arena *arena, const char *s, size_t len);
+
+/* bitset.c */
+struct bm_bitset* bm_bitset_new(const uint32_t *indices, uint32_t count, uint32_t universe);
+void bm_bitset_free(struct bm_bitset *set);
+uint32_t bm_bitset_get_count(const struct bm_bitset *set);
+bool bm_bitset_intersect(const struct bm_bitset **sets, uint32_t nsets, uint32_t **out_indices, uint32_t *out_count);
+uint64_t bm_bitset_intersect_cost(const struct bm_bitset **sets, uint32_t nsets);
+struct bm_token_cache* bm_token_cache_new(size_t limit);
+void bm_token_cache_free(struct bm_token_cache *cache);
+void bm_token_cache_clear(struct bm_token_cache *cache);
+const struct bm_bitset* bm_token_cache_get(struct bm_token_cache *cache, uint64_t generation, bool nocase, const char *token, size_t len);
+void bm_token_cache_put(struct bm_token_cache *cache, uint64_t generation, bool nocase, const char *token, size_t len, struct bm_bitset *set);
 
 /* filter.c */
-struct bm_item** bm_filter_dmenu(struct bm_menu *menu, bool addition, uint32_t *out_nmemb);
-struct bm_item** bm_filter_dmenu_case_insensitive(struct bm_menu *menu, bool addition, uint32_t *out_nmemb);
+typedef uint32_t* (*bm_filter_fun)(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb);
+bool bm_filter_group_by_rank(uint32_t **in_out_filtered, uint8_t *ranks, uint32_t count, uint32_t nranks);
+bool bm_filter_sort_by_index(uint32_t *filtered, uint8_t *ranks, uint32_t count);
+uint32_t* bm_filter_dmenu(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb);
+uint32_t* bm_filter_dmenu_case_insensitive(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb);
+uint32_t* bm_filter_acronym(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb);
+uint32_t* bm_filter_path(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb);
+uint32_t* bm_filter_path_case_insensitive(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb);
+uint32_t* bm_filter_fuzzy(struct bm_menu *menu, const uint32_t *source, uint32_t begin, uint32_t end, uint8_t **out_ranks, uint32_t *out_nmemb);
+
+/* pack.c */
+struct bm_pack* bm_pack_new(const char **texts, uint32_t count);
+void bm_pack_free(struct bm_pack *pack);
+void bm_pack_reader_init(struct bm_pack_reader *reader, const struct bm_pack *pack);
+const char* bm_pack_read(struct bm_pack_reader *reader, uint32_t index, uint32_t *out_len);
+char* bm_pack_copy(const struct bm_pack *pack, uint32_t index);
+
+/* plan.c */
+void bm_plan_filter(struct bm_menu *menu, bool addition, struct bm_plan *out_plan);
+void bm_plan_log(const struct bm_menu *menu, const struct bm_plan *plan, const char *how, uint32_t count);
+
+/* pool.c */
+struct bm_pool* bm_pool_new(uint32_t max_threads);
+void bm_pool_free(struct bm_pool *pool);
+uint32_t bm_pool_get_thread_count(const struct bm_pool *pool);
+void bm_pool_spawn(struct bm_pool *pool, struct bm_pool_group *group, bm_pool_fun fun, void *data, uint32_t begin, uint32_t end);
+void bm_pool_join(struct bm_pool *pool, struct bm_pool_group *group);
+void bm_pool_parallel_for(struct bm_pool *pool, uint32_t count, uint32_t grain, bm_pool_fun fun, void *data);
+
+/* preview.c */
+struct bm_preview* bm_preview_new(const char *command);
+void bm_preview_free(struct bm_preview *preview, struct bm_menu *menu);
+void bm_preview_update(struct bm_preview *preview, struct bm_menu *menu);
+int32_t bm_preview_get_timeout(const struct bm_preview *preview);
+const char* bm_preview_get_text(const struct bm_preview *preview, const struct bm_item *item, size_t *out_len);
+
+/* speculate.c */
+struct bm_speculation* bm_speculation_new(uint32_t max);
+void bm_speculation_free(struct bm_speculation *spec);
+uint32_t bm_speculation_get_max(const struct bm_speculation *spec);
+void bm_speculation_cancel(struct bm_speculation *spec);
+void bm_speculation_reset(struct bm_speculation *spec);
+void bm_speculation_start(struct bm_speculation *spec, struct bm_menu *menu, bm_filter_fun filter);
+bool bm_speculation_take(struct bm_speculation *spec, struct bm_menu *menu, uint32_t **out_indices, uint8_t **out_ranks, uint32_t *out_count);
+void bm_speculation_get_stats(const struct bm_speculation *spec, struct bm_speculation_stats *out_stats);
+
+/* sort.c */
+bool bm_sort_items(struct bm_item **items, uint32_t *indices, uint8_t *ranks, uint32_t count, enum bm_sort_mode mode, struct bm_pool *pool);
+uint32_t* bm_sort_merge(struct bm_item **items, const uint32_t *a, const uint8_t *a_ranks, uint32_t a_count, const uint32_t *b, const uint8_t *b_ranks, uint32_t b_count, enum bm_sort_mode mode, uint8_t **out_ranks);
+
+/* store.c */
+uint64_t bm_signature(const char *text, size_t len);
+uint64_t bm_hash(const char *text, size_t len);
+uint32_t bm_initials(const char *text, uint32_t len, uint32_t *out_initials);
+bool bm_item_store_build(struct bm_item_store *store, struct bm_item **items, uint32_t count, struct bm_pool *pool);
+bool bm_item_store_build_initials(struct bm_item_store *store);
+bool bm_item_store_is_valid(const struct bm_item_store *store, uint32_t count);
+bool bm_item_store_share(struct bm_item_store *store, const struct bm_item_store *corpus);
+void bm_item_store_release(struct bm_item_store *store);
 
 /* list.c */
 void list_free_list(struct list *list);
@@ -339,23 +900,38 @@ bool list_add_item(struct list *list, void *item);
 bool list_remove_item_at(struct list *list, uint32_t index);
 bool list_remove_item(struct list *list, const void *item);
 void list_sort(struct list *list, int (*compar)(const void *a, const void *b));
+void index_list_free(struct index_list *list);
+void index_list_set_no_copy(struct index_list *list, uint32_t *indices, uint32_t nmemb);
+bool index_list_add(struct index_list *list, uint32_t index);
+bool index_list_contains(const struct index_list *list, uint32_t index);
+void index_list_insert_index(struct index_list *list, uint32_t index);
+void index_list_remove_index(struct index_list *list, uint32_t index);
+
+/* memory.c */
+void* bm_malloc(enum bm_memory_domain domain, size_t size);
+void* bm_calloc(enum bm_memory_domain domain, size_t nmemb, size_t size);
+void* bm_realloc(enum bm_memory_domain domain, void *ptr, size_t size);
+void bm_free(void *ptr);
 
 /* util.c */
-char* bm_strdup(const char *s);
-bool bm_resize_buffer(char **in_out_buffer, size_t *in_out_size, size_t nsize);
-BM_LOG_ATTR(1, 2) char* bm_dprintf(const char *fmt, ...);
-BM_LOG_ATTR(3, 0) bool bm_vrprintf(char **in_out_buffer, size_t *in_out_len, const char *fmt, va_list args);
+char* bm_strdup(enum bm_memory_domain domain, const char *s);
+bool bm_resize_buffer(enum bm_memory_domain domain, char **in_out_buffer, size_t *in_out_size, size_t nsize);
+BM_LOG_ATTR(2, 3) char* bm_dprintf(enum bm_memory_domain domain, const char *fmt, ...);
+BM_LOG_ATTR(4, 0) bool bm_vrprintf(enum bm_memory_domain domain, char **in_out_buffer, size_t *in_out_len, const char *fmt, va_list args);
 size_t bm_strip_token(char *string, const char *token, size_t *out_next);
 int bm_strupcmp(const char *hay, const char *needle);
 int bm_strnupcmp(const char *hay, const char *needle, size_t len);
-char* bm_strupstr(const char *hay, const char *needle);
+char* bm_strnstr(const char *hay, size_t hay_len, const char *needle, size_t len);
+char* bm_strnupstr(const char *hay, size_t hay_len, const char *needle, size_t len);
 int32_t bm_utf8_string_screen_width(const char *string);
 size_t bm_utf8_rune_next(const char *string, size_t start);
 size_t bm_utf8_rune_prev(const char *string, size_t start);
+uint32_t bm_utf8_rune_decode(const char *string, size_t len, size_t *out_u8len);
 size_t bm_utf8_rune_width(const char *rune, uint32_t u8len);
 size_t bm_utf8_rune_remove(char *string, size_t start, size_t *out_rune_width);
 size_t bm_utf8_rune_insert(char **string, size_t *bufSize, size_t start, const char *rune, uint32_t u8len, size_t *out_rune_width);
 size_t bm_unicode_insert(char **string, size_t *bufSize, size_t start, uint32_t unicode, size_t *out_rune_width);
+size_t bm_utf8_string_insert(char **string, size_t *bufSize, size_t start, const char *text, size_t len, size_t *out_width);
 
 #endif /* _BEMENU_INTERNAL_H_ */
 
@@ -7,7 +7,7 @@ struct bm_item*
 bm_item_new(const char *text)
 {
     struct bm_item *item;
-    if (!(item = calloc(1, sizeof(struct bm_item))))
+    if (!(item = bm_calloc(BM_MEMORY_ITEMS, 1, sizeof(struct bm_item))))
         return NULL;
 
     bm_item_set_text(item, text);
@@ -17,9 +17,15 @@ bm_item_new(const char *text)
 void
 bm_item_free(struct bm_item *item)
 {
-    assert(item);
-    free(item->text);
-    free(item);
+    /* packed items are allocated at once and freed by their corpus */
+    assert(item && !item->pack);
+
+    /* arena items and all their texts are freed by their menu */
+    if (item->arena)
+        return;
+
+    bm_free(item->text);
+    bm_free(item);
 }
 
 void
@@ -41,20 +47,149 @@ bm_item_set_text(struct bm_item *item, const char *text)
 {
     assert(item);
 
+    /* arena items keep their texts in arena, the old text stays there until arena is freed */
     char *copy = NULL;
-    if (text && !(copy = bm_strdup(text)))
+    if (text && !(copy = (item->arena ? bm_arena_strndup(item->arena, text, strlen(text)) : bm_strdup(BM_MEMORY_ITEMS, text))))
         return false;
 
-    free(item->text);
+    /* speculation may be reading the old text */
+    if (item->menu)
+        bm_speculation_reset(item->menu->speculation);
+
+    if (!item->arena)
+        bm_free(item->text);
+
     item->text = copy;
+    item->len = (copy ? strlen(copy) : 0);
+    item->match = item->display = (struct span){ 0, item->len };
+
+    /* store of the owning menu describes the old text */
+    if (item->menu) {
+        bm_item_set_fields(item, item->menu->field_delimiter, item->menu->match_fields, item->menu->display_fields);
+        item->menu->store.valid = false;
+    }
+
     return true;
 }
 
+/**
+ * Get text of item, copying it from pack on first use.
+ * Corpus items may be read from several threads, so the copy is published atomically.
+ */
+static const char*
+get_text(const struct bm_item *item)
+{
+    char *text = __atomic_load_n(&item->text, __ATOMIC_ACQUIRE);
+    if (text || !item->pack)
+        return text;
+
+    char *copy;
+    if (!(copy = bm_pack_copy(item->pack, item->pack_index)))
+        return NULL;
+
+    if (!__atomic_compare_exchange_n(&((struct bm_item*)item)->text, &text, copy, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        bm_free(copy);
+        return text;
+    }
+
+    return copy;
+}
+
 const char*
 bm_item_get_text(const struct bm_item *item)
 {
     assert(item);
-    return item->text;
+    return get_text(item);
+}
+
+/**
+ * Find byte span for range of fields.
+ *
+ * @param text Null terminated C "string" to split.
+ * @param len Length of text.
+ * @param delimiter Null terminated C "string" of characters that separate fields.
+ * @param range Range of fields to find.
+ * @return Span covering the fields, empty span at end of text if the first field does not exist.
+ */
+static struct span
+field_span(const char *text, uint32_t len, const char *delimiter, struct field_range range)
+{
+    if (!range.first || !delimiter)
+        return (struct span){ 0, len };
+
+    uint32_t start = len, end = len;
+    for (uint32_t field = 1, offset = 0;; ++field) {
+        const uint32_t flen = strcspn(text + offset, delimiter);
+
+        if (field == range.first)
+            start = end = offset;
+
+        if (field >= range.first && (!range.last || field <= range.last))
+            end = offset + flen;
+
+        if (!text[offset + flen] || (range.last && field >= range.last))
+            break;
+
+        offset += flen + 1;
+    }
+
+    return (struct span){ start, end - start };
+}
+
+/**
+ * Split item text to fields and store spans for matching and display.
+ *
+ * @param item bm_item instance which text to split.
+ * @param delimiter Null terminated C "string" of characters that separate fields, **NULL** to use whole text.
+ * @param match Range of fields that will be matched by filter.
+ * @param display Range of fields that will be shown by renderers.
+ */
+void
+bm_item_set_fields(struct bm_item *item, const char *delimiter, struct field_range match, struct field_range display)
+{
+    assert(item);
+
+    if (!item->text)
+        return;
+
+    item->match = field_span(item->text, item->len, delimiter, match);
+    item->display = field_span(item->text, item->len, delimiter, display);
+}
+
+/**
+ * Get the part of item text shown by renderers.
+ *
+ * @param item bm_item instance where to get text from.
+ * @param out_len Reference to uint32_t where length of the returned text will be stored.
+ * @return Pointer to start of the displayed text, not null terminated.
+ */
+const char*
+bm_item_get_display(const struct bm_item *item, uint32_t *out_len)
+{
+    assert(item && out_len);
+
+    const char *text;
+    if (!(text = get_text(item))) {
+        *out_len = 0;
+        return "";
+    }
+
+    *out_len = item->display.len;
+    return text + item->display.offset;
+}
+
+void
+bm_item_set_sort_key(struct bm_item *item, uint64_t key)
+{
+    assert(item);
+    item->sort_key = key;
+}
+
+uint64_t
+bm_item_get_sort_key(const struct bm_item *item)
+{
+    assert(item);
+    return item->sort_key;
 }
 
 /* vim: set ts=8 sw=4 tw=0 :*/
@@ -19,9 +19,9 @@ bm_renderer_free(struct bm_renderer *renderer)
     if (renderer->handle)
         chckDlUnload(renderer->handle);
 
-    free(renderer->name);
-    free(renderer->file);
-    free(renderer);
+    bm_free(renderer->name);
+    bm_free(renderer->file);
+    bm_free(renderer);
 }
 
 static bool
@@ -49,10 +49,10 @@ load(const char *file, struct bm_renderer *renderer)
         goto mismatch_fail;
 
     if (!renderer->name)
-        renderer->name = bm_strdup(name);
+        renderer->name = bm_strdup(BM_MEMORY_OTHER, name);
 
     if (!renderer->file)
-        renderer->file = bm_strdup(file);
+        renderer->file = bm_strdup(BM_MEMORY_OTHER, file);
 
     renderer->handle = handle;
     return true;
@@ -79,7 +79,7 @@ static bool
 load_to_list(const char *file)
 {
     struct bm_renderer *renderer;
-    if (!(renderer = calloc(1, sizeof(struct bm_renderer))))
+    if (!(renderer = bm_calloc(BM_MEMORY_OTHER, 1, sizeof(struct bm_renderer))))
         goto fail;
 
     if (!load(file, renderer))
@@ -146,9 +146,9 @@ bm_init(void)
     while ((file = readdir(dir))) {
         if (file->d_type != DT_DIR && !strncmp(file->d_name, "bemenu-renderer-", strlen("bemenu-renderer-"))) {
             char *fpath;
-            if ((fpath = bm_dprintf("%s/%s", path, file->d_name))) {
+            if ((fpath = bm_dprintf(BM_MEMORY_OTHER, "%s/%s", path, file->d_name))) {
                 load_to_list(fpath);
-                free(fpath);
+                bm_free(fpath);
             }
         }
     }
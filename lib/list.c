@@ -7,7 +7,7 @@ void
 list_free_list(struct list *list)
 {
     assert(list);
-    free(list->items);
+    bm_free(list->items);
     list->allocated = list->count = 0;
     list->items = NULL;
 }
@@ -64,7 +64,7 @@ list_set_items(struct list *list, const void *items, uint32_t nmemb, list_free_f
     }
 
     void *new_items;
-    if (!(new_items = calloc(sizeof(void*), nmemb)))
+    if (!(new_items = bm_calloc(BM_MEMORY_ITEMS, sizeof(void*), nmemb)))
         return false;
 
     memcpy(new_items, items, sizeof(void*) * nmemb);
@@ -79,7 +79,7 @@ list_grow(struct list *list, uint32_t step)
     void *tmp;
     uint32_t nsize = sizeof(void*) * (list->allocated + step);
 
-    if (!(tmp = realloc(list->items, nsize)))
+    if (!(tmp = bm_realloc(BM_MEMORY_ITEMS, list->items, nsize)))
         return false;
 
     list->items = tmp;
@@ -144,4 +144,88 @@ list_sort(struct list *list, int (*compar)(const void *a, const void *b))
     qsort(list->items, list->count, sizeof(void*), compar);
 }
 
+void
+index_list_free(struct index_list *list)
+{
+    assert(list);
+    bm_free(list->indices);
+    list->allocated = list->count = 0;
+    list->indices = NULL;
+}
+
+/** !!! Frees the old list !!! */
+void
+index_list_set_no_copy(struct index_list *list, uint32_t *indices, uint32_t nmemb)
+{
+    assert(list);
+
+    index_list_free(list);
+
+    if (!indices || nmemb == 0) {
+        bm_free(indices);
+        return;
+    }
+
+    list->indices = indices;
+    list->allocated = list->count = nmemb;
+}
+
+bool
+index_list_add(struct index_list *list, uint32_t index)
+{
+    assert(list);
+
+    if (list->allocated <= list->count) {
+        void *tmp;
+        const uint32_t nsize = list->allocated + 32;
+        if (!(tmp = bm_realloc(BM_MEMORY_FILTER, list->indices, sizeof(uint32_t) * nsize)))
+            return false;
+
+        list->indices = tmp;
+        list->allocated = nsize;
+    }
+
+    list->indices[list->count++] = index;
+    return true;
+}
+
+bool
+index_list_contains(const struct index_list *list, uint32_t index)
+{
+    assert(list);
+
+    uint32_t i;
+    for (i = 0; i < list->count && list->indices[i] != index; ++i);
+    return (i < list->count);
+}
+
+/** Adjust indices after item was inserted at index. */
+void
+index_list_insert_index(struct index_list *list, uint32_t index)
+{
+    assert(list);
+
+    for (uint32_t i = 0; i < list->count; ++i) {
+        if (list->indices[i] >= index && list->indices[i] != UINT32_MAX)
+            list->indices[i]++;
+    }
+}
+
+/** Drop index and adjust indices after item at index was removed. */
+void
+index_list_remove_index(struct index_list *list, uint32_t index)
+{
+    assert(list);
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < list->count; ++i) {
+        if (list->indices[i] == index)
+            continue;
+
+        list->indices[n++] = list->indices[i] - (list->indices[i] > index && list->indices[i] != UINT32_MAX);
+    }
+
+    list->count = n;
+}
+
 /* vim: set ts=8 sw=4 tw=0 :*/
@@ -0,0 +1,202 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Hooks used for allocation, zeroed hooks use malloc, realloc and free.
+ */
+static struct bm_allocator allocator;
+
+/**
+ * Are allocations prefixed with header for accounting?
+ */
+static bool accounting;
+
+/**
+ * Bytes held in each bm_memory_domain, only counted with accounting.
+ */
+static size_t usage[BM_MEMORY_LAST];
+
+/**
+ * Number of blocks held, allocator can only be changed when this is zero.
+ */
+static size_t blocks;
+
+/**
+ * Prefix of accounted allocations, sized to keep the returned memory aligned.
+ */
+union header {
+    struct {
+        size_t size;
+        uint32_t domain;
+    } info;
+    long double align_ld;
+    void *align_ptr;
+    uint64_t align_u64;
+};
+
+static void*
+raw_malloc(size_t size)
+{
+    return (allocator.malloc_fun ? allocator.malloc_fun(size, allocator.context) : malloc(size));
+}
+
+static void*
+raw_realloc(void *ptr, size_t size)
+{
+    return (allocator.realloc_fun ? allocator.realloc_fun(ptr, size, allocator.context) : realloc(ptr, size));
+}
+
+static void
+raw_free(void *ptr)
+{
+    if (allocator.free_fun) {
+        allocator.free_fun(ptr, allocator.context);
+    } else {
+        free(ptr);
+    }
+}
+
+static void
+account(uint32_t domain, size_t add, size_t sub)
+{
+    __atomic_add_fetch(&usage[domain], add, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&usage[domain], sub, __ATOMIC_RELAXED);
+}
+
+bool
+bm_set_allocator(const struct bm_allocator *hooks, bool count)
+{
+    if (__atomic_load_n(&blocks, __ATOMIC_ACQUIRE) > 0)
+        return false;
+
+    if (hooks && (!hooks->malloc_fun || !hooks->realloc_fun || !hooks->free_fun))
+        return false;
+
+    if (hooks) {
+        allocator = *hooks;
+    } else {
+        memset(&allocator, 0, sizeof(allocator));
+    }
+
+    accounting = count;
+    return true;
+}
+
+size_t
+bm_get_memory_usage(enum bm_memory_domain domain)
+{
+    if (domain >= BM_MEMORY_LAST)
+        return 0;
+
+    return __atomic_load_n(&usage[domain], __ATOMIC_RELAXED);
+}
+
+/**
+ * Allocate memory with the allocator set by bm_set_allocator.
+ *
+ * @param domain bm_memory_domain the memory is accounted to.
+ * @param size Size of memory in bytes, 0 allocates a unique pointer.
+ * @return Pointer to allocated memory, **NULL** if out of memory.
+ */
+void*
+bm_malloc(enum bm_memory_domain domain, size_t size)
+{
+    assert(domain < BM_MEMORY_LAST);
+
+    const size_t prefix = (accounting ? sizeof(union header) : 0);
+    if (size > SIZE_MAX - prefix)
+        return NULL;
+
+    void *ptr;
+    if (!(ptr = raw_malloc((size + prefix) > 0 ? size + prefix : 1)))
+        return NULL;
+
+    __atomic_add_fetch(&blocks, 1, __ATOMIC_RELEASE);
+
+    if (!accounting)
+        return ptr;
+
+    union header *header = ptr;
+    header->info.size = size;
+    header->info.domain = domain;
+    account(domain, size, 0);
+    return header + 1;
+}
+
+/**
+ * Allocate zeroed memory with the allocator set by bm_set_allocator.
+ *
+ * @param domain bm_memory_domain the memory is accounted to.
+ * @param nmemb Number of elements.
+ * @param size Size of element in bytes.
+ * @return Pointer to allocated memory, **NULL** if out of memory.
+ */
+void*
+bm_calloc(enum bm_memory_domain domain, size_t nmemb, size_t size)
+{
+    if (size > 0 && nmemb > SIZE_MAX / size)
+        return NULL;
+
+    void *ptr;
+    if ((ptr = bm_malloc(domain, nmemb * size)))
+        memset(ptr, 0, nmemb * size);
+
+    return ptr;
+}
+
+/**
+ * Resize memory with the allocator set by bm_set_allocator.
+ *
+ * @param domain bm_memory_domain the memory is accounted to, if ptr is **NULL**. Otherwise domain of ptr is kept.
+ * @param ptr Memory to resize, may be **NULL**.
+ * @param size New size in bytes.
+ * @return Pointer to resized memory, **NULL** if out of memory and ptr was left untouched.
+ */
+void*
+bm_realloc(enum bm_memory_domain domain, void *ptr, size_t size)
+{
+    if (!ptr)
+        return bm_malloc(domain, size);
+
+    if (!accounting)
+        return raw_realloc(ptr, (size > 0 ? size : 1));
+
+    if (size > SIZE_MAX - sizeof(union header))
+        return NULL;
+
+    union header *header = (union header*)ptr - 1;
+    const size_t old_size = header->info.size;
+
+    if (!(header = raw_realloc(header, sizeof(union header) + size)))
+        return NULL;
+
+    header->info.size = size;
+    account(header->info.domain, size, old_size);
+    return header + 1;
+}
+
+/**
+ * Release memory allocated with bm_malloc, bm_calloc or bm_realloc.
+ *
+ * @param ptr Memory to release, may be **NULL**.
+ */
+void
+bm_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    __atomic_sub_fetch(&blocks, 1, __ATOMIC_RELEASE);
+
+    if (accounting) {
+        union header *header = (union header*)ptr - 1;
+        account(header->info.domain, 0, header->info.size);
+        ptr = header;
+    }
+
+    raw_free(ptr);
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <poll.h>
 #include <assert.h>
 
 /**
@@ -29,31 +30,234 @@ static const char *default_colors[BM_COLOR_LAST] = {
     "#D81860", // BM_COLOR_SCROLLBAR_FG
 };
 
+/**
+ * Default memory limit of token cache.
+ */
+static const size_t default_token_cache_limit = 64 << 20;
+
 /**
  * Filter function map.
  */
-static struct bm_item** (*filter_func[BM_FILTER_MODE_LAST])(struct bm_menu *menu, bool addition, uint32_t *out_nmemb) = {
+static bm_filter_fun filter_func[BM_FILTER_MODE_LAST] = {
     bm_filter_dmenu, /* BM_FILTER_DMENU */
-    bm_filter_dmenu_case_insensitive /* BM_FILTER_DMENU_CASE_INSENSITIVE */
+    bm_filter_dmenu_case_insensitive, /* BM_FILTER_DMENU_CASE_INSENSITIVE */
+    bm_filter_acronym, /* BM_FILTER_ACRONYM */
+    bm_filter_path, /* BM_FILTER_PATH */
+    bm_filter_path_case_insensitive, /* BM_FILTER_PATH_CASE_INSENSITIVE */
+    bm_filter_fuzzy /* BM_FILTER_FUZZY */
 };
 
+/**
+ * Split text of all items in menu to fields and filter again.
+ */
+static void
+split_fields(struct bm_menu *menu)
+{
+    /* corpus items are shared by other menus and can't change */
+    if (menu->corpus)
+        return;
+
+    bm_speculation_reset(menu->speculation);
+
+    uint32_t count;
+    struct bm_item **items = bm_menu_get_items(menu, &count);
+    for (uint32_t i = 0; i < count; ++i)
+        bm_item_set_fields(items[i], menu->field_delimiter, menu->match_fields, menu->display_fields);
+
+    menu->store.valid = false;
+    bm_menu_filter(menu);
+}
+
+/**
+ * Index used in selection for filter_item, which is not part of items.
+ */
+static const uint32_t filter_item_index = UINT32_MAX;
+
+static bool
+is_filtering(const struct bm_menu *menu)
+{
+    return (menu->filter && *menu->filter);
+}
+
+/**
+ * Translate index of filtered items to index of items.
+ */
+static uint32_t
+item_index(const struct bm_menu *menu, uint32_t index)
+{
+    return (is_filtering(menu) ? menu->filtered.indices[index] : index);
+}
+
+/**
+ * Find index of item in items.
+ */
+static bool
+find_item(const struct bm_menu *menu, const struct bm_item *item, uint32_t *out_index)
+{
+    uint32_t i;
+    for (i = 0; i < menu->items.count && menu->items.items[i] != item; ++i);
+    *out_index = i;
+    return (i < menu->items.count);
+}
+
+/**
+ * Get pointer view of index list, building it on first use.
+ * Views are only caches of the index lists, thus they may be built through const menu.
+ */
+static struct bm_item**
+get_view(const struct bm_menu *menu, const struct index_list *list, struct bm_item ***in_out_view, uint32_t *out_nmemb)
+{
+    if (out_nmemb)
+        *out_nmemb = 0;
+
+    if (!list->count)
+        return NULL;
+
+    if (!*in_out_view) {
+        struct bm_item **view;
+        if (!(view = bm_calloc(BM_MEMORY_FILTER, list->count, sizeof(struct bm_item*))))
+            return NULL;
+
+        for (uint32_t i = 0; i < list->count; ++i)
+            view[i] = (list->indices[i] == filter_item_index ? menu->filter_item : menu->items.items[list->indices[i]]);
+
+        *in_out_view = view;
+    }
+
+    if (out_nmemb)
+        *out_nmemb = list->count;
+
+    return *in_out_view;
+}
+
+static void
+set_filtered(struct bm_menu *menu, uint32_t *indices, uint8_t *ranks, uint32_t count)
+{
+    /* speculation filters the results being replaced */
+    bm_speculation_cancel(menu->speculation);
+    index_list_set_no_copy(&menu->filtered, indices, count);
+    bm_free(menu->filtered_ranks);
+    menu->filtered_ranks = ranks;
+    bm_free(menu->filtered_view);
+    menu->filtered_view = NULL;
+}
+
+/**
+ * Refresh selected flags of item store from selection.
+ */
+static void
+sync_selected_flags(struct bm_menu *menu)
+{
+    bm_free(menu->selection_view);
+    menu->selection_view = NULL;
+
+    if (!bm_item_store_is_valid(&menu->store, menu->items.count))
+        return;
+
+    for (uint32_t i = 0; i < menu->items.count; ++i)
+        menu->store.flags[i] &= ~BM_ITEM_FLAG_SELECTED;
+
+    for (uint32_t i = 0; i < menu->selection.count; ++i) {
+        if (menu->selection.indices[i] != filter_item_index)
+            menu->store.flags[menu->selection.indices[i]] |= BM_ITEM_FLAG_SELECTED;
+    }
+}
+
+static bool
+is_selected(const struct bm_menu *menu, uint32_t index)
+{
+    if (bm_item_store_is_valid(&menu->store, menu->items.count))
+        return (menu->store.flags[index] & BM_ITEM_FLAG_SELECTED);
+
+    return index_list_contains(&menu->selection, index);
+}
+
+static bool
+select_item(struct bm_menu *menu, uint32_t index)
+{
+    if (!index_list_add(&menu->selection, index))
+        return false;
+
+    bm_free(menu->selection_view);
+    menu->selection_view = NULL;
+
+    if (index != filter_item_index && bm_item_store_is_valid(&menu->store, menu->items.count))
+        menu->store.flags[index] |= BM_ITEM_FLAG_SELECTED;
+
+    return true;
+}
+
+/**
+ * Get thread pool of menu, creating it if needed.
+ * Threads are only started when work is large enough to be split.
+ *
+ * @return bm_pool, or **NULL** if it can't be created and work runs on the calling thread.
+ */
+static struct bm_pool*
+get_pool(struct bm_menu *menu)
+{
+    if (!menu->pool && menu->max_threads != 1)
+        menu->pool = bm_pool_new(menu->max_threads);
+
+    return menu->pool;
+}
+
+/**
+ * Get token cache of menu, creating it if needed.
+ * Cache is only created here, so filters running on other threads never get one.
+ *
+ * @return bm_token_cache, or **NULL** if cache is disabled or can't be created.
+ */
+static struct bm_token_cache*
+get_token_cache(struct bm_menu *menu)
+{
+    if (!menu->tokens && menu->token_cache_limit > 0)
+        menu->tokens = bm_token_cache_new(menu->token_cache_limit);
+
+    return menu->tokens;
+}
+
 bool
-bm_menu_item_is_selected(const struct bm_menu *menu, const struct bm_item *item)
+bm_menu_is_path_mode(const struct bm_menu *menu)
+{
+    assert(menu);
+    return (menu->filter_mode == BM_FILTER_MODE_PATH || menu->filter_mode == BM_FILTER_MODE_PATH_CASE_INSENSITIVE);
+}
+
+uint32_t
+bm_menu_get_filtered_count(const struct bm_menu *menu)
 {
     assert(menu);
-    assert(item);
+    return (is_filtering(menu) ? menu->filtered.count : menu->items.count);
+}
+
+struct bm_item*
+bm_menu_get_filtered_item(const struct bm_menu *menu, uint32_t index)
+{
+    assert(menu);
+
+    if (bm_menu_get_filtered_count(menu) <= index)
+        return NULL;
 
-    uint32_t i, count;
-    struct bm_item **items = bm_menu_get_selected_items(menu, &count);
-    for (i = 0; i < count && items[i] != item; ++i);
-    return (i < count);
+    return menu->items.items[item_index(menu, index)];
+}
+
+bool
+bm_menu_filtered_item_is_selected(const struct bm_menu *menu, uint32_t index)
+{
+    assert(menu);
+
+    if (bm_menu_get_filtered_count(menu) <= index)
+        return false;
+
+    return is_selected(menu, item_index(menu, index));
 }
 
 struct bm_menu*
 bm_menu_new(const char *renderer)
 {
     struct bm_menu *menu;
-    if (!(menu = calloc(1, sizeof(struct bm_menu))))
+    if (!(menu = bm_calloc(BM_MEMORY_OTHER, 1, sizeof(struct bm_menu))))
         return NULL;
 
     uint32_t count;
@@ -100,6 +304,9 @@ bm_menu_new(const char *renderer)
     if (!(menu->filter_item = bm_item_new(NULL)))
         goto fail;
 
+    menu->poll_timeout = -1;
+    menu->token_cache_limit = default_token_cache_limit;
+    menu->debug = (secure_getenv("BEMENU_DEBUG") != NULL);
     return menu;
 
 fail:
@@ -112,31 +319,69 @@ bm_menu_free(struct bm_menu *menu)
 {
     assert(menu);
 
+    bm_speculation_free(menu->speculation);
+    menu->speculation = NULL;
+
     if (menu->renderer && menu->renderer->api.destructor)
         menu->renderer->api.destructor(menu);
 
-    free(menu->title);
-    free(menu->filter);
-    free(menu->old_filter);
-    free(menu->font.name);
+    bm_free(menu->title);
+    bm_free(menu->prefix);
+    bm_free(menu->field_delimiter);
+    bm_preview_free(menu->preview, menu);
+    bm_free(menu->poll_fds);
+    bm_free(menu->filter);
+    bm_free(menu->old_filter);
+    bm_free(menu->fuzzy);
+    bm_token_cache_free(menu->tokens);
+    bm_free(menu->font.name);
 
     for (uint32_t i = 0; i < BM_COLOR_LAST; ++i)
-        free(menu->colors[i].hex);
+        bm_free(menu->colors[i].hex);
 
     bm_menu_free_items(menu);
-    free(menu);
+
+    /* filter item is selected on return even without items, so it lives as long as menu */
+    if (menu->filter_item)
+        bm_item_free(menu->filter_item);
+
+    bm_pool_free(menu->pool);
+    bm_free(menu);
+}
+
+/**
+ * Release items of menu, or detach menu from its corpus.
+ */
+static void
+clear_items(struct bm_menu *menu)
+{
+    bm_speculation_reset(menu->speculation);
+    index_list_free(&menu->selection);
+    set_filtered(menu, NULL, NULL, 0);
+    sync_selected_flags(menu);
+
+    if (menu->corpus) {
+        memset(&menu->items, 0, sizeof(struct list));
+        bm_corpus_unref(menu->corpus);
+        menu->corpus = NULL;
+    } else if (menu->arena_items == menu->items.count) {
+        /* arena items are freed with arena, so there is nothing to do for each of them */
+        list_free_list(&menu->items);
+    } else {
+        list_free_items(&menu->items, (list_free_fun)bm_item_free);
+    }
+
+    menu->arena_items = 0;
+    bm_item_store_release(&menu->store);
 }
 
 void
 bm_menu_free_items(struct bm_menu *menu)
 {
     assert(menu);
-    list_free_list(&menu->selection);
-    list_free_list(&menu->filtered);
-    list_free_items(&menu->items, (list_free_fun)bm_item_free);
-
-    if (menu->filter_item)
-        free(menu->filter_item);
+    clear_items(menu);
+    bm_arena_free(menu->arena);
+    menu->arena = NULL;
 }
 
 const struct bm_renderer*
@@ -164,8 +409,8 @@ void
 bm_menu_set_prefix(struct bm_menu *menu, const char *prefix)
 {
     assert(menu);
-    free(menu->prefix);
-    menu->prefix = (prefix && strlen(prefix) > 0 ? bm_strdup(prefix) : NULL);
+    bm_free(menu->prefix);
+    menu->prefix = (prefix && strlen(prefix) > 0 ? bm_strdup(BM_MEMORY_OTHER, prefix) : NULL);
 }
 
 const char*
@@ -175,14 +420,35 @@ bm_menu_get_prefix(struct bm_menu *menu)
     return menu->prefix;
 }
 
+bool
+bm_menu_set_preview(struct bm_menu *menu, const char *command)
+{
+    assert(menu);
+
+    struct bm_preview *preview = NULL;
+    if (command && strlen(command) > 0 && !(preview = bm_preview_new(command)))
+        return false;
+
+    bm_preview_free(menu->preview, menu);
+    menu->preview = preview;
+    return true;
+}
+
+bool
+bm_menu_has_preview(const struct bm_menu *menu)
+{
+    assert(menu);
+    return (menu->preview != NULL);
+}
+
 void
 bm_menu_set_filter(struct bm_menu *menu, const char *filter)
 {
     assert(menu);
 
-    free(menu->filter);
+    bm_free(menu->filter);
     menu->filter_size = (filter ? strlen(filter) : 0);
-    menu->filter = (menu->filter_size > 0 ? bm_strdup(filter) : NULL);
+    menu->filter = (menu->filter_size > 0 ? bm_strdup(BM_MEMORY_FILTER, filter) : NULL);
     menu->curses_cursor = (menu->filter ? bm_utf8_string_screen_width(menu->filter) : 0);
     menu->cursor = menu->filter_size;
 }
@@ -198,7 +464,17 @@ void
 bm_menu_set_filter_mode(struct bm_menu *menu, enum bm_filter_mode mode)
 {
     assert(menu);
-    menu->filter_mode = (mode >= BM_FILTER_MODE_LAST ? BM_FILTER_MODE_DMENU : mode);
+
+    mode = (mode >= BM_FILTER_MODE_LAST ? BM_FILTER_MODE_DMENU : mode);
+
+    if (menu->filter_mode == mode)
+        return;
+
+    menu->filter_mode = mode;
+
+    /* results of another mode can't be narrowed down */
+    bm_free(menu->old_filter);
+    menu->old_filter = NULL;
 }
 
 enum bm_filter_mode
@@ -208,6 +484,159 @@ bm_menu_get_filter_mode(const struct bm_menu *menu)
     return menu->filter_mode;
 }
 
+void
+bm_menu_set_sort_mode(struct bm_menu *menu, enum bm_sort_mode mode)
+{
+    assert(menu);
+
+    mode = (mode >= BM_SORT_MODE_LAST ? BM_SORT_MODE_NONE : mode);
+    if (menu->sort_mode == mode)
+        return;
+
+    menu->sort_mode = mode;
+
+    /* the filtered order may have been lost to previous sort, so filter again */
+    bm_free(menu->old_filter);
+    menu->old_filter = NULL;
+    bm_menu_filter(menu);
+}
+
+enum bm_sort_mode
+bm_menu_get_sort_mode(const struct bm_menu *menu)
+{
+    assert(menu);
+    return menu->sort_mode;
+}
+
+void
+bm_menu_set_thread_count(struct bm_menu *menu, uint32_t count)
+{
+    assert(menu);
+
+    if (menu->max_threads == count)
+        return;
+
+    /* pool is created again with new count on next filter */
+    bm_speculation_cancel(menu->speculation);
+    bm_pool_free(menu->pool);
+    menu->pool = NULL;
+    menu->max_threads = count;
+}
+
+uint32_t
+bm_menu_get_thread_count(const struct bm_menu *menu)
+{
+    assert(menu);
+    return menu->max_threads;
+}
+
+bool
+bm_menu_set_speculation(struct bm_menu *menu, uint32_t count)
+{
+    assert(menu);
+
+    if (bm_speculation_get_max(menu->speculation) == count)
+        return true;
+
+    struct bm_speculation *spec = NULL;
+    if (count > 0 && !(spec = bm_speculation_new(count)))
+        return false;
+
+    bm_speculation_free(menu->speculation);
+    menu->speculation = spec;
+    return true;
+}
+
+uint32_t
+bm_menu_get_speculation(const struct bm_menu *menu)
+{
+    assert(menu);
+    return bm_speculation_get_max(menu->speculation);
+}
+
+bool
+bm_menu_set_token_cache_limit(struct bm_menu *menu, size_t bytes)
+{
+    assert(menu);
+
+    if (menu->token_cache_limit == bytes)
+        return true;
+
+    /* sets are created again as filters are typed */
+    bm_token_cache_free(menu->tokens);
+    menu->tokens = NULL;
+    menu->token_cache_limit = bytes;
+    return true;
+}
+
+size_t
+bm_menu_get_token_cache_limit(const struct bm_menu *menu)
+{
+    assert(menu);
+    return menu->token_cache_limit;
+}
+
+void
+bm_menu_get_speculation_stats(const struct bm_menu *menu, struct bm_speculation_stats *out_stats)
+{
+    assert(menu && out_stats);
+    bm_speculation_get_stats(menu->speculation, out_stats);
+}
+
+bool
+bm_menu_set_field_delimiter(struct bm_menu *menu, const char *delimiter)
+{
+    assert(menu);
+
+    char *copy = NULL;
+    if (delimiter && !(copy = bm_strdup(BM_MEMORY_OTHER, delimiter)))
+        return false;
+
+    bm_free(menu->field_delimiter);
+    menu->field_delimiter = copy;
+    split_fields(menu);
+    return true;
+}
+
+const char*
+bm_menu_get_field_delimiter(const struct bm_menu *menu)
+{
+    assert(menu);
+    return menu->field_delimiter;
+}
+
+void
+bm_menu_set_match_fields(struct bm_menu *menu, uint32_t first, uint32_t last)
+{
+    assert(menu);
+    menu->match_fields = (struct field_range){ first, last };
+    split_fields(menu);
+}
+
+void
+bm_menu_get_match_fields(const struct bm_menu *menu, uint32_t *out_first, uint32_t *out_last)
+{
+    assert(menu && out_first && out_last);
+    *out_first = menu->match_fields.first;
+    *out_last = menu->match_fields.last;
+}
+
+void
+bm_menu_set_display_fields(struct bm_menu *menu, uint32_t first, uint32_t last)
+{
+    assert(menu);
+    menu->display_fields = (struct field_range){ first, last };
+    split_fields(menu);
+}
+
+void
+bm_menu_get_display_fields(const struct bm_menu *menu, uint32_t *out_first, uint32_t *out_last)
+{
+    assert(menu && out_first && out_last);
+    *out_first = menu->display_fields.first;
+    *out_last = menu->display_fields.last;
+}
+
 void
 bm_menu_set_lines(struct bm_menu *menu, uint32_t lines)
 {
@@ -242,10 +671,10 @@ bm_menu_set_title(struct bm_menu *menu, const char *title)
     assert(menu);
 
     char *copy = NULL;
-    if (title && !(copy = bm_strdup(title)))
+    if (title && !(copy = bm_strdup(BM_MEMORY_OTHER, title)))
         return false;
 
-    free(menu->title);
+    bm_free(menu->title);
     menu->title = copy;
     return true;
 }
@@ -265,10 +694,10 @@ bm_menu_set_font(struct bm_menu *menu, const char *font)
     const char *nfont = (font ? font : default_font);
 
     char *copy = NULL;
-    if (!(copy = bm_strdup(nfont)))
+    if (!(copy = bm_strdup(BM_MEMORY_OTHER, nfont)))
         return false;
 
-    free(menu->font.name);
+    bm_free(menu->font.name);
     menu->font.name = copy;
     return true;
 }
@@ -306,10 +735,10 @@ bm_menu_set_color(struct bm_menu *menu, enum bm_color color, const char *hex)
         return false;
 
     char *copy = NULL;
-    if (!(copy = bm_strdup(nhex)))
+    if (!(copy = bm_strdup(BM_MEMORY_OTHER, nhex)))
         return false;
 
-    free(menu->colors[color].hex);
+    bm_free(menu->colors[color].hex);
     menu->colors[color].hex = copy;
     menu->colors[color].r = r;
     menu->colors[color].g = g;
@@ -398,6 +827,46 @@ bm_menu_is_keyboard_grabbed(struct bm_menu *menu)
     return menu->grabbed;
 }
 
+void
+bm_menu_set_visible(struct bm_menu *menu, bool visible)
+{
+    assert(menu);
+
+    if (menu->hidden == !visible)
+        return;
+
+    menu->hidden = !visible;
+
+    if (!visible && menu->grabbed && menu->renderer->api.grab_keyboard)
+        menu->renderer->api.grab_keyboard(menu, false);
+
+    if (menu->renderer->api.set_visible)
+        menu->renderer->api.set_visible(menu, visible);
+
+    if (visible && menu->grabbed && menu->renderer->api.grab_keyboard)
+        menu->renderer->api.grab_keyboard(menu, true);
+}
+
+bool
+bm_menu_is_visible(const struct bm_menu *menu)
+{
+    assert(menu);
+    return !menu->hidden;
+}
+
+void
+bm_menu_reset(struct bm_menu *menu)
+{
+    assert(menu);
+    bm_menu_set_filter(menu, NULL);
+    bm_free(menu->old_filter);
+    menu->old_filter = NULL;
+    menu->index = 0;
+    index_list_free(&menu->selection);
+    set_filtered(menu, NULL, NULL, 0);
+    sync_selected_flags(menu);
+}
+
 void
 bm_menu_set_panel_overlap(struct bm_menu *menu, bool overlap)
 {
@@ -416,13 +885,83 @@ bool
 bm_menu_add_items_at(struct bm_menu *menu, struct bm_item *item, uint32_t index)
 {
     assert(menu);
-    return list_add_item_at(&menu->items, item, index);
+
+    /* arena items are freed with the menu that allocated them */
+    assert(!item->arena || item->arena == menu->arena);
+
+    if (menu->corpus)
+        return false;
+
+    bm_speculation_reset(menu->speculation);
+
+    if (!list_add_item_at(&menu->items, item, index))
+        return false;
+
+    if (item->arena)
+        ++menu->arena_items;
+
+    /* store stays valid for items appended at end, so they can be filtered without rebuilding */
+    if (index + 1 < menu->items.count) {
+        index_list_insert_index(&menu->selection, index);
+        index_list_insert_index(&menu->filtered, index);
+        menu->store.valid = false;
+    }
+
+    item->menu = menu;
+    bm_item_set_fields(item, menu->field_delimiter, menu->match_fields, menu->display_fields);
+    return true;
 }
 
 bool
 bm_menu_add_item(struct bm_menu *menu, struct bm_item *item)
 {
-    return list_add_item(&menu->items, item);
+    return bm_menu_add_items_at(menu, item, menu->items.count);
+}
+
+bool
+bm_menu_add_texts(struct bm_menu *menu, const char **texts, uint32_t nmemb)
+{
+    assert(menu && (texts || nmemb == 0));
+
+    if (menu->corpus)
+        return false;
+
+    if (nmemb == 0)
+        return true;
+
+    if (!menu->arena && !(menu->arena = bm_arena_new()))
+        return false;
+
+    const uint32_t room = menu->items.allocated - menu->items.count;
+    if (room < nmemb && !list_grow(&menu->items, nmemb - room))
+        return false;
+
+    struct bm_item *items;
+    if (!(items = bm_arena_alloc(menu->arena, sizeof(struct bm_item) * nmemb)))
+        return false;
+
+    memset(items, 0, sizeof(struct bm_item) * nmemb);
+    bm_speculation_reset(menu->speculation);
+
+    /* items are appended, so store stays valid like with bm_menu_add_item */
+    for (uint32_t i = 0; i < nmemb; ++i) {
+        struct bm_item *item = &items[i];
+        item->arena = menu->arena;
+
+        if (texts[i]) {
+            item->len = strlen(texts[i]);
+            if (!(item->text = bm_arena_strndup(menu->arena, texts[i], item->len)))
+                return false;
+        }
+
+        item->match = item->display = (struct span){ 0, item->len };
+        item->menu = menu;
+        bm_item_set_fields(item, menu->field_delimiter, menu->match_fields, menu->display_fields);
+        list_add_item(&menu->items, item);
+        ++menu->arena_items;
+    }
+
+    return true;
 }
 
 bool
@@ -430,15 +969,27 @@ bm_menu_remove_item_at(struct bm_menu *menu, uint32_t index)
 {
     assert(menu);
 
-    if (!menu->items.items || menu->items.count <= index)
+    if (menu->corpus || !menu->items.items || menu->items.count <= index)
         return 0;
 
-    struct bm_item *item = ((struct bm_item**)menu->items.items)[index];
+    bm_speculation_reset(menu->speculation);
+
+    struct bm_item *item = menu->items.items[index];
     bool ret = list_remove_item_at(&menu->items, index);
 
     if (ret) {
-        list_remove_item(&menu->selection, item);
-        list_remove_item(&menu->filtered, item);
+        if (item->arena)
+            --menu->arena_items;
+
+        item->menu = NULL;
+        index_list_remove_index(&menu->selection, index);
+        index_list_remove_index(&menu->filtered, index);
+        bm_free(menu->filtered_view);
+        bm_free(menu->filtered_ranks);
+        menu->filtered_view = NULL;
+        menu->filtered_ranks = NULL;
+        menu->store.valid = false;
+        sync_selected_flags(menu);
     }
 
     return ret;
@@ -449,14 +1000,11 @@ bm_menu_remove_item(struct bm_menu *menu, struct bm_item *item)
 {
     assert(menu);
 
-    bool ret = list_remove_item(&menu->items, item);
-
-    if (ret) {
-        list_remove_item(&menu->selection, item);
-        list_remove_item(&menu->filtered, item);
-    }
+    uint32_t index;
+    if (!find_item(menu, item, &index))
+        return false;
 
-    return ret;
+    return bm_menu_remove_item_at(menu, index);
 }
 
 bool
@@ -464,10 +1012,7 @@ bm_menu_set_highlighted_index(struct bm_menu *menu, uint32_t index)
 {
     assert(menu);
 
-    uint32_t count;
-    bm_menu_get_filtered_items(menu, &count);
-
-    if (count <= index)
+    if (bm_menu_get_filtered_count(menu) <= index)
         return 0;
 
     return (menu->index = index);
@@ -478,9 +1023,9 @@ bm_menu_set_highlighted_item(struct bm_menu *menu, struct bm_item *item)
 {
     assert(menu);
 
-    uint32_t i, count;
-    struct bm_item **items = bm_menu_get_filtered_items(menu, &count);
-    for (i = 0; i < count && items[i] != item; ++i);
+    uint32_t i;
+    const uint32_t count = bm_menu_get_filtered_count(menu);
+    for (i = 0; i < count && bm_menu_get_filtered_item(menu, i) != item; ++i);
 
     if (count <= i)
         return 0;
@@ -493,13 +1038,7 @@ bm_menu_get_highlighted_item(const struct bm_menu *menu)
 {
     assert(menu);
 
-    uint32_t count;
-    struct bm_item **items = bm_menu_get_filtered_items(menu, &count);
-
-    if (!items || count <= menu->index)
-        return NULL;
-
-    return items[menu->index];
+    return bm_menu_get_filtered_item(menu, menu->index);
 }
 
 bool
@@ -507,19 +1046,29 @@ bm_menu_set_selected_items(struct bm_menu *menu, struct bm_item **items, uint32_
 {
     assert(menu);
 
-    struct bm_item **new_items;
-    if (!(new_items = calloc(sizeof(struct bm_item*), nmemb)))
+    uint32_t *indices;
+    if (!(indices = bm_calloc(BM_MEMORY_FILTER, sizeof(uint32_t), nmemb)))
         return 0;
 
-    memcpy(new_items, items, sizeof(struct bm_item*) * nmemb);
-    return list_set_items_no_copy(&menu->selection, new_items, nmemb);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < nmemb; ++i) {
+        if (items[i] == menu->filter_item) {
+            indices[count++] = filter_item_index;
+        } else if (find_item(menu, items[i], &indices[count])) {
+            count++;
+        }
+    }
+
+    index_list_set_no_copy(&menu->selection, indices, count);
+    sync_selected_flags(menu);
+    return true;
 }
 
 struct bm_item**
 bm_menu_get_selected_items(const struct bm_menu *menu, uint32_t *out_nmemb)
 {
     assert(menu);
-    return list_get_items(&menu->selection, out_nmemb);
+    return get_view(menu, &menu->selection, &((struct bm_menu*)menu)->selection_view, out_nmemb);
 }
 
 bool
@@ -527,14 +1076,70 @@ bm_menu_set_items(struct bm_menu *menu, const struct bm_item **items, uint32_t n
 {
     assert(menu);
 
-    bool ret = list_set_items(&menu->items, items, nmemb, (list_free_fun)bm_item_free);
+    bm_speculation_reset(menu->speculation);
 
-    if (ret) {
-        list_free_list(&menu->selection);
-        list_free_list(&menu->filtered);
+    if (menu->corpus)
+        clear_items(menu);
+
+    /* replaced items are given back to caller, unless freed below */
+    for (uint32_t i = 0; i < menu->items.count; ++i)
+        ((struct bm_item*)menu->items.items[i])->menu = NULL;
+
+    if (!list_set_items(&menu->items, items, nmemb, (list_free_fun)bm_item_free)) {
+        for (uint32_t i = 0; i < menu->items.count; ++i)
+            ((struct bm_item*)menu->items.items[i])->menu = menu;
+        return false;
     }
 
-    return ret;
+    index_list_free(&menu->selection);
+    set_filtered(menu, NULL, NULL, 0);
+    sync_selected_flags(menu);
+
+    menu->arena_items = 0;
+    for (uint32_t i = 0; i < menu->items.count; ++i) {
+        struct bm_item *item = menu->items.items[i];
+        assert(!item->arena || item->arena == menu->arena);
+        item->menu = menu;
+        menu->arena_items += (item->arena != NULL);
+        bm_item_set_fields(item, menu->field_delimiter, menu->match_fields, menu->display_fields);
+    }
+
+    menu->store.valid = false;
+    return true;
+}
+
+bool
+bm_menu_set_corpus(struct bm_menu *menu, struct bm_corpus *corpus)
+{
+    assert(menu);
+
+    if (menu->corpus == corpus)
+        return true;
+
+    struct bm_item_store store = {0};
+    if (corpus && !bm_item_store_share(&store, &corpus->store))
+        return false;
+
+    clear_items(menu);
+
+    if (!corpus)
+        return true;
+
+    menu->corpus = bm_corpus_ref(corpus);
+    menu->items = (struct list){ (void**)corpus->items, corpus->count, corpus->count };
+    menu->store = store;
+
+    /* store is valid from the start, so make sure the old filter results are not narrowed down */
+    bm_free(menu->old_filter);
+    menu->old_filter = NULL;
+    return true;
+}
+
+struct bm_corpus*
+bm_menu_get_corpus(const struct bm_menu *menu)
+{
+    assert(menu);
+    return menu->corpus;
 }
 
 struct bm_item**
@@ -549,21 +1154,185 @@ bm_menu_get_filtered_items(const struct bm_menu *menu, uint32_t *out_nmemb)
 {
     assert(menu);
 
-    if (menu->filter && strlen(menu->filter))
-        return list_get_items(&menu->filtered, out_nmemb);
+    if (is_filtering(menu))
+        return get_view(menu, &menu->filtered, &((struct bm_menu*)menu)->filtered_view, out_nmemb);
 
     return list_get_items(&menu->items, out_nmemb);
 }
 
+bool
+bm_menu_add_watch_fd(struct bm_menu *menu, int fd)
+{
+    assert(menu && fd >= 0);
+
+    void *tmp;
+    if (!(tmp = bm_realloc(BM_MEMORY_OTHER, menu->poll_fds, sizeof(struct pollfd) * (menu->watch_count + 2))))
+        return false;
+
+    menu->poll_fds = tmp;
+    menu->poll_fds[++menu->watch_count] = (struct pollfd){ .fd = fd, .events = POLLIN };
+    return true;
+}
+
+void
+bm_menu_remove_watch_fd(struct bm_menu *menu, int fd)
+{
+    assert(menu);
+
+    for (uint32_t i = 1; i <= menu->watch_count; ++i) {
+        if (menu->poll_fds[i].fd != fd)
+            continue;
+
+        memmove(&menu->poll_fds[i], &menu->poll_fds[i + 1], sizeof(struct pollfd) * (menu->watch_count - i));
+        menu->watch_count--;
+        return;
+    }
+}
+
+void
+bm_menu_set_poll_timeout(struct bm_menu *menu, int32_t timeout)
+{
+    assert(menu);
+    menu->poll_timeout = (timeout < 0 ? -1 : timeout);
+}
+
+int32_t
+bm_menu_get_poll_timeout(const struct bm_menu *menu)
+{
+    assert(menu);
+    return menu->poll_timeout;
+}
+
+/**
+ * Wait until renderer input is readable, or a watched file descriptor is readable, or poll timeout expires.
+ * Renderers call this before blocking on their input.
+ *
+ * @param menu bm_menu instance whose watched file descriptors and timeout are used.
+ * @param fd File descriptor of renderer input.
+ * @param renderer_timeout Milliseconds renderer waits at most, for example to retry something, -1 for no limit.
+ * @return true if renderer should read its input, false if it should return without input.
+ */
+bool
+bm_menu_wait_fd(const struct bm_menu *menu, int fd, int32_t renderer_timeout)
+{
+    assert(menu);
+
+    int32_t timeout = menu->poll_timeout;
+    const int32_t preview_timeout = bm_preview_get_timeout(menu->preview);
+    if (preview_timeout >= 0 && (timeout < 0 || preview_timeout < timeout))
+        timeout = preview_timeout;
+
+    if (renderer_timeout >= 0 && (timeout < 0 || renderer_timeout < timeout))
+        timeout = renderer_timeout;
+
+    if (!menu->watch_count && timeout < 0)
+        return true;
+
+    struct pollfd input = { .fd = fd, .events = POLLIN };
+    struct pollfd *fds = (menu->watch_count ? menu->poll_fds : &input);
+    fds[0] = input;
+
+    /* interrupted, for example by resize, so let renderer handle its input */
+    if (poll(fds, menu->watch_count + 1, timeout) < 0)
+        return true;
+
+    return (fds[0].revents != 0);
+}
+
 void
 bm_menu_render(const struct bm_menu *menu)
 {
     assert(menu);
 
+    if (menu->hidden)
+        return;
+
+    /* render is the one call every menu loop makes, so keep preview of highlighted item going from here */
+    if (menu->preview)
+        bm_preview_update(menu->preview, (struct bm_menu*)menu);
+
+    if (menu->speculation)
+        bm_menu_speculate((struct bm_menu*)menu);
+
     if (menu->renderer->api.render)
         menu->renderer->api.render(menu);
 }
 
+/**
+ * Filter current results ahead with likely next characters on the menu's pool.
+ * Called while menu waits for input, speculation is cancelled once input arrives.
+ *
+ * @param menu bm_menu instance to speculate for.
+ */
+void
+bm_menu_speculate(struct bm_menu *menu)
+{
+    assert(menu);
+
+    if (!menu->speculation)
+        return;
+
+    /* acronym filter builds initials lazily, which must not happen on pool threads */
+    if (menu->filter_mode == BM_FILTER_MODE_ACRONYM && bm_item_store_is_valid(&menu->store, menu->items.count) && !bm_item_store_build_initials(&menu->store))
+        return;
+
+    get_pool(menu);
+    bm_speculation_start(menu->speculation, menu, filter_func[menu->filter_mode]);
+}
+
+/**
+ * Filter items appended since last filter, and merge them to current results.
+ * Highlighted item stays highlighted, even if appended items are listed before it.
+ *
+ * @param menu bm_menu instance to filter.
+ * @param first Index of first appended item.
+ * @return true on success, false if results have to be filtered from scratch.
+ */
+static bool
+filter_appended(struct bm_menu *menu, uint32_t first)
+{
+    if (!menu->filtered_ranks && menu->filtered.count > 0)
+        return false;
+
+    uint8_t *ranks;
+    uint32_t count;
+    uint32_t *filtered = filter_func[menu->filter_mode](menu, NULL, first, menu->items.count, &ranks, &count);
+
+    if (!filtered && count > 0)
+        return false;
+
+    if (!count)
+        return true;
+
+    struct bm_item **items = (struct bm_item**)menu->items.items;
+    if (!ranks || !bm_sort_items(items, filtered, ranks, count, menu->sort_mode, menu->pool))
+        goto fail;
+
+    uint8_t *merged_ranks;
+    uint32_t *merged;
+    if (!(merged = bm_sort_merge(items, menu->filtered.indices, menu->filtered_ranks, menu->filtered.count, filtered, ranks, count, menu->sort_mode, &merged_ranks)))
+        goto fail;
+
+    const uint32_t highlighted = (menu->index < menu->filtered.count ? menu->filtered.indices[menu->index] : UINT32_MAX);
+    set_filtered(menu, merged, merged_ranks, menu->filtered.count + count);
+
+    for (uint32_t i = 0; highlighted != UINT32_MAX && i < menu->filtered.count; ++i) {
+        if (menu->filtered.indices[i] == highlighted) {
+            menu->index = i;
+            break;
+        }
+    }
+
+    bm_free(filtered);
+    bm_free(ranks);
+    return true;
+
+fail:
+    bm_free(filtered);
+    bm_free(ranks);
+    return false;
+}
+
 void
 bm_menu_filter(struct bm_menu *menu)
 {
@@ -573,12 +1342,44 @@ bm_menu_filter(struct bm_menu *menu)
     size_t len = (menu->filter ? strlen(menu->filter) : 0);
 
     if (!len || !menu->items.items || menu->items.count <= 0) {
-        list_free_list(&menu->filtered);
-        free(menu->old_filter);
+        set_filtered(menu, NULL, NULL, 0);
+        bm_free(menu->old_filter);
         menu->old_filter = NULL;
         return;
     }
 
+    struct bm_pool *pool = get_pool(menu);
+    get_token_cache(menu);
+
+    if (!bm_item_store_is_valid(&menu->store, menu->items.count)) {
+        bm_speculation_reset(menu->speculation);
+
+        /* items appended at end keep the store and results valid for items before them */
+        const uint32_t first = (menu->store.valid && menu->store.count < menu->items.count ? menu->store.count : 0);
+
+        if (!bm_item_store_build(&menu->store, (struct bm_item**)menu->items.items, menu->items.count, pool)) {
+            bm_free(menu->old_filter);
+            menu->old_filter = NULL;
+            return;
+        }
+
+        if (first > 0) {
+            for (uint32_t i = 0; i < menu->selection.count; ++i) {
+                if (menu->selection.indices[i] != filter_item_index && menu->selection.indices[i] >= first)
+                    menu->store.flags[menu->selection.indices[i]] |= BM_ITEM_FLAG_SELECTED;
+            }
+        } else {
+            sync_selected_flags(menu);
+        }
+
+        if (first > 0 && menu->old_filter && !strcmp(menu->filter, menu->old_filter) && filter_appended(menu, first))
+            return;
+
+        /* items changed, previous results can't be narrowed down */
+        bm_free(menu->old_filter);
+        menu->old_filter = NULL;
+    }
+
     if (menu->old_filter) {
         size_t oldLen = strlen(menu->old_filter);
         addition = (oldLen < len && !memcmp(menu->old_filter, menu->filter, oldLen));
@@ -590,14 +1391,31 @@ bm_menu_filter(struct bm_menu *menu)
     if (menu->old_filter && !strcmp(menu->filter, menu->old_filter))
         return;
 
+    bm_plan_filter(menu, addition, &menu->plan);
+
+    uint8_t *ranks;
     uint32_t count;
-    struct bm_item **filtered = filter_func[menu->filter_mode](menu, addition, &count);
+    uint32_t *filtered;
+    if (bm_speculation_take(menu->speculation, menu, &filtered, &ranks, &count)) {
+        set_filtered(menu, filtered, ranks, count);
+        menu->index = 0;
+        bm_free(menu->old_filter);
+        menu->old_filter = bm_strdup(BM_MEMORY_FILTER, menu->filter);
+        bm_plan_log(menu, &menu->plan, "speculation", count);
+        return;
+    }
 
-    list_set_items_no_copy(&menu->filtered, filtered, count);
+    filtered = (menu->plan.strategy == BM_PLAN_NARROW ?
+            filter_func[menu->filter_mode](menu, menu->filtered.indices, 0, menu->filtered.count, &ranks, &count) :
+            filter_func[menu->filter_mode](menu, NULL, 0, menu->items.count, &ranks, &count));
+    bm_sort_items((struct bm_item**)menu->items.items, filtered, ranks, count, menu->sort_mode, pool);
+
+    set_filtered(menu, filtered, ranks, count);
     menu->index = 0;
+    bm_plan_log(menu, &menu->plan, NULL, count);
 
-    free(menu->old_filter);
-    menu->old_filter = bm_strdup(menu->filter);
+    bm_free(menu->old_filter);
+    menu->old_filter = bm_strdup(BM_MEMORY_FILTER, menu->filter);
 }
 
 enum bm_key
@@ -611,6 +1429,10 @@ bm_menu_poll_key(struct bm_menu *menu, uint32_t *out_unicode)
     if (menu->renderer->api.poll_key)
         key = menu->renderer->api.poll_key(menu, out_unicode);
 
+    /* input is handled before speculation may continue, so it never waits for speculated results */
+    if (key != BM_KEY_NONE && !(key == BM_KEY_UNICODE && !*out_unicode))
+        bm_speculation_cancel(menu->speculation);
+
     return key;
 }
 
@@ -639,8 +1461,7 @@ bm_menu_run_with_key(struct bm_menu *menu, enum bm_key key, uint32_t unicode)
 {
     assert(menu);
 
-    uint32_t count;
-    bm_menu_get_filtered_items(menu, &count);
+    const uint32_t count = bm_menu_get_filtered_count(menu);
 
     uint32_t displayed = 0;
     if (menu->renderer->api.get_displayed_count)
@@ -755,6 +1576,18 @@ bm_menu_run_with_key(struct bm_menu *menu, enum bm_key key, uint32_t unicode)
             }
             break;
 
+        case BM_KEY_PASTE:
+            {
+                /* whole paste is one edit, so it is filtered once */
+                const char *text;
+                if (menu->renderer->api.get_paste && (text = menu->renderer->api.get_paste(menu))) {
+                    size_t width;
+                    menu->cursor += bm_utf8_string_insert(&menu->filter, &menu->filter_size, menu->cursor, text, strlen(text), &width);
+                    menu->curses_cursor += width;
+                }
+            }
+            break;
+
         case BM_KEY_TAB:
             {
                 menu_next(menu, count, true);
@@ -772,16 +1605,14 @@ bm_menu_run_with_key(struct bm_menu *menu, enum bm_key key, uint32_t unicode)
 
         case BM_KEY_CONTROL_RETURN:
         case BM_KEY_RETURN:
-            {
-                struct bm_item *highlighted = bm_menu_get_highlighted_item(menu);
-                if (highlighted && !bm_menu_item_is_selected(menu, highlighted))
-                    list_add_item(&menu->selection, highlighted);
-            }
+            if (menu->index < count && !bm_menu_filtered_item_is_selected(menu, menu->index))
+                select_item(menu, item_index(menu, menu->index));
             break;
 
         case BM_KEY_SHIFT_RETURN: /* this will return the filter as selected item below! */
         case BM_KEY_ESCAPE: /* this will cancel however */
-            list_free_list(&menu->selection);
+            index_list_free(&menu->selection);
+            sync_selected_flags(menu);
             break;
 
         default: break;
@@ -792,9 +1623,9 @@ bm_menu_run_with_key(struct bm_menu *menu, enum bm_key key, uint32_t unicode)
     switch (key) {
         case BM_KEY_SHIFT_RETURN:
         case BM_KEY_RETURN:
-            if (!bm_menu_get_selected_items(menu, NULL)) {
+            if (!menu->selection.count) {
                 bm_item_set_text(menu->filter_item, menu->filter);
-                list_add_item(&menu->selection, menu->filter_item);
+                select_item(menu, filter_item_index);
             }
             return BM_RUN_RESULT_SELECTED;
         case BM_KEY_ESCAPE: return BM_RUN_RESULT_CANCEL;
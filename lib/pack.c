@@ -0,0 +1,256 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Texts per block.
+ * First text of a block is stored whole, so any text is found by decoding at most this many.
+ */
+static const uint32_t pack_block_size = 16;
+
+/**
+ * Texts front coded against the previous text, in blocks.
+ */
+struct bm_pack {
+    /**
+     * Entries back to back.
+     * Entry is length of prefix shared with previous text and length of suffix as LEB128 varints, followed by suffix.
+     * Entries without shared prefix hold the whole text, and are read in place.
+     */
+    uint8_t *data;
+    size_t len, allocated;
+
+    /**
+     * Offset of first entry of each block in data.
+     */
+    size_t *blocks;
+
+    /**
+     * Number of texts.
+     */
+    uint32_t count;
+};
+
+static size_t
+varint_size(uint32_t value)
+{
+    size_t n = 1;
+    for (; value >= 0x80; value >>= 7)
+        ++n;
+    return n;
+}
+
+static uint8_t*
+varint_write(uint8_t *p, uint32_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        *p++ = (value & 0x7f) | 0x80;
+    *p++ = value;
+    return p;
+}
+
+static uint32_t
+varint_read(const uint8_t **in_out_p)
+{
+    const uint8_t *p = *in_out_p;
+    uint32_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        const uint8_t b = *p++;
+        value |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            break;
+    }
+    *in_out_p = p;
+    return value;
+}
+
+/**
+ * Pack texts with front coding.
+ * Sorted texts share long prefixes with their neighbours, and pack the best.
+ *
+ * @param texts Array of null terminated C "strings", **NULL** entries are packed as empty text.
+ * @param count Number of texts in array.
+ * @return bm_pack for success, **NULL** on failure.
+ */
+struct bm_pack*
+bm_pack_new(const char **texts, uint32_t count)
+{
+    assert(texts || count == 0);
+
+    struct bm_pack *pack;
+    if (!(pack = bm_calloc(BM_MEMORY_ITEMS, 1, sizeof(struct bm_pack))))
+        return NULL;
+
+    if (!(pack->blocks = bm_calloc(BM_MEMORY_ITEMS, count / pack_block_size + 1, sizeof(size_t))))
+        goto fail;
+
+    const char *prev = "";
+    size_t prev_len = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const char *text = (texts[i] ? texts[i] : "");
+        const size_t len = strlen(text);
+        if (len > UINT32_MAX)
+            goto fail;
+
+        /* texts decoded from a shared prefix must fit the scratch of reader */
+        size_t prefix = 0;
+        if (i % pack_block_size && len <= BM_PACK_SCRATCH_SIZE) {
+            const size_t max = (len < prev_len ? len : prev_len);
+            for (; prefix < max && text[prefix] == prev[prefix]; ++prefix);
+        }
+
+        const size_t suffix = len - prefix;
+        const size_t size = varint_size(prefix) + varint_size(suffix) + suffix;
+        if (pack->allocated - pack->len < size) {
+            size_t nsize = (pack->allocated ? pack->allocated * 2 : 4096);
+            for (; nsize - pack->len < size; nsize *= 2);
+
+            void *tmp;
+            if (!(tmp = bm_realloc(BM_MEMORY_ITEMS, pack->data, nsize)))
+                goto fail;
+
+            pack->data = tmp;
+            pack->allocated = nsize;
+        }
+
+        if (i % pack_block_size == 0)
+            pack->blocks[i / pack_block_size] = pack->len;
+
+        uint8_t *p = pack->data + pack->len;
+        p = varint_write(p, prefix);
+        p = varint_write(p, suffix);
+        memcpy(p, text + prefix, suffix);
+        pack->len += size;
+
+        prev = text;
+        prev_len = len;
+    }
+
+    /* texts are never added, so give back the growth slack */
+    void *tmp;
+    if (pack->len > 0 && (tmp = bm_realloc(BM_MEMORY_ITEMS, pack->data, pack->len))) {
+        pack->data = tmp;
+        pack->allocated = pack->len;
+    }
+
+    pack->count = count;
+    return pack;
+
+fail:
+    bm_pack_free(pack);
+    return NULL;
+}
+
+/**
+ * Release packed texts.
+ *
+ * @param pack bm_pack to free, may be **NULL**.
+ */
+void
+bm_pack_free(struct bm_pack *pack)
+{
+    if (!pack)
+        return;
+
+    bm_free(pack->data);
+    bm_free(pack->blocks);
+    bm_free(pack);
+}
+
+/**
+ * Prepare reader for packed texts.
+ * Reader needs no release, its scratch lives inside it.
+ *
+ * @param reader bm_pack_reader to prepare.
+ * @param pack bm_pack to read, may be **NULL** when reader is not used.
+ */
+void
+bm_pack_reader_init(struct bm_pack_reader *reader, const struct bm_pack *pack)
+{
+    assert(reader);
+    reader->pack = pack;
+    reader->next = NULL;
+    reader->text = NULL;
+    reader->index = UINT32_MAX;
+}
+
+/**
+ * Read packed text.
+ * Reading texts in increasing order decodes each text once, from the one before it.
+ * Other orders decode from the start of the block.
+ *
+ * @param reader bm_pack_reader to read with.
+ * @param index Index of text to read.
+ * @param out_len Reference to uint32_t where length of text is stored, may be **NULL**.
+ * @return Text, not null terminated. Valid until next read.
+ */
+const char*
+bm_pack_read(struct bm_pack_reader *reader, uint32_t index, uint32_t *out_len)
+{
+    assert(reader && reader->pack && index < reader->pack->count);
+
+    const uint32_t block = index / pack_block_size;
+    uint32_t i = reader->index + 1;
+    if (reader->index == UINT32_MAX || index < i || block != reader->index / pack_block_size) {
+        reader->next = reader->pack->data + reader->pack->blocks[block];
+        i = block * pack_block_size;
+    }
+
+    const uint8_t *p = reader->next;
+    uint32_t len = reader->len;
+    for (; i <= index; ++i) {
+        const uint32_t prefix = varint_read(&p);
+        const uint32_t suffix = varint_read(&p);
+
+        if (!prefix) {
+            reader->text = (const char*)p;
+        } else {
+            if (reader->text != reader->scratch)
+                memcpy(reader->scratch, reader->text, prefix);
+            memcpy(reader->scratch + prefix, p, suffix);
+            reader->text = reader->scratch;
+        }
+
+        len = prefix + suffix;
+        p += suffix;
+    }
+
+    reader->next = p;
+    reader->len = len;
+    reader->index = index;
+
+    if (out_len)
+        *out_len = len;
+
+    return reader->text;
+}
+
+/**
+ * Copy packed text to new null terminated C "string".
+ *
+ * @param pack bm_pack to read.
+ * @param index Index of text to copy.
+ * @return Copy of text that must be freed, **NULL** if out of memory.
+ */
+char*
+bm_pack_copy(const struct bm_pack *pack, uint32_t index)
+{
+    assert(pack);
+
+    struct bm_pack_reader reader;
+    bm_pack_reader_init(&reader, pack);
+
+    uint32_t len;
+    const char *text = bm_pack_read(&reader, index, &len);
+
+    char *copy;
+    if (!(copy = bm_malloc(BM_MEMORY_ITEMS, (size_t)len + 1)))
+        return NULL;
+
+    memcpy(copy, text, len);
+    copy[len] = 0;
+    return copy;
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
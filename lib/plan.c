@@ -0,0 +1,208 @@
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <assert.h>
+
+/**
+ * Filters expected to reuse sets built by splitting, so cost of building them is shared between those filters.
+ * Only applies to queries of several tokens, a single token is mostly extended by typing, which narrowing does cheaper.
+ */
+static const uint64_t plan_set_reuse = 3;
+
+static const char *strategy_names[BM_PLAN_LAST] = {
+    "scan", /* BM_PLAN_SCAN */
+    "narrow", /* BM_PLAN_NARROW */
+    "tokens", /* BM_PLAN_TOKENS */
+    "split", /* BM_PLAN_SPLIT */
+};
+
+/**
+ * Token of filter, and its cached set if it has one.
+ */
+struct plan_token {
+    const char *text;
+    size_t len;
+    const struct bm_bitset *set;
+};
+
+static uint64_t
+get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Filter modes whose filters keep sets of tokens in token cache.
+ */
+static bool
+uses_token_cache(const struct bm_menu *menu, bool *out_nocase)
+{
+    *out_nocase = (menu->filter_mode == BM_FILTER_MODE_DMENU_CASE_INSENSITIVE || menu->filter_mode == BM_FILTER_MODE_PATH_CASE_INSENSITIVE);
+    return (menu->tokens && (menu->filter_mode == BM_FILTER_MODE_DMENU || menu->filter_mode == BM_FILTER_MODE_PATH || *out_nocase));
+}
+
+/**
+ * Estimate cost of matching items against tokens.
+ *
+ * Kernels stop at the first token an item misses, so each token is only matched against items that matched the tokens before it.
+ * Cached sets tell how many items match their token, other tokens are guessed to match fewer items the longer they are.
+ *
+ * @param count Number of items matched.
+ * @param tokens Tokens items are matched against.
+ * @param ntokens Number of tokens.
+ * @param items Number of all items.
+ * @param in_sets Whether items are known to be in all cached sets.
+ * @param out_matches Reference to estimated number of items matching all tokens, may be **NULL**.
+ * @return Estimated cost, in items matched against a token.
+ */
+static uint64_t
+estimate(uint64_t count, const struct plan_token *tokens, uint32_t ntokens, uint32_t items, bool in_sets, uint64_t *out_matches)
+{
+    uint64_t cost = 0;
+    for (uint32_t t = 0; t < ntokens && count > 0; ++t) {
+        cost += count;
+
+        if (!tokens[t].set) {
+            count /= tokens[t].len + 1;
+        } else if (!in_sets) {
+            count = count * bm_bitset_get_count(tokens[t].set) / items;
+        }
+    }
+
+    if (out_matches)
+        *out_matches = count;
+
+    return cost;
+}
+
+/**
+ * Pick cheapest strategy for filtering items of menu with its filter.
+ *
+ * @param menu bm_menu instance to filter, with valid store.
+ * @param addition Whether characters were appended to the previous filter, so its results can be narrowed down.
+ * @param out_plan Reference to bm_plan where strategy and its estimates are stored.
+ */
+void
+bm_plan_filter(struct bm_menu *menu, bool addition, struct bm_plan *out_plan)
+{
+    assert(menu && out_plan);
+
+    *out_plan = (struct bm_plan){0};
+    out_plan->strategy = (addition ? BM_PLAN_NARROW : BM_PLAN_SCAN);
+    out_plan->started = (menu->debug ? get_time_us() : 0);
+
+    for (uint32_t i = 0; i < BM_PLAN_LAST; ++i)
+        out_plan->cost[i] = UINT64_MAX;
+
+    const char *filter = (menu->filter ? menu->filter : "");
+    uint32_t ntokens = 0;
+    for (const char *s = filter + strspn(filter, " "); *s; s += strspn(s, " ")) {
+        s += strcspn(s, " ");
+        ++ntokens;
+    }
+
+    struct plan_token *tokens = NULL;
+    const struct bm_bitset **sets = NULL;
+    if (ntokens > 0 && !(tokens = bm_calloc(BM_MEMORY_FILTER, ntokens, sizeof(struct plan_token))))
+        goto out;
+
+    if (ntokens > 0 && !(sets = bm_calloc(BM_MEMORY_FILTER, ntokens, sizeof(struct bm_bitset*))))
+        goto out;
+
+    bool nocase;
+    const bool cache = uses_token_cache(menu, &nocase);
+    const uint32_t items = menu->store.count;
+
+    uint32_t nsets = 0, t = 0;
+    for (const char *s = filter + strspn(filter, " "); *s; s += strspn(s, " "), ++t) {
+        tokens[t].text = s;
+        tokens[t].len = strcspn(s, " ");
+        s += tokens[t].len;
+
+        if (cache && (tokens[t].set = bm_token_cache_get(menu->tokens, menu->store.generation, nocase, tokens[t].text, tokens[t].len)))
+            sets[nsets++] = tokens[t].set;
+    }
+
+    out_plan->tokens = ntokens;
+    out_plan->cached = nsets;
+
+    out_plan->cost[BM_PLAN_SCAN] = estimate(items, tokens, ntokens, items, false, NULL);
+
+    if (addition)
+        out_plan->cost[BM_PLAN_NARROW] = estimate(menu->filtered.count, tokens, ntokens, items, false, NULL);
+
+    if (cache && nsets > 0) {
+        /* only cached tokens narrow down candidates, which are then matched against all tokens */
+        struct plan_token *cached;
+        if ((cached = bm_calloc(BM_MEMORY_FILTER, nsets, sizeof(struct plan_token)))) {
+            for (uint32_t i = 0, c = 0; i < ntokens; ++i) {
+                if (tokens[i].set)
+                    cached[c++] = tokens[i];
+            }
+
+            uint64_t candidates;
+            estimate(items, cached, nsets, items, false, &candidates);
+            out_plan->cost[BM_PLAN_TOKENS] = bm_bitset_intersect_cost(sets, nsets) + estimate(candidates, tokens, ntokens, items, true, NULL);
+            bm_free(cached);
+        }
+    } else if (cache && ntokens > 0) {
+        /* single token is scanned once and its matches are its set, more tokens are intersected and matched afterwards */
+        const uint64_t words = ((uint64_t)items + 63) / 64;
+        uint64_t cost = ((uint64_t)items + words) * ntokens / (ntokens > 1 ? plan_set_reuse : 1);
+        if (ntokens > 1) {
+            uint64_t matches;
+            estimate(items, tokens, ntokens, items, false, &matches);
+            cost += (words + matches) * ntokens;
+        }
+
+        out_plan->cost[BM_PLAN_SPLIT] = cost;
+    }
+
+    for (uint32_t i = 0; i < BM_PLAN_LAST; ++i) {
+        if (out_plan->cost[i] < out_plan->cost[out_plan->strategy])
+            out_plan->strategy = i;
+    }
+
+out:
+    bm_free(tokens);
+    bm_free(sets);
+}
+
+/**
+ * Log how menu was filtered to stderr, if BEMENU_DEBUG is set.
+ *
+ * @param menu bm_menu instance that was filtered.
+ * @param plan bm_plan filter was planned with.
+ * @param how Strategy results came from, **NULL** for the planned strategy.
+ * @param count Number of filtered items.
+ */
+void
+bm_plan_log(const struct bm_menu *menu, const struct bm_plan *plan, const char *how, uint32_t count)
+{
+    assert(menu && plan);
+
+    if (!menu->debug)
+        return;
+
+    char costs[BM_PLAN_LAST][24];
+    for (uint32_t i = 0; i < BM_PLAN_LAST; ++i) {
+        if (plan->cost[i] == UINT64_MAX) {
+            snprintf(costs[i], sizeof(costs[i]), "-");
+        } else {
+            snprintf(costs[i], sizeof(costs[i]), "%" PRIu64, plan->cost[i]);
+        }
+    }
+
+    const uint64_t elapsed = get_time_us() - plan->started;
+    fprintf(stderr, "bemenu: filter \"%s\" by %s, %u of %u items in %" PRIu64 ".%03" PRIu64 " ms, %u of %u tokens cached, cost scan %s narrow %s tokens %s split %s\n",
+            (menu->filter ? menu->filter : ""), (how ? how : strategy_names[plan->strategy]), count, menu->items.count,
+            elapsed / 1000, elapsed % 1000, plan->cached, plan->tokens,
+            costs[BM_PLAN_SCAN], costs[BM_PLAN_NARROW], costs[BM_PLAN_TOKENS], costs[BM_PLAN_SPLIT]);
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
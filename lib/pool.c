@@ -0,0 +1,384 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+/**
+ * Initial number of tasks a deque can hold, must be power of two.
+ */
+static const uint32_t deque_initial_size = 64;
+
+/**
+ * Range of work queued to the pool.
+ */
+struct pool_task {
+    bm_pool_fun fun;
+    void *data;
+    uint32_t begin, end;
+    struct bm_pool_group *group;
+};
+
+/**
+ * Double ended queue of tasks owned by a worker.
+ * The owner pops newest tasks from the bottom, others steal oldest from the top.
+ */
+struct pool_deque {
+    pthread_mutex_t mutex;
+    struct pool_task *tasks;
+    uint32_t head, tail, mask;
+};
+
+struct pool_worker {
+    struct bm_pool *pool;
+    struct pool_deque deque;
+    pthread_t thread;
+    uint32_t id;
+};
+
+struct bm_pool {
+    /**
+     * Workers, threads are started on first spawn.
+     */
+    struct pool_worker *workers;
+
+    /**
+     * Maximum number of threads working, including the thread that joins.
+     */
+    uint32_t max_threads;
+
+    /**
+     * Number of workers whose threads are running.
+     */
+    uint32_t nworkers;
+
+    /**
+     * Number of tasks in all deques.
+     */
+    uint32_t queued;
+
+    /**
+     * Deque the next spawned task is pushed to.
+     */
+    uint32_t next;
+
+    bool started, stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake, done;
+};
+
+static bool
+deque_push(struct bm_pool *pool, struct pool_deque *deque, const struct pool_task *task)
+{
+    pthread_mutex_lock(&deque->mutex);
+
+    if (!deque->tasks || deque->tail - deque->head > deque->mask) {
+        const uint32_t size = (deque->tasks ? (deque->mask + 1) * 2 : deque_initial_size);
+
+        struct pool_task *tasks;
+        if (!(tasks = bm_calloc(BM_MEMORY_OTHER, size, sizeof(struct pool_task)))) {
+            pthread_mutex_unlock(&deque->mutex);
+            return false;
+        }
+
+        for (uint32_t i = deque->head; i != deque->tail; ++i)
+            tasks[i & (size - 1)] = deque->tasks[i & deque->mask];
+
+        bm_free(deque->tasks);
+        deque->tasks = tasks;
+        deque->mask = size - 1;
+    }
+
+    deque->tasks[deque->tail++ & deque->mask] = *task;
+
+    /* counted under the deque lock, so a pop can never see the task before the count */
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&deque->mutex);
+    return true;
+}
+
+static bool
+deque_pop(struct bm_pool *pool, struct pool_deque *deque, bool steal, struct pool_task *out_task)
+{
+    pthread_mutex_lock(&deque->mutex);
+
+    if (deque->head == deque->tail) {
+        pthread_mutex_unlock(&deque->mutex);
+        return false;
+    }
+
+    *out_task = (steal ? deque->tasks[deque->head++ & deque->mask] : deque->tasks[--deque->tail & deque->mask]);
+    __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&deque->mutex);
+    return true;
+}
+
+/**
+ * Pop task from own deque of worker, or steal one from the others.
+ *
+ * @param pool bm_pool to find task from.
+ * @param id Worker looking for task, nworkers for the joining thread that has no deque.
+ * @param out_task Reference to pool_task where the task is stored.
+ * @return true if task was found.
+ */
+static bool
+find_task(struct bm_pool *pool, uint32_t id, struct pool_task *out_task)
+{
+    const uint32_t nworkers = __atomic_load_n(&pool->nworkers, __ATOMIC_ACQUIRE);
+    if (id < nworkers && deque_pop(pool, &pool->workers[id].deque, false, out_task))
+        return true;
+
+    for (uint32_t i = 1; i <= nworkers; ++i) {
+        const uint32_t victim = (id + i) % (nworkers + 1);
+        if (victim < nworkers && deque_pop(pool, &pool->workers[victim].deque, true, out_task))
+            return true;
+    }
+
+    return false;
+}
+
+static void
+run_task(struct bm_pool *pool, const struct pool_task *task)
+{
+    task->fun(task->data, task->begin, task->end);
+
+    if (__atomic_sub_fetch(&task->group->pending, 1, __ATOMIC_ACQ_REL) == 0 && pool) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static void*
+worker_main(void *arg)
+{
+    struct pool_worker *worker = arg;
+    struct bm_pool *pool = worker->pool;
+
+    for (;;) {
+        struct pool_task task;
+        if (find_task(pool, worker->id, &task)) {
+            run_task(pool, &task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->stop && !__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&pool->wake, &pool->mutex);
+        const bool stop = pool->stop;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (stop)
+            return NULL;
+    }
+}
+
+/**
+ * Start worker threads, if not started yet.
+ * Pool keeps running with fewer workers, if threads can't be created.
+ */
+static bool
+start(struct bm_pool *pool)
+{
+    if (pool->started)
+        return (pool->nworkers > 0);
+
+    pool->started = true;
+
+    for (uint32_t i = 0; i + 1 < pool->max_threads; ++i) {
+        struct pool_worker *worker = &pool->workers[i];
+        if (pthread_create(&worker->thread, NULL, worker_main, worker))
+            break;
+        __atomic_store_n(&pool->nworkers, i + 1, __ATOMIC_RELEASE);
+    }
+
+    return (pool->nworkers > 0);
+}
+
+/**
+ * Create new thread pool.
+ * Threads are started lazily when work is first spawned.
+ *
+ * @param max_threads Maximum number of threads working, including the caller. 0 uses number of online CPUs.
+ * @return bm_pool for success, **NULL** on failure.
+ */
+struct bm_pool*
+bm_pool_new(uint32_t max_threads)
+{
+    if (max_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max_threads = (cpus > 0 ? cpus : 1);
+    }
+
+    struct bm_pool *pool;
+    if (!(pool = bm_calloc(BM_MEMORY_OTHER, 1, sizeof(struct bm_pool))))
+        return NULL;
+
+    pool->max_threads = max_threads;
+
+    if (max_threads > 1 && !(pool->workers = bm_calloc(BM_MEMORY_OTHER, max_threads - 1, sizeof(struct pool_worker))))
+        goto fail;
+
+    for (uint32_t i = 0; i + 1 < max_threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pthread_mutex_init(&pool->workers[i].deque.mutex, NULL);
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    return pool;
+
+fail:
+    bm_free(pool);
+    return NULL;
+}
+
+/**
+ * Stop threads of pool and release it.
+ * All spawned work must have been joined.
+ *
+ * @param pool bm_pool to free, may be **NULL**.
+ */
+void
+bm_pool_free(struct bm_pool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (uint32_t i = 0; i < pool->nworkers; ++i)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for (uint32_t i = 0; i + 1 < pool->max_threads; ++i) {
+        pthread_mutex_destroy(&pool->workers[i].deque.mutex);
+        bm_free(pool->workers[i].deque.tasks);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->mutex);
+    bm_free(pool->workers);
+    bm_free(pool);
+}
+
+/**
+ * Get maximum number of threads working on pool, including the caller.
+ *
+ * @param pool bm_pool to query, may be **NULL**.
+ * @return Number of threads, 1 for **NULL** pool.
+ */
+uint32_t
+bm_pool_get_thread_count(const struct bm_pool *pool)
+{
+    return (pool ? pool->max_threads : 1);
+}
+
+/**
+ * Queue function to be ran over range by the pool.
+ * Function is ran on the calling thread, if pool is **NULL** or can't take the work.
+ *
+ * @param pool bm_pool to run function with, may be **NULL**.
+ * @param group bm_pool_group that is joined to wait for the function.
+ * @param fun Function to run.
+ * @param data Data passed to function.
+ * @param begin Start of range passed to function.
+ * @param end End of range passed to function.
+ */
+void
+bm_pool_spawn(struct bm_pool *pool, struct bm_pool_group *group, bm_pool_fun fun, void *data, uint32_t begin, uint32_t end)
+{
+    assert(group && fun);
+
+    const struct pool_task task = { fun, data, begin, end, group };
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_ACQ_REL);
+
+    if (!pool || !start(pool)) {
+        run_task(pool, &task);
+        return;
+    }
+
+    const uint32_t id = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->nworkers;
+    if (!deque_push(pool, &pool->workers[id].deque, &task)) {
+        run_task(pool, &task);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Wait until all work spawned to group has finished.
+ * Calling thread runs queued tasks while it waits.
+ *
+ * @param pool bm_pool the work was spawned to, may be **NULL**.
+ * @param group bm_pool_group to wait for.
+ */
+void
+bm_pool_join(struct bm_pool *pool, struct bm_pool_group *group)
+{
+    assert(group);
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        struct pool_task task;
+        if (pool && find_task(pool, pool->nworkers, &task)) {
+            run_task(pool, &task);
+            continue;
+        }
+
+        if (!pool)
+            continue;
+
+        pthread_mutex_lock(&pool->mutex);
+        while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0 && !__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&pool->done, &pool->mutex);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/**
+ * Run function over range split to chunks, and wait for it to finish.
+ * Calling thread runs the first chunk.
+ *
+ * @param pool bm_pool to run function with, may be **NULL**.
+ * @param count Size of range.
+ * @param grain Ranges smaller than this are not split further.
+ * @param fun Function to run.
+ * @param data Data passed to function.
+ */
+void
+bm_pool_parallel_for(struct bm_pool *pool, uint32_t count, uint32_t grain, bm_pool_fun fun, void *data)
+{
+    assert(fun);
+
+    if (count == 0)
+        return;
+
+    const uint32_t threads = bm_pool_get_thread_count(pool);
+    if (threads < 2 || count <= grain) {
+        fun(data, 0, count);
+        return;
+    }
+
+    /* few chunks per thread, so stealing can even out uneven chunks */
+    const uint32_t max_chunks = (grain > 0 ? (count + grain - 1) / grain : count);
+    const uint32_t chunks = (threads * 4 < max_chunks ? threads * 4 : max_chunks);
+    const uint32_t chunk = (count + chunks - 1) / chunks;
+
+    struct bm_pool_group group = {0};
+    for (uint32_t begin = chunk; begin < count; begin += chunk)
+        bm_pool_spawn(pool, &group, fun, data, begin, (count - begin > chunk ? begin + chunk : count));
+
+    fun(data, 0, (count > chunk ? chunk : count));
+    bm_pool_join(pool, &group);
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
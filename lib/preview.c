@@ -0,0 +1,352 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <assert.h>
+
+/**
+ * Number of previews kept in cache.
+ */
+static const uint32_t preview_cache_size = 64;
+
+/**
+ * Milliseconds preview command may run before it is killed.
+ */
+static const uint32_t preview_timeout = 2000;
+
+/**
+ * Bytes of preview output kept, command is killed once it has written this much.
+ */
+static const size_t preview_max_size = 1 << 16;
+
+/**
+ * Cached output of preview command for item text.
+ */
+struct preview_entry {
+    char *key;
+    char *text;
+    size_t len;
+    uint64_t hash;
+    uint64_t used;
+};
+
+struct bm_preview {
+    /**
+     * Command ran with sh, item text is passed as $1.
+     */
+    char *command;
+
+    /**
+     * Least recently used entry is replaced when cache is full.
+     */
+    struct preview_entry *entries;
+    uint32_t count;
+    uint64_t tick;
+
+    /**
+     * Running command, its item text and output read so far.
+     */
+    struct preview_entry running;
+    size_t allocated;
+    uint64_t deadline;
+    pid_t pid;
+    int fd;
+};
+
+static uint64_t
+get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct preview_entry*
+cache_find(const struct bm_preview *preview, const char *key, uint64_t hash)
+{
+    for (uint32_t i = 0; i < preview->count; ++i) {
+        if (preview->entries[i].hash == hash && !strcmp(preview->entries[i].key, key))
+            return &preview->entries[i];
+    }
+    return NULL;
+}
+
+/**
+ * Move output of running command to cache, replacing least recently used entry if full.
+ */
+static void
+cache_insert(struct bm_preview *preview, struct preview_entry *entry)
+{
+    struct preview_entry *slot = &preview->entries[0];
+    if (preview->count < preview_cache_size) {
+        slot = &preview->entries[preview->count++];
+    } else {
+        for (uint32_t i = 1; i < preview->count; ++i) {
+            if (preview->entries[i].used < slot->used)
+                slot = &preview->entries[i];
+        }
+        bm_free(slot->key);
+        bm_free(slot->text);
+    }
+
+    *slot = *entry;
+    slot->used = ++preview->tick;
+    memset(entry, 0, sizeof(struct preview_entry));
+}
+
+/**
+ * Kill running command and reap it.
+ * Output read so far is cached, if complete is true.
+ */
+static void
+stop(struct bm_preview *preview, struct bm_menu *menu, bool complete)
+{
+    if (preview->pid > 0) {
+        kill(-preview->pid, SIGKILL);
+        waitpid(preview->pid, NULL, 0);
+        preview->pid = 0;
+    }
+
+    if (preview->fd >= 0) {
+        bm_menu_remove_watch_fd(menu, preview->fd);
+        close(preview->fd);
+        preview->fd = -1;
+    }
+
+    if (complete && preview->running.key)
+        cache_insert(preview, &preview->running);
+
+    bm_free(preview->running.key);
+    bm_free(preview->running.text);
+    memset(&preview->running, 0, sizeof(struct preview_entry));
+    preview->allocated = 0;
+}
+
+static void
+start(struct bm_preview *preview, struct bm_menu *menu, const char *key, uint64_t hash)
+{
+    if (!(preview->running.key = bm_strdup(BM_MEMORY_RENDER, key)))
+        return;
+
+    preview->running.hash = hash;
+
+    int fds[2];
+    if (pipe(fds) == -1)
+        goto fail;
+
+    pid_t pid;
+    if ((pid = fork()) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        goto fail;
+    }
+
+    if (pid == 0) {
+        /* only async signal safe calls, threads of the pool may hold locks */
+        setpgid(0, 0);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        int null;
+        if ((null = open("/dev/null", O_RDONLY)) != -1) {
+            dup2(null, STDIN_FILENO);
+            close(null);
+        }
+
+        execl("/bin/sh", "sh", "-c", preview->command, "sh", key, (char*)NULL);
+        _exit(EXIT_FAILURE);
+    }
+
+    setpgid(pid, pid);
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    preview->pid = pid;
+    preview->fd = fds[0];
+    preview->deadline = get_time_ms() + preview_timeout;
+
+    if (!bm_menu_add_watch_fd(menu, fds[0]))
+        goto fail;
+
+    return;
+
+fail:
+    /* cache empty preview, so failing item is not retried on every render */
+    stop(preview, menu, true);
+}
+
+/**
+ * Read available output of running command.
+ *
+ * @return true when command has finished and output should be cached.
+ */
+static bool
+read_output(struct bm_preview *preview)
+{
+    struct preview_entry *running = &preview->running;
+
+    for (;;) {
+        if (running->len >= preview_max_size)
+            return true;
+
+        if (preview->allocated - running->len < 4096 + 1) {
+            const size_t nsize = (preview->allocated ? preview->allocated * 2 : 4096 * 2);
+            if (!bm_resize_buffer(BM_MEMORY_RENDER, &running->text, &preview->allocated, nsize))
+                return true;
+        }
+
+        const size_t want = preview->allocated - running->len - 1;
+        const ssize_t ret = read(preview->fd, running->text + running->len, (want < preview_max_size - running->len ? want : preview_max_size - running->len));
+
+        if (ret < 0)
+            return !(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+        if (ret == 0)
+            return true;
+
+        running->len += ret;
+        running->text[running->len] = 0;
+    }
+}
+
+/**
+ * Create preview runner for command.
+ *
+ * @param command Command ran with sh for highlighted item, item text is passed as $1.
+ * @return bm_preview for success, **NULL** on failure.
+ */
+struct bm_preview*
+bm_preview_new(const char *command)
+{
+    assert(command);
+
+    struct bm_preview *preview;
+    if (!(preview = bm_calloc(BM_MEMORY_RENDER, 1, sizeof(struct bm_preview))))
+        return NULL;
+
+    if (!(preview->command = bm_strdup(BM_MEMORY_RENDER, command)))
+        goto fail;
+
+    if (!(preview->entries = bm_calloc(BM_MEMORY_RENDER, preview_cache_size, sizeof(struct preview_entry))))
+        goto fail;
+
+    preview->fd = -1;
+    return preview;
+
+fail:
+    bm_free(preview->command);
+    bm_free(preview);
+    return NULL;
+}
+
+/**
+ * Kill running command and release preview runner.
+ *
+ * @param preview bm_preview to free, may be **NULL**.
+ * @param menu bm_menu whose file descriptors running command is watched with.
+ */
+void
+bm_preview_free(struct bm_preview *preview, struct bm_menu *menu)
+{
+    if (!preview)
+        return;
+
+    stop(preview, menu, false);
+
+    for (uint32_t i = 0; i < preview->count; ++i) {
+        bm_free(preview->entries[i].key);
+        bm_free(preview->entries[i].text);
+    }
+
+    bm_free(preview->entries);
+    bm_free(preview->command);
+    bm_free(preview);
+}
+
+/**
+ * Start command for highlighted item if its preview is not cached, and collect output of running command.
+ * Never blocks, output is read as it becomes available through the watched file descriptors of menu.
+ *
+ * @param preview bm_preview to update.
+ * @param menu bm_menu whose highlighted item is previewed.
+ */
+void
+bm_preview_update(struct bm_preview *preview, struct bm_menu *menu)
+{
+    assert(preview && menu);
+
+    if (preview->fd >= 0) {
+        if (read_output(preview) || get_time_ms() >= preview->deadline)
+            stop(preview, menu, true);
+    }
+
+    const char *key;
+    struct bm_item *item = bm_menu_get_highlighted_item(menu);
+    if (!item || !(key = bm_item_get_text(item)))
+        return;
+
+    const uint64_t hash = bm_hash(key, strlen(key));
+    if (preview->running.key && preview->running.hash == hash && !strcmp(preview->running.key, key))
+        return;
+
+    struct preview_entry *entry;
+    if ((entry = cache_find(preview, key, hash))) {
+        entry->used = ++preview->tick;
+        return;
+    }
+
+    /* highlight moved on, preview of the old item is not needed anymore */
+    stop(preview, menu, false);
+    start(preview, menu, key, hash);
+}
+
+/**
+ * Get milliseconds until running command times out.
+ *
+ * @param preview bm_preview to query, may be **NULL**.
+ * @return Milliseconds, -1 if no command is running.
+ */
+int32_t
+bm_preview_get_timeout(const struct bm_preview *preview)
+{
+    if (!preview || preview->fd < 0)
+        return -1;
+
+    const uint64_t now = get_time_ms();
+    return (preview->deadline > now ? preview->deadline - now : 0);
+}
+
+/**
+ * Get cached preview of item.
+ *
+ * @param preview bm_preview to query, may be **NULL**.
+ * @param item bm_item to get preview for, may be **NULL**.
+ * @param out_len Reference to size_t where length of preview is stored.
+ * @return Preview text, **NULL** if not available yet.
+ */
+const char*
+bm_preview_get_text(const struct bm_preview *preview, const struct bm_item *item, size_t *out_len)
+{
+    assert(out_len);
+    *out_len = 0;
+
+    const char *key;
+    if (!preview || !item || !(key = bm_item_get_text(item)))
+        return NULL;
+
+    const struct preview_entry *entry;
+    if (!(entry = cache_find(preview, key, bm_hash(key, strlen(key)))))
+        return NULL;
+
+    *out_len = entry->len;
+    return (entry->text ? entry->text : "");
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
@@ -49,8 +49,43 @@ struct cairo_paint_result {
     uint32_t height;
 };
 
-static size_t blen = 0;
-static char *buffer = NULL;
+/**
+ * Menu state painted by bm_cairo_paint, copied from menu on the thread that handles input.
+ * Strings are stored in text, and referred to with offsets, UINT32_MAX for **NULL**.
+ */
+struct cairo_snapshot {
+    struct cairo_color colors[BM_COLOR_LAST];
+    uint32_t width, max_height;
+    int32_t scale;
+
+    uint32_t line_height, lines, cursor, index, count;
+    enum bm_scrollbar_mode scrollbar;
+    bool wrap, path_mode, preview;
+
+    uint32_t font, title, prefix, filter;
+    uint32_t preview_text, preview_len;
+
+    /**
+     * Filtered items from index first, that may be visible.
+     */
+    struct cairo_row {
+        uint32_t text, len;
+        uint32_t selected;
+    } *rows;
+    uint32_t first, nrows, rows_allocated;
+
+    char *text;
+    size_t text_len, text_allocated;
+
+    /**
+     * Hash of everything above, so unchanged state is not painted again.
+     */
+    uint64_t hash;
+};
+
+/* painting happens on render threads, each keeps its own format buffer */
+static __thread size_t blen = 0;
+static __thread char *buffer = NULL;
 
 static inline bool
 bm_cairo_create_for_surface(struct cairo *cairo, cairo_surface_t *surface)
@@ -74,6 +109,8 @@ fail:
 static inline void
 bm_cairo_destroy(struct cairo *cairo)
 {
+    if (cairo->pango)
+        g_object_unref(cairo->pango);
     if (cairo->cr)
         cairo_destroy(cairo->cr);
     if (cairo->surface)
@@ -100,7 +137,7 @@ bm_pango_get_text_extents(struct cairo *cairo, struct cairo_paint *paint, struct
 
     va_list args;
     va_start(args, fmt);
-    bool ret = bm_vrprintf(&buffer, &blen, fmt, args);
+    bool ret = bm_vrprintf(BM_MEMORY_RENDER, &buffer, &blen, fmt, args);
     va_end(args);
 
     if (!ret)
@@ -126,7 +163,7 @@ bm_cairo_draw_line(struct cairo *cairo, struct cairo_paint *paint, struct cairo_
 
     va_list args;
     va_start(args, fmt);
-    bool ret = bm_vrprintf(&buffer, &blen, fmt, args);
+    bool ret = bm_vrprintf(BM_MEMORY_RENDER, &buffer, &blen, fmt, args);
     va_end(args);
 
     if (!ret)
@@ -203,12 +240,231 @@ bm_cairo_color_from_menu_color(const struct bm_menu *menu, enum bm_color color,
     c->a = 1.0f;
 }
 
+static inline uint64_t
+bm_cairo_hash(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *s = data;
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ s[i]) * 0x100000001b3;
+    return hash;
+}
+
+static inline const char*
+bm_cairo_snapshot_get_text(const struct cairo_snapshot *snap, uint32_t offset)
+{
+    assert(snap);
+    return (offset != UINT32_MAX ? snap->text + offset : NULL);
+}
+
+static inline bool
+bm_cairo_snapshot_push(struct cairo_snapshot *snap, const char *text, size_t len, uint32_t *out_offset)
+{
+    assert(snap && out_offset);
+    *out_offset = UINT32_MAX;
+
+    if (!text)
+        return true;
+
+    if (snap->text_allocated - snap->text_len < len + 1) {
+        size_t nsize = (snap->text_allocated ? snap->text_allocated : 4096);
+        while (nsize - snap->text_len < len + 1)
+            nsize *= 2;
+
+        if (!bm_resize_buffer(BM_MEMORY_RENDER, &snap->text, &snap->text_allocated, nsize))
+            return false;
+    }
+
+    memcpy(snap->text + snap->text_len, text, len);
+    snap->text[snap->text_len + len] = 0;
+    *out_offset = snap->text_len;
+    snap->text_len += len + 1;
+    return true;
+}
+
+static inline bool
+bm_cairo_snapshot_push_string(struct cairo_snapshot *snap, const char *text, uint32_t *out_offset)
+{
+    return bm_cairo_snapshot_push(snap, text, (text ? strlen(text) : 0), out_offset);
+}
+
+/**
+ * Copy state of menu that is painted to width and max_height, so it can be painted without touching menu.
+ *
+ * @return true on success, false if memory could not be allocated.
+ */
+static inline bool
+bm_cairo_snapshot_capture(struct cairo_snapshot *snap, const struct bm_menu *menu, uint32_t width, uint32_t max_height, int32_t scale)
+{
+    assert(snap && menu && scale > 0);
+
+    for (uint32_t i = 0; i < BM_COLOR_LAST; ++i)
+        bm_cairo_color_from_menu_color(menu, i, &snap->colors[i]);
+
+    snap->width = width;
+    snap->max_height = max_height;
+    snap->scale = scale;
+    snap->line_height = menu->line_height;
+    snap->lines = menu->lines;
+    snap->cursor = menu->cursor;
+    snap->index = menu->index;
+    snap->count = bm_menu_get_filtered_count(menu);
+    snap->scrollbar = menu->scrollbar;
+    snap->wrap = menu->wrap;
+    snap->path_mode = bm_menu_is_path_mode(menu);
+    snap->preview = (menu->preview != NULL);
+
+    snap->text_len = 0;
+    if (!bm_cairo_snapshot_push_string(snap, menu->font.name, &snap->font) ||
+        !bm_cairo_snapshot_push_string(snap, menu->title, &snap->title) ||
+        !bm_cairo_snapshot_push_string(snap, menu->prefix, &snap->prefix) ||
+        !bm_cairo_snapshot_push_string(snap, (menu->filter ? menu->filter : ""), &snap->filter))
+        return false;
+
+    size_t preview_len = 0;
+    const char *preview = bm_preview_get_text(menu->preview, bm_menu_get_highlighted_item(menu), &preview_len);
+    if (!bm_cairo_snapshot_push(snap, preview, preview_len, &snap->preview_text))
+        return false;
+    snap->preview_len = preview_len;
+
+    /* any page holding the highlighted item is within lines of it, even if fewer lines fit to screen,
+     * in single-line mode every item takes at least 6 pixels */
+    uint32_t first, last;
+    if (menu->lines > 0) {
+        first = (menu->index >= menu->lines ? menu->index - menu->lines + 1 : 0);
+        last = menu->index + menu->lines;
+    } else {
+        first = menu->index;
+        last = menu->index + width / scale / 6 + 1;
+    }
+
+    last = (last < snap->count ? last : snap->count);
+    first = (first < last ? first : last);
+
+    if (snap->rows_allocated < last - first) {
+        void *tmp;
+        if (!(tmp = bm_realloc(BM_MEMORY_RENDER, snap->rows, sizeof(struct cairo_row) * (last - first))))
+            return false;
+
+        snap->rows = tmp;
+        snap->rows_allocated = last - first;
+    }
+
+    snap->first = first;
+    snap->nrows = last - first;
+    for (uint32_t i = 0; i < snap->nrows; ++i) {
+        uint32_t len;
+        const char *text = bm_item_get_display(bm_menu_get_filtered_item(menu, first + i), &len);
+        if (!bm_cairo_snapshot_push(snap, text, len, &snap->rows[i].text))
+            return false;
+
+        snap->rows[i].len = len;
+        snap->rows[i].selected = bm_menu_filtered_item_is_selected(menu, first + i);
+    }
+
+    const uint32_t scalars[] = {
+        snap->width, snap->max_height, snap->scale, snap->line_height, snap->lines, snap->cursor, snap->index, snap->count,
+        snap->scrollbar, snap->wrap, snap->path_mode, snap->preview, snap->font, snap->title, snap->prefix, snap->filter,
+        snap->preview_text, snap->preview_len, snap->first, snap->nrows,
+    };
+
+    uint64_t hash = 0xcbf29ce484222325;
+    hash = bm_cairo_hash(hash, snap->colors, sizeof(snap->colors));
+    hash = bm_cairo_hash(hash, scalars, sizeof(scalars));
+    hash = bm_cairo_hash(hash, snap->rows, sizeof(struct cairo_row) * snap->nrows);
+    snap->hash = bm_cairo_hash(hash, snap->text, snap->text_len);
+    return true;
+}
+
+static inline void
+bm_cairo_snapshot_release(struct cairo_snapshot *snap)
+{
+    assert(snap);
+    bm_free(snap->rows);
+    bm_free(snap->text);
+    memset(snap, 0, sizeof(struct cairo_snapshot));
+}
+
+/**
+ * Skip leading directories of path until it fits to max_width with ellipsis prepended.
+ * Path is laid out once, widths of what follows each directory are read from where it starts.
+ *
+ * @param ellipsis_width Width of the prepended ellipsis.
+ * @return Number of bytes to skip, 0 if path fits as is.
+ */
+static inline uint32_t
+bm_cairo_abbreviate_path(struct cairo *cairo, struct cairo_paint *paint, const char *text, uint32_t len, uint32_t max_width, uint32_t ellipsis_width)
+{
+    PangoLayout *layout = bm_pango_get_layout(cairo, paint, "");
+    pango_layout_set_text(layout, text, len);
+
+    PangoRectangle rect;
+    pango_layout_get_pixel_extents(layout, NULL, &rect);
+    const int32_t width = rect.x + rect.width;
+
+    uint32_t skip = 0;
+    if (width > (int32_t)max_width) {
+        for (uint32_t i = 1; i + 1 < len; ++i) {
+            if (text[i] != '/')
+                continue;
+
+            skip = i;
+            pango_layout_index_to_pos(layout, i, &rect);
+            if (width - PANGO_PIXELS(rect.x) + (int32_t)ellipsis_width <= (int32_t)max_width)
+                break;
+        }
+    }
+
+    g_object_unref(layout);
+    return skip;
+}
+
+/**
+ * Paint preview of highlighted item over the list, from x to width and top to bottom.
+ */
+static inline void
+bm_cairo_paint_preview(struct cairo *cairo, struct cairo_paint *paint, const struct cairo_snapshot *snap, uint32_t x, uint32_t width, uint32_t top, uint32_t bottom, uint32_t spacing_y, int32_t vpadding, int32_t ascii_height)
+{
+    paint->fg = snap->colors[BM_COLOR_ITEM_FG];
+    paint->bg = snap->colors[BM_COLOR_ITEM_BG];
+
+    cairo_scale(cairo->cr, cairo->scale, cairo->scale);
+    cairo_set_source_rgba(cairo->cr, paint->bg.r, paint->bg.b, paint->bg.g, paint->bg.a);
+    cairo_rectangle(cairo->cr, x, top, width - x, bottom - top);
+    cairo_fill(cairo->cr);
+    cairo_set_source_rgba(cairo->cr, paint->fg.r, paint->fg.b, paint->fg.g, paint->fg.a);
+    cairo_rectangle(cairo->cr, x, top, 1, bottom - top);
+    cairo_fill(cairo->cr);
+    cairo_identity_matrix(cairo->cr);
+
+    size_t len = snap->preview_len;
+    const char *text;
+    if (!(text = bm_cairo_snapshot_get_text(snap, snap->preview_text))) {
+        text = "…";
+        len = strlen(text);
+    }
+
+    struct cairo_result result;
+    for (uint32_t posy = top; len > 0 && posy < bottom;) {
+        const char *end = memchr(text, '\n', len);
+        const size_t line = (end ? (size_t)(end - text) : len);
+
+        paint->pos = (struct pos){ x + 4, vpadding + posy };
+        paint->box = (struct box){ 4, 0, vpadding, vpadding, width - x - 4, ascii_height };
+        bm_cairo_draw_line(cairo, paint, &result, "%.*s", (int)line, text);
+
+        text += (end ? line + 1 : line);
+        len -= (end ? line + 1 : line);
+        posy += (spacing_y ? spacing_y : result.height);
+    }
+}
+
 static inline void
-bm_cairo_paint(struct cairo *cairo, uint32_t width, uint32_t max_height, const struct bm_menu *menu, struct cairo_paint_result *out_result)
+bm_cairo_paint(struct cairo *cairo, const struct cairo_snapshot *snap, struct cairo_paint_result *out_result)
 {
-    assert(cairo && menu && out_result);
+    assert(cairo && snap && out_result);
 
-    uint32_t height = fmin(menu->line_height, max_height);
+    const uint32_t width = snap->width, max_height = snap->max_height;
+    uint32_t height = fmin(snap->line_height, max_height);
 
     memset(out_result, 0, sizeof(struct cairo_paint_result));
     out_result->displayed = 1;
@@ -218,7 +474,7 @@ bm_cairo_paint(struct cairo *cairo, uint32_t width, uint32_t max_height, const s
     cairo_fill(cairo->cr);
 
     struct cairo_paint paint = {0};
-    paint.font = menu->font.name;
+    paint.font = bm_cairo_snapshot_get_text(snap, snap->font);
 
     struct cairo_result result = {0};
     int ascii_height;
@@ -231,34 +487,34 @@ bm_cairo_paint(struct cairo *cairo, uint32_t width, uint32_t max_height, const s
 
     memset(&result, 0, sizeof(result));
     uint32_t title_x = 0;
-    if (menu->title) {
-        bm_cairo_color_from_menu_color(menu, BM_COLOR_TITLE_FG, &paint.fg);
-        bm_cairo_color_from_menu_color(menu, BM_COLOR_TITLE_BG, &paint.bg);
+    const char *title = bm_cairo_snapshot_get_text(snap, snap->title);
+    if (title) {
+        paint.fg = snap->colors[BM_COLOR_TITLE_FG];
+        paint.bg = snap->colors[BM_COLOR_TITLE_BG];
         paint.pos = (struct pos){ result.x_advance, vpadding };
         paint.box = (struct box){ 4, 8, vpadding, vpadding, 0, ascii_height };
-        bm_cairo_draw_line(cairo, &paint, &result, "%s", menu->title);
+        bm_cairo_draw_line(cairo, &paint, &result, "%s", title);
         title_x = result.x_advance;
     }
 
-    bm_cairo_color_from_menu_color(menu, BM_COLOR_FILTER_FG, &paint.fg);
-    bm_cairo_color_from_menu_color(menu, BM_COLOR_FILTER_BG, &paint.bg);
+    paint.fg = snap->colors[BM_COLOR_FILTER_FG];
+    paint.bg = snap->colors[BM_COLOR_FILTER_BG];
     paint.draw_cursor = true;
-    paint.cursor = menu->cursor;
-    paint.pos = (struct pos){ (menu->title ? 2 : 0) + result.x_advance, vpadding };
-    paint.box = (struct box){ (menu->title ? 2 : 4), 0, vpadding, vpadding, width - paint.pos.x, ascii_height };
-    bm_cairo_draw_line(cairo, &paint, &result, "%s", (menu->filter ? menu->filter : ""));
+    paint.cursor = snap->cursor;
+    paint.pos = (struct pos){ (title ? 2 : 0) + result.x_advance, vpadding };
+    paint.box = (struct box){ (title ? 2 : 4), 0, vpadding, vpadding, width - paint.pos.x, ascii_height };
+    bm_cairo_draw_line(cairo, &paint, &result, "%s", bm_cairo_snapshot_get_text(snap, snap->filter));
     paint.draw_cursor = false;
     const uint32_t titleh = result.height;
     out_result->height = titleh;
 
-    uint32_t count;
-    struct bm_item **items = bm_menu_get_filtered_items(menu, &count);
-    uint32_t lines = (menu->lines > 0 ? menu->lines : 1);
+    const uint32_t count = snap->count;
+    uint32_t lines = (snap->lines > 0 ? snap->lines : 1);
 
-    if (menu->lines > 0) {
+    if (snap->lines > 0) {
         /* vertical mode */
 
-        const bool scrollbar = (menu->scrollbar > BM_SCROLLBAR_NONE && (menu->scrollbar != BM_SCROLLBAR_AUTOHIDE || count > lines) ? true : false);
+        const bool scrollbar = (snap->scrollbar > BM_SCROLLBAR_NONE && (snap->scrollbar != BM_SCROLLBAR_AUTOHIDE || count > lines) ? true : false);
         uint32_t spacing_x = title_x, spacing_y = 0; // 0 == variable width spacing
         if (lines > max_height / titleh) {
             /* there is more lines than screen can fit, enter fixed spacing mode */
@@ -267,8 +523,9 @@ bm_cairo_paint(struct cairo *cairo, uint32_t width, uint32_t max_height, const s
         }
 
         uint32_t prefix_x = 0;
-        if (menu->prefix) {
-            bm_pango_get_text_extents(cairo, &paint, &result, "%s ", menu->prefix);
+        const char *prefix = bm_cairo_snapshot_get_text(snap, snap->prefix);
+        if (prefix) {
+            bm_pango_get_text_extents(cairo, &paint, &result, "%s ", prefix);
             prefix_x += result.x_advance;
         }
 
@@ -279,30 +536,51 @@ bm_cairo_paint(struct cairo *cairo, uint32_t width, uint32_t max_height, const s
             spacing_x += (title_x < scrollbar_w ? scrollbar_w - title_x : 0);
         }
 
+        /* preview takes right half of the list */
+        const uint32_t list_w = (snap->preview ? width / cairo->scale / 2 : width / cairo->scale);
+
+        struct cairo_result ellipsis_result = {0};
+        if (snap->path_mode)
+            bm_pango_get_text_extents(cairo, &paint, &ellipsis_result, "…");
+
         uint32_t posy = titleh;
-        const uint32_t page = (menu->index / lines) * lines;
-        for (uint32_t l = 0, i = page; l < lines && i < count && posy < max_height; ++i, ++l) {
-            bool highlighted = (items[i] == bm_menu_get_highlighted_item(menu));
+        const uint32_t page = (snap->index / lines) * lines;
+        for (uint32_t l = 0, i = page; l < lines && i < count && i - snap->first < snap->nrows && posy < max_height; ++i, ++l) {
+            const struct cairo_row *row = &snap->rows[i - snap->first];
+            bool highlighted = (i == snap->index);
 
             if (highlighted) {
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_HIGHLIGHTED_FG, &paint.fg);
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_HIGHLIGHTED_BG, &paint.bg);
-            } else if (bm_menu_item_is_selected(menu, items[i])) {
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_SELECTED_FG, &paint.fg);
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_SELECTED_BG, &paint.bg);
+                paint.fg = snap->colors[BM_COLOR_HIGHLIGHTED_FG];
+                paint.bg = snap->colors[BM_COLOR_HIGHLIGHTED_BG];
+            } else if (row->selected) {
+                paint.fg = snap->colors[BM_COLOR_SELECTED_FG];
+                paint.bg = snap->colors[BM_COLOR_SELECTED_BG];
             } else {
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_ITEM_FG, &paint.fg);
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_ITEM_BG, &paint.bg);
+                paint.fg = snap->colors[BM_COLOR_ITEM_FG];
+                paint.bg = snap->colors[BM_COLOR_ITEM_BG];
+            }
+
+            uint32_t len = row->len;
+            const char *text = bm_cairo_snapshot_get_text(snap, row->text);
+
+            const char *ellipsis = "";
+            const uint32_t used = spacing_x + 4 + prefix_x;
+            const uint32_t max_width = (list_w > used ? list_w - used : 1);
+            uint32_t skip;
+            if (snap->path_mode && (skip = bm_cairo_abbreviate_path(cairo, &paint, text, len, max_width, ellipsis_result.x_advance)) > 0) {
+                ellipsis = "…";
+                text += skip;
+                len -= skip;
             }
 
-            if (menu->prefix && highlighted) {
+            if (prefix && highlighted) {
                 paint.pos = (struct pos){ spacing_x, vpadding + posy };
                 paint.box = (struct box){ 4, 0, vpadding, vpadding, width - paint.pos.x, ascii_height };
-                bm_cairo_draw_line(cairo, &paint, &result, "%s %s", menu->prefix, (items[i]->text ? items[i]->text : ""));
+                bm_cairo_draw_line(cairo, &paint, &result, "%s %s%.*s", prefix, ellipsis, (int)len, text);
             } else {
                 paint.pos = (struct pos){ spacing_x, vpadding + posy };
                 paint.box = (struct box){ 4 + prefix_x, 0, vpadding, vpadding, width - paint.pos.x, ascii_height };
-                bm_cairo_draw_line(cairo, &paint, &result, "%s", (items[i]->text ? items[i]->text : ""));
+                bm_cairo_draw_line(cairo, &paint, &result, "%s%.*s", ellipsis, (int)len, text);
             }
 
             posy += (spacing_y ? spacing_y : result.height);
@@ -311,7 +589,7 @@ bm_cairo_paint(struct cairo *cairo, uint32_t width, uint32_t max_height, const s
         }
 
         if (spacing_x) {
-            bm_cairo_color_from_menu_color(menu, BM_COLOR_ITEM_BG, &paint.bg);
+            paint.bg = snap->colors[BM_COLOR_ITEM_BG];
             const uint32_t sheight = out_result->height - titleh;
             cairo_set_source_rgba(cairo->cr, paint.bg.r, paint.bg.b, paint.bg.g, paint.bg.a);
             cairo_rectangle(cairo->cr, scrollbar_w, titleh, spacing_x - scrollbar_w, sheight);
@@ -319,8 +597,8 @@ bm_cairo_paint(struct cairo *cairo, uint32_t width, uint32_t max_height, const s
         }
 
         if (scrollbar && count > 0) {
-            bm_cairo_color_from_menu_color(menu, BM_COLOR_SCROLLBAR_BG, &paint.bg);
-            bm_cairo_color_from_menu_color(menu, BM_COLOR_SCROLLBAR_FG, &paint.fg);
+            paint.bg = snap->colors[BM_COLOR_SCROLLBAR_BG];
+            paint.fg = snap->colors[BM_COLOR_SCROLLBAR_FG];
 
             const uint32_t sheight = out_result->height - titleh;
             cairo_set_source_rgba(cairo->cr, paint.bg.r, paint.bg.b, paint.bg.g, paint.bg.a);
@@ -334,40 +612,47 @@ bm_cairo_paint(struct cairo *cairo, uint32_t width, uint32_t max_height, const s
             cairo_rectangle(cairo->cr, 0, titleh + posy, scrollbar_w, size);
             cairo_fill(cairo->cr);
         }
+
+        if (snap->preview && out_result->height > titleh)
+            bm_cairo_paint_preview(cairo, &paint, snap, list_w, width / cairo->scale, titleh, out_result->height, spacing_y, vpadding, ascii_height);
     } else {
         /* single-line mode */
         bm_pango_get_text_extents(cairo, &paint, &result, "lorem ipsum lorem ipsum lorem ipsum lorem");
         uint32_t cl = fmin(title_x + result.x_advance, width / 4);
         paint.pos = (struct pos){ cl, vpadding };
         paint.box = (struct box){ 1, 2, vpadding, vpadding, 0, ascii_height };
-        bm_cairo_draw_line(cairo, &paint, &result, (count > 0 && (menu->wrap || menu->index > 0) ? "<" : " "));
+        bm_cairo_draw_line(cairo, &paint, &result, (count > 0 && (snap->wrap || snap->index > 0) ? "<" : " "));
         cl += result.x_advance + 1;
 
-        for (uint32_t i = menu->index; i < count && cl < (width/cairo->scale); ++i) {
-            bool highlighted = (items[i] == bm_menu_get_highlighted_item(menu));
+        for (uint32_t i = snap->index; i < count && i - snap->first < snap->nrows && cl < (width/cairo->scale); ++i) {
+            const struct cairo_row *row = &snap->rows[i - snap->first];
+            bool highlighted = (i == snap->index);
 
             if (highlighted) {
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_HIGHLIGHTED_FG, &paint.fg);
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_HIGHLIGHTED_BG, &paint.bg);
-            } else if (bm_menu_item_is_selected(menu, items[i])) {
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_SELECTED_FG, &paint.fg);
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_SELECTED_BG, &paint.bg);
+                paint.fg = snap->colors[BM_COLOR_HIGHLIGHTED_FG];
+                paint.bg = snap->colors[BM_COLOR_HIGHLIGHTED_BG];
+            } else if (row->selected) {
+                paint.fg = snap->colors[BM_COLOR_SELECTED_FG];
+                paint.bg = snap->colors[BM_COLOR_SELECTED_BG];
             } else {
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_ITEM_FG, &paint.fg);
-                bm_cairo_color_from_menu_color(menu, BM_COLOR_ITEM_BG, &paint.bg);
+                paint.fg = snap->colors[BM_COLOR_ITEM_FG];
+                paint.bg = snap->colors[BM_COLOR_ITEM_BG];
             }
 
+            uint32_t len = row->len;
+            const char *text = bm_cairo_snapshot_get_text(snap, row->text);
+
             paint.pos = (struct pos){ cl, vpadding };
             paint.box = (struct box){ 2, 4, vpadding, vpadding, 0, ascii_height };
-            bm_cairo_draw_line(cairo, &paint, &result, "%s", (items[i]->text ? items[i]->text : ""));
+            bm_cairo_draw_line(cairo, &paint, &result, "%.*s", (int)len, text);
             cl += result.x_advance + 2;
             out_result->displayed += (cl < width);
             out_result->height = fmax(out_result->height, result.height);
         }
 
-        if (menu->wrap || menu->index + 1 < count) {
-            bm_cairo_color_from_menu_color(menu, BM_COLOR_FILTER_FG, &paint.fg);
-            bm_cairo_color_from_menu_color(menu, BM_COLOR_FILTER_BG, &paint.bg);
+        if (snap->wrap || snap->index + 1 < count) {
+            paint.fg = snap->colors[BM_COLOR_FILTER_FG];
+            paint.bg = snap->colors[BM_COLOR_FILTER_BG];
             bm_pango_get_text_extents(cairo, &paint, &result, ">");
             paint.pos = (struct pos){ width/cairo->scale - result.x_advance - 2, vpadding };
             paint.box = (struct box){ 1, 2, vpadding, vpadding, 0, ascii_height };
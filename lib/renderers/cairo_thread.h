@@ -0,0 +1,328 @@
+#ifndef _BM_CAIRO_THREAD_H_
+#define _BM_CAIRO_THREAD_H_
+
+#include "renderers/cairo.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+/**
+ * Frame painted by render thread.
+ */
+struct cairo_frame {
+    struct cairo cairo;
+    uint32_t width, height;
+    struct cairo_paint_result result;
+};
+
+/**
+ * Paints snapshots of menu on its own thread, so slow paint never delays input handling or filtering.
+ *
+ * Frames are triple buffered: render thread paints to back, finished frame waits in ready,
+ * and front belongs to the input thread until it acquires a newer frame.
+ * Snapshots rotate the same way between capture, pending and painting.
+ */
+struct cairo_thread {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake, painted;
+
+    struct cairo_frame frames[3];
+    uint32_t back, ready, front;
+
+    struct cairo_snapshot snapshots[3];
+    uint32_t capture, pending, painting;
+
+    /**
+     * Hash of last submitted snapshot, owned by input thread.
+     */
+    uint64_t submitted;
+    bool has_submitted;
+
+    /**
+     * Height frames are created with, owned by render thread.
+     */
+    uint32_t height;
+
+    /**
+     * Pipe written when frame becomes ready, so input thread can wait for frames with its other input.
+     */
+    int fds[2];
+
+    bool has_pending, has_ready, busy, initialized, started, stop;
+};
+
+static inline void
+bm_cairo_frame_destroy(struct cairo_frame *frame)
+{
+    bm_cairo_destroy(&frame->cairo);
+    memset(frame, 0, sizeof(struct cairo_frame));
+}
+
+static inline bool
+bm_cairo_frame_create(struct cairo_frame *frame, uint32_t width, uint32_t height, int32_t scale)
+{
+    cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    if (cairo_surface_status(surf) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surf);
+        return false;
+    }
+
+    if (!bm_cairo_create_for_surface(&frame->cairo, surf)) {
+        cairo_surface_destroy(surf);
+        return false;
+    }
+
+    frame->cairo.scale = scale;
+    frame->width = width;
+    frame->height = height;
+    return true;
+}
+
+/**
+ * Paint snapshot to frame, growing frame if painted menu does not fit.
+ */
+static inline bool
+bm_cairo_frame_paint(struct cairo_thread *thread, struct cairo_frame *frame, const struct cairo_snapshot *snap)
+{
+    uint32_t height = fmax(fmin(thread->height, snap->max_height), 1);
+
+    for (int32_t tries = 0; tries < 2; ++tries) {
+        if (frame->width != snap->width || frame->height < height || frame->cairo.scale != snap->scale)
+            bm_cairo_frame_destroy(frame);
+
+        if (!frame->cairo.cr && !bm_cairo_frame_create(frame, fmax(snap->width, 1), height, snap->scale))
+            return false;
+
+        cairo_save(frame->cairo.cr);
+        cairo_set_operator(frame->cairo.cr, CAIRO_OPERATOR_CLEAR);
+        cairo_paint(frame->cairo.cr);
+        cairo_restore(frame->cairo.cr);
+
+        bm_cairo_paint(&frame->cairo, snap, &frame->result);
+        cairo_surface_flush(frame->cairo.surface);
+
+        height = fmax(fmin(frame->result.height * snap->scale, snap->max_height), 1);
+        thread->height = height;
+
+        if (height <= frame->height)
+            return true;
+    }
+
+    return true;
+}
+
+static inline void*
+bm_cairo_thread_main(void *arg)
+{
+    struct cairo_thread *thread = arg;
+
+    pthread_mutex_lock(&thread->mutex);
+    for (;;) {
+        while (!thread->stop && !thread->has_pending)
+            pthread_cond_wait(&thread->wake, &thread->mutex);
+
+        if (thread->stop)
+            break;
+
+        const uint32_t painting = thread->pending;
+        thread->pending = thread->painting;
+        thread->painting = painting;
+        thread->has_pending = false;
+        thread->busy = true;
+        pthread_mutex_unlock(&thread->mutex);
+
+        const bool painted = bm_cairo_frame_paint(thread, &thread->frames[thread->back], &thread->snapshots[painting]);
+
+        pthread_mutex_lock(&thread->mutex);
+        thread->busy = false;
+
+        if (painted) {
+            const uint32_t ready = thread->ready;
+            thread->ready = thread->back;
+            thread->back = ready;
+
+            if (!thread->has_ready) {
+                thread->has_ready = true;
+                while (write(thread->fds[1], "", 1) < 0 && errno == EINTR);
+            }
+        }
+
+        pthread_cond_broadcast(&thread->painted);
+    }
+    pthread_mutex_unlock(&thread->mutex);
+
+    bm_free(buffer);
+    buffer = NULL;
+    blen = 0;
+    return NULL;
+}
+
+/**
+ * Stop render thread and release its frames.
+ * Safe to call for thread that failed to start, or was never started.
+ */
+static inline void
+bm_cairo_thread_stop(struct cairo_thread *thread)
+{
+    assert(thread);
+
+    if (!thread->initialized)
+        return;
+
+    if (thread->started) {
+        pthread_mutex_lock(&thread->mutex);
+        thread->stop = true;
+        pthread_cond_signal(&thread->wake);
+        pthread_mutex_unlock(&thread->mutex);
+        pthread_join(thread->thread, NULL);
+        thread->started = false;
+    }
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        bm_cairo_frame_destroy(&thread->frames[i]);
+        bm_cairo_snapshot_release(&thread->snapshots[i]);
+    }
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        if (thread->fds[i] >= 0)
+            close(thread->fds[i]);
+        thread->fds[i] = -1;
+    }
+
+    pthread_cond_destroy(&thread->painted);
+    pthread_cond_destroy(&thread->wake);
+    pthread_mutex_destroy(&thread->mutex);
+    thread->initialized = false;
+}
+
+/**
+ * Start render thread.
+ *
+ * @return true on success, false if thread could not be started.
+ */
+static inline bool
+bm_cairo_thread_start(struct cairo_thread *thread)
+{
+    assert(thread);
+    memset(thread, 0, sizeof(struct cairo_thread));
+    thread->back = thread->capture = 0;
+    thread->ready = thread->pending = 1;
+    thread->front = thread->painting = 2;
+
+    thread->fds[0] = thread->fds[1] = -1;
+
+    pthread_mutex_init(&thread->mutex, NULL);
+    pthread_cond_init(&thread->wake, NULL);
+    pthread_cond_init(&thread->painted, NULL);
+    thread->initialized = true;
+
+    if (pipe(thread->fds) == -1) {
+        thread->fds[0] = thread->fds[1] = -1;
+        goto fail;
+    }
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        fcntl(thread->fds[i], F_SETFL, fcntl(thread->fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(thread->fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    if (pthread_create(&thread->thread, NULL, bm_cairo_thread_main, thread))
+        goto fail;
+
+    thread->started = true;
+    return true;
+
+fail:
+    bm_cairo_thread_stop(thread);
+    return false;
+}
+
+/**
+ * Get file descriptor that becomes readable when a frame is ready to be acquired.
+ *
+ * @return File descriptor, -1 if thread is not started.
+ */
+static inline int
+bm_cairo_thread_get_fd(const struct cairo_thread *thread)
+{
+    assert(thread);
+    return (thread->started ? thread->fds[0] : -1);
+}
+
+/**
+ * Capture state of menu, and hand it to render thread if it differs from last submitted state.
+ *
+ * @return true on success, false if state could not be captured.
+ */
+static inline bool
+bm_cairo_thread_submit(struct cairo_thread *thread, const struct bm_menu *menu, uint32_t width, uint32_t max_height, int32_t scale)
+{
+    assert(thread && thread->started && menu);
+
+    struct cairo_snapshot *snap = &thread->snapshots[thread->capture];
+    if (!bm_cairo_snapshot_capture(snap, menu, width, max_height, scale))
+        return false;
+
+    if (thread->has_submitted && thread->submitted == snap->hash)
+        return true;
+
+    pthread_mutex_lock(&thread->mutex);
+    const uint32_t pending = thread->pending;
+    thread->pending = thread->capture;
+    thread->capture = pending;
+    thread->has_pending = true;
+    pthread_cond_signal(&thread->wake);
+    pthread_mutex_unlock(&thread->mutex);
+
+    thread->submitted = snap->hash;
+    thread->has_submitted = true;
+    return true;
+}
+
+/**
+ * Paint next submitted state, even if it equals the last one.
+ */
+static inline void
+bm_cairo_thread_invalidate(struct cairo_thread *thread)
+{
+    assert(thread);
+    thread->has_submitted = false;
+}
+
+/**
+ * Take newest painted frame.
+ * Frame stays valid until next acquire.
+ *
+ * @param wait Wait for submitted state to be painted, if no frame is ready yet.
+ * @return Newest frame, **NULL** if no frame was painted since last acquire.
+ */
+static inline const struct cairo_frame*
+bm_cairo_thread_acquire(struct cairo_thread *thread, bool wait)
+{
+    assert(thread && thread->started);
+
+    /* drained before checking, so a frame readied meanwhile leaves its wake up in the pipe */
+    char drain[16];
+    while (read(thread->fds[0], drain, sizeof(drain)) > 0);
+
+    pthread_mutex_lock(&thread->mutex);
+    while (wait && !thread->has_ready && (thread->has_pending || thread->busy))
+        pthread_cond_wait(&thread->painted, &thread->mutex);
+
+    const bool ready = thread->has_ready;
+    if (ready) {
+        const uint32_t front = thread->front;
+        thread->front = thread->ready;
+        thread->ready = front;
+        thread->has_ready = false;
+    }
+    pthread_mutex_unlock(&thread->mutex);
+
+    return (ready ? &thread->frames[thread->front] : NULL);
+}
+
+#endif /* _BM_CAIRO_THREAD_H_ */
+
+/* vim: set ts=8 sw=4 tw=0 :*/
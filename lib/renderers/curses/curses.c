@@ -8,6 +8,7 @@
 #include <dlfcn.h>
 #include <assert.h>
 #include <math.h>
+#include <limits.h>
 
 #define NCURSES_WIDECHAR 1
 #include <curses.h>
@@ -29,6 +30,13 @@ static struct curses {
     struct sigaction winch_action;
     char *buffer;
     size_t blen;
+
+    /**
+     * Text of last bracketed paste, null terminated.
+     */
+    char *paste;
+    size_t paste_len, paste_size;
+
     int old_stdin;
     int old_stdout;
     bool polled_once;
@@ -83,7 +91,7 @@ static void
 terminate(void)
 {
     if (curses.buffer) {
-        free(curses.buffer);
+        bm_free(curses.buffer);
         curses.buffer = NULL;
         curses.blen = 0;
     }
@@ -92,6 +100,8 @@ terminate(void)
         return;
 
     reopen_stdin_stdout();
+    putp("\033[?2004l");
+    fflush(stdout);
     refresh();
     endwin();
     restore_stdin_stdout();
@@ -127,7 +137,7 @@ draw_line(int32_t pair, int32_t y, const char *fmt, ...)
 
     va_list args;
     va_start(args, fmt);
-    bool ret = bm_vrprintf(&curses.buffer, &curses.blen, fmt, args);
+    bool ret = bm_vrprintf(BM_MEMORY_RENDER, &curses.buffer, &curses.blen, fmt, args);
     va_end(args);
 
     if (!ret)
@@ -136,7 +146,7 @@ draw_line(int32_t pair, int32_t y, const char *fmt, ...)
     size_t nlen = strlen(curses.buffer);
     size_t dw = 0, i = 0;
     while (dw < ncols && i < nlen) {
-        if (curses.buffer[i] == '\t') curses.buffer[i] = ' ';
+        if (curses.buffer[i] == '\t' || curses.buffer[i] == '\n') curses.buffer[i] = ' ';
         int32_t next = bm_utf8_rune_next(curses.buffer, i);
         dw += bm_utf8_rune_width(curses.buffer + i, next);
         i += (next ? next : 1);
@@ -145,7 +155,7 @@ draw_line(int32_t pair, int32_t y, const char *fmt, ...)
     if (dw < ncols) {
         /* line is too short, widen it */
         size_t offset = i + (ncols - dw);
-        if (curses.blen <= offset && !bm_resize_buffer(&curses.buffer, &curses.blen, offset + 1))
+        if (curses.blen <= offset && !bm_resize_buffer(BM_MEMORY_RENDER, &curses.buffer, &curses.blen, offset + 1))
              return;
 
         memset(curses.buffer + nlen, ' ', offset - nlen);
@@ -158,7 +168,7 @@ draw_line(int32_t pair, int32_t y, const char *fmt, ...)
         size_t offset = i - (dw - ncols) + (ncols - cc) + 1;
         if (curses.blen <= offset) {
             int32_t diff = offset - curses.blen + 1;
-            if (!bm_resize_buffer(&curses.buffer, &curses.blen, curses.blen + diff))
+            if (!bm_resize_buffer(BM_MEMORY_RENDER, &curses.buffer, &curses.blen, curses.blen + diff))
                 return;
         }
 
@@ -175,6 +185,79 @@ draw_line(int32_t pair, int32_t y, const char *fmt, ...)
         attroff(COLOR_PAIR(pair));
 }
 
+/**
+ * Skip leading directories of path until it fits to cols columns with ellipsis prepended.
+ *
+ * @return Number of bytes to skip, 0 if path fits as is.
+ */
+static uint32_t
+abbreviate_path(const char *text, uint32_t len, uint32_t cols)
+{
+    char *copy;
+    if (!(copy = bm_dprintf(BM_MEMORY_RENDER, "%.*s", (int)len, text)))
+        return 0;
+
+    uint32_t skip = 0;
+    if ((uint32_t)bm_utf8_string_screen_width(copy) > cols) {
+        for (const char *s = copy; (s = strchr(s + 1, '/')) && s[1];) {
+            skip = s - copy;
+            if ((uint32_t)bm_utf8_string_screen_width(s) + 1 <= cols)
+                break;
+        }
+    }
+
+    bm_free(copy);
+    return skip;
+}
+
+/**
+ * Draw preview of highlighted item to columns from x to end of rows 1 to lines.
+ */
+static void
+draw_preview(const struct bm_menu *menu, uint32_t x, uint32_t ncols, uint32_t lines)
+{
+    size_t len;
+    const char *text;
+    if (!(text = bm_preview_get_text(menu->preview, bm_menu_get_highlighted_item(menu), &len))) {
+        text = "…";
+        len = strlen(text);
+    }
+
+    const uint32_t cols = (ncols > x + 2 ? ncols - x - 2 : 0);
+    for (uint32_t l = 0; l < lines; ++l) {
+        move(1 + l, x);
+        clrtoeol();
+        addstr("│ ");
+
+        uint32_t dw = 0;
+        size_t i = 0;
+        for (; i < len && text[i] != '\n'; i += bm_utf8_rune_next(text, i)) {
+            const uint32_t next = bm_utf8_rune_next(text, i);
+            if (next == 0)
+                break;
+
+            if ((unsigned char)text[i] < 0x20) {
+                /* tabs and other control characters would move the cursor */
+                if (dw < cols && text[i] == '\t') {
+                    addch(' ');
+                    ++dw;
+                }
+                continue;
+            }
+
+            const uint32_t w = bm_utf8_rune_width(text + i, next);
+            if (dw + w > cols)
+                continue;
+
+            addnstr(text + i, next);
+            dw += w;
+        }
+
+        text += (i < len ? i + 1 : len);
+        len -= (i < len ? i + 1 : len);
+    }
+}
+
 static void
 render(const struct bm_menu *menu)
 {
@@ -198,6 +281,10 @@ render(const struct bm_menu *menu)
         noecho();
         raw();
 
+        /* terminal wraps pasted text in escape sequences, so it is inserted at once instead of key by key */
+        putp("\033[?2004h");
+        fflush(stdout);
+
         start_color();
         use_default_colors();
         init_pair(1, COLOR_BLACK, COLOR_RED);
@@ -233,25 +320,42 @@ render(const struct bm_menu *menu)
     const uint32_t lines = fmax(getmaxy(curses.stdscreen), 1) - 1;
     if (lines > 1) {
         uint32_t displayed = 0;
-        struct bm_item **items = bm_menu_get_filtered_items(menu, &count);
+        count = bm_menu_get_filtered_count(menu);
         const bool scrollbar = (menu->scrollbar > BM_SCROLLBAR_NONE && (menu->scrollbar != BM_SCROLLBAR_AUTOHIDE || count > lines) ? true : false);
         const int32_t offset_x = title_len + (scrollbar && 2 > title_len ? 2 - title_len : 0);
         const int32_t prefix_x = (menu->prefix ? bm_utf8_string_screen_width(menu->prefix) : 0);
+        const uint32_t preview_x = (menu->preview ? ncols / 2 : ncols);
 
         const uint32_t page = menu->index / lines * lines;
         for (uint32_t i = page; i < count && cl < lines; ++i) {
-            bool highlighted = (items[i] == bm_menu_get_highlighted_item(menu));
-            int32_t color = (highlighted ? 2 : (bm_menu_item_is_selected(menu, items[i]) ? 1 : 0));
+            bool highlighted = (i == menu->index);
+            int32_t color = (highlighted ? 2 : (bm_menu_filtered_item_is_selected(menu, i) ? 1 : 0));
+
+            uint32_t len;
+            const char *text = bm_item_get_display(bm_menu_get_filtered_item(menu, i), &len);
+
+            const char *ellipsis = "";
+            const uint32_t used = offset_x + prefix_x + (menu->prefix ? 1 : 0);
+            const uint32_t cols = (preview_x > used ? preview_x - used : 1);
+            uint32_t skip;
+            if (bm_menu_is_path_mode(menu) && (skip = abbreviate_path(text, len, cols)) > 0) {
+                ellipsis = "…";
+                text += skip;
+                len -= skip;
+            }
 
             if (menu->prefix && highlighted) {
-                draw_line(color, 1 + cl++, "%*s%s %s", offset_x, "", menu->prefix, (items[i]->text ? items[i]->text : ""));
+                draw_line(color, 1 + cl++, "%*s%s %s%.*s", offset_x, "", menu->prefix, ellipsis, (int)len, text);
             } else {
-                draw_line(color, 1 + cl++, "%*s%s%s", offset_x + prefix_x, "", (menu->prefix ? " " : ""), (items[i]->text ? items[i]->text : ""));
+                draw_line(color, 1 + cl++, "%*s%s%s%.*s", offset_x + prefix_x, "", (menu->prefix ? " " : ""), ellipsis, (int)len, text);
             }
 
             ++displayed;
         }
 
+        if (menu->preview)
+            draw_preview(menu, preview_x, ncols, lines);
+
         if (scrollbar) {
             attron(COLOR_PAIR(1));
             const float percent = fmin(((float)page / (count - lines)), 1.0f);
@@ -276,6 +380,16 @@ render(const struct bm_menu *menu)
     }
 }
 
+static void
+set_visible(const struct bm_menu *menu, bool visible)
+{
+    (void)menu;
+
+    /* screen is set up again by next render */
+    if (!visible)
+        terminate();
+}
+
 static uint32_t
 get_displayed_count(const struct bm_menu *menu)
 {
@@ -283,18 +397,89 @@ get_displayed_count(const struct bm_menu *menu)
     return (curses.stdscreen ? getmaxy(curses.stdscreen) : 0);
 }
 
+/**
+ * Read characters following escape, and check they are the given sequence.
+ * Characters that don't match are dropped, escape cancels the menu anyway.
+ */
+static bool
+read_sequence(const char *sequence, bool wait)
+{
+    nodelay(curses.stdscreen, !wait);
+
+    wint_t c;
+    const char *s;
+    for (s = sequence; *s && get_wch(&c) == OK && c == (wint_t)*s; ++s);
+
+    nodelay(curses.stdscreen, false);
+    return !*s;
+}
+
+/**
+ * Read bracketed paste up to its end sequence.
+ */
+static void
+read_paste(void)
+{
+    curses.paste_len = 0;
+
+    int ret;
+    wint_t c;
+    while ((ret = get_wch(&c)) != ERR) {
+        if (ret == KEY_CODE_YES)
+            continue;
+
+        if (c == 27) {
+            if (read_sequence("[201~", true))
+                break;
+            continue;
+        }
+
+        char mb[MB_LEN_MAX];
+        mbstate_t state;
+        memset(&state, 0, sizeof(state));
+        const size_t len = wcrtomb(mb, c, &state);
+        if (len == (size_t)-1)
+            continue;
+
+        if (curses.paste_len + len >= curses.paste_size && !bm_resize_buffer(BM_MEMORY_RENDER, &curses.paste, &curses.paste_size, (curses.paste_size + len) * 2))
+            continue;
+
+        memcpy(curses.paste + curses.paste_len, mb, len);
+        curses.paste_len += len;
+    }
+
+    if (curses.paste)
+        curses.paste[curses.paste_len] = 0;
+}
+
+static const char*
+get_paste(const struct bm_menu *menu)
+{
+    (void)menu;
+    return (curses.paste_len > 0 ? curses.paste : NULL);
+}
+
 static enum bm_key
 poll_key(const struct bm_menu *menu, uint32_t *unicode)
 {
-    (void)menu;
-    assert(unicode);
+    assert(menu && unicode);
     *unicode = 0;
     curses.polled_once = true;
 
     if (!curses.stdscreen || curses.should_terminate)
         return BM_KEY_NONE;
 
-    get_wch((wint_t*)unicode);
+    /* curses may hold input already read from terminal, so check it before waiting on the terminal */
+    nodelay(curses.stdscreen, true);
+    const int ret = get_wch((wint_t*)unicode);
+    nodelay(curses.stdscreen, false);
+
+    if (ret == ERR) {
+        if (!bm_menu_wait_fd(menu, STDIN_FILENO, -1))
+            return BM_KEY_NONE;
+
+        get_wch((wint_t*)unicode);
+    }
 
     switch (*unicode) {
 #if KEY_RESIZE
@@ -381,8 +566,13 @@ poll_key(const struct bm_menu *menu, uint32_t *unicode)
             terminate();
             return BM_KEY_RETURN;
 
-        case 7: /* C-g */
         case 27: /* Escape */
+            if (read_sequence("[200~", false)) {
+                read_paste();
+                return BM_KEY_PASTE;
+            }
+            // fall through
+        case 7: /* C-g */
             terminate();
             return BM_KEY_ESCAPE;
 
@@ -397,6 +587,7 @@ destructor(struct bm_menu *menu)
 {
     (void)menu;
     terminate();
+    bm_free(curses.paste);
     sigaction(SIGABRT, &curses.abrt_action, NULL);
     sigaction(SIGSEGV, &curses.segv_action, NULL);
     sigaction(SIGWINCH, &curses.winch_action, NULL);
@@ -432,6 +623,8 @@ register_renderer(struct render_api *api)
     api->get_displayed_count = get_displayed_count;
     api->poll_key = poll_key;
     api->render = render;
+    api->set_visible = set_visible;
+    api->get_paste = get_paste;
     api->priorty = BM_PRIO_TERMINAL;
     api->version = BM_PLUGIN_VERSION;
     return "curses";
@@ -1,9 +1,26 @@
 #include "wayland.h"
 
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/timerfd.h>
 
+/**
+ * Text types taken from clipboard, most preferred first.
+ */
+static const char *paste_mimes[] = {
+    "text/plain;charset=utf-8",
+    "UTF8_STRING",
+    "text/plain",
+};
+
+/**
+ * Most bytes read from clipboard.
+ */
+static const size_t paste_max = 1 << 18;
+
 const char *BM_XKB_MASK_NAMES[MASK_LAST] = {
     XKB_MOD_NAME_SHIFT,
     XKB_MOD_NAME_CAPS,
@@ -228,6 +245,94 @@ static const struct wl_seat_listener seat_listener = {
     .name = seat_handle_name
 };
 
+static void
+data_offer_handle_offer(void *data, struct wl_data_offer *offer, const char *mime)
+{
+    (void)data;
+    const char *best = wl_data_offer_get_user_data(offer);
+
+    /* only types preferred over the best one offered so far replace it */
+    for (size_t i = 0; i < sizeof(paste_mimes) / sizeof(paste_mimes[0]) && paste_mimes[i] != best; ++i) {
+        if (strcmp(mime, paste_mimes[i]) == 0) {
+            wl_data_offer_set_user_data(offer, (void*)paste_mimes[i]);
+            break;
+        }
+    }
+}
+
+static const struct wl_data_offer_listener data_offer_listener = {
+    .offer = data_offer_handle_offer
+};
+
+static void
+data_device_handle_data_offer(void *data, struct wl_data_device *data_device, struct wl_data_offer *offer)
+{
+    (void)data, (void)data_device;
+    wl_data_offer_add_listener(offer, &data_offer_listener, NULL);
+}
+
+static void
+data_device_handle_enter(void *data, struct wl_data_device *data_device, uint32_t serial, struct wl_surface *surface, wl_fixed_t x, wl_fixed_t y, struct wl_data_offer *offer)
+{
+    (void)data, (void)data_device, (void)serial, (void)surface, (void)x, (void)y;
+
+    /* nothing is dropped on menu */
+    if (offer)
+        wl_data_offer_destroy(offer);
+}
+
+static void
+data_device_handle_leave(void *data, struct wl_data_device *data_device)
+{
+    (void)data, (void)data_device;
+}
+
+static void
+data_device_handle_motion(void *data, struct wl_data_device *data_device, uint32_t time, wl_fixed_t x, wl_fixed_t y)
+{
+    (void)data, (void)data_device, (void)time, (void)x, (void)y;
+}
+
+static void
+data_device_handle_drop(void *data, struct wl_data_device *data_device)
+{
+    (void)data, (void)data_device;
+}
+
+static void
+data_device_handle_selection(void *data, struct wl_data_device *data_device, struct wl_data_offer *offer)
+{
+    (void)data_device;
+    struct wayland *wayland = data;
+
+    if (wayland->selection)
+        wl_data_offer_destroy(wayland->selection);
+
+    wayland->selection = offer;
+}
+
+static const struct wl_data_device_listener data_device_listener = {
+    .data_offer = data_device_handle_data_offer,
+    .enter = data_device_handle_enter,
+    .leave = data_device_handle_leave,
+    .motion = data_device_handle_motion,
+    .drop = data_device_handle_drop,
+    .selection = data_device_handle_selection
+};
+
+/**
+ * Close pipe of pending paste, text read so far is dropped.
+ */
+static void
+stop_receiving(struct wayland *wayland)
+{
+    if (wayland->fds.paste >= 0)
+        close(wayland->fds.paste);
+
+    wayland->fds.paste = -1;
+    wayland->receiving.len = 0;
+}
+
 static void
 display_handle_geometry(void *data, struct wl_output *wl_output, int x, int y, int physical_width, int physical_height, int subpixel, const char *make, const char *model, int transform)
 {
@@ -253,10 +358,11 @@ display_handle_scale(void *data, struct wl_output *wl_output, int32_t scale)
 static void
 display_handle_mode(void *data, struct wl_output *wl_output, uint32_t flags, int width, int height, int refresh)
 {
-    (void)wl_output, (void)refresh, (void)height, (void)width;
+    (void)wl_output, (void)refresh;
     struct output *output = data;
 
     if (flags & WL_OUTPUT_MODE_CURRENT) {
+        output->width = width;
         output->height = height;
     }
 }
@@ -281,12 +387,14 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id, co
     } else if (strcmp(interface, "wl_seat") == 0) {
         wayland->seat = wl_registry_bind(registry, id, &wl_seat_interface, 1);
         wl_seat_add_listener(wayland->seat, &seat_listener, &wayland->input);
+    } else if (strcmp(interface, "wl_data_device_manager") == 0) {
+        wayland->data_device_manager = wl_registry_bind(registry, id, &wl_data_device_manager_interface, 1);
     } else if (strcmp(interface, "wl_shm") == 0) {
         wayland->shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
         wl_shm_add_listener(wayland->shm, &shm_listener, data);
     } else if (strcmp(interface, "wl_output") == 0) {
         struct wl_output *wl_output = wl_registry_bind(registry, id, &wl_output_interface, 2);
-        struct output *output = calloc(1, sizeof(struct output));
+        struct output *output = bm_calloc(BM_MEMORY_RENDER, 1, sizeof(struct output));
         output->output = wl_output;
         output->scale = 1;
         wl_list_insert(&wayland->outputs, &output->link);
@@ -323,6 +431,18 @@ bm_wl_registry_destroy(struct wayland *wayland)
 {
     assert(wayland);
 
+    stop_receiving(wayland);
+    bm_free(wayland->receiving.text);
+
+    if (wayland->selection)
+        wl_data_offer_destroy(wayland->selection);
+
+    if (wayland->data_device)
+        wl_data_device_destroy(wayland->data_device);
+
+    if (wayland->data_device_manager)
+        wl_data_device_manager_destroy(wayland->data_device_manager);
+
     if (wayland->shm)
         wl_shm_destroy(wayland->shm);
 
@@ -347,17 +467,117 @@ bm_wl_registry_register(struct wayland *wayland)
     if (!(wayland->registry = wl_display_get_registry(wayland->display)))
         return false;
 
+    /* defaults, until compositor tells repeat info of keyboard */
+    set_repeat_info(&wayland->input, 40, 400);
+    wayland->input.last_code = 0xDEADBEEF;
+
     wl_registry_add_listener(wayland->registry, &registry_listener, wayland);
     wl_display_roundtrip(wayland->display); // trip 1, registry globals
-    if (!wayland->compositor || !wayland->seat || !wayland->shm || !wayland->layer_shell)
-        return false;
+
+    /* clipboard is optional, its selection arrives with the global listeners of trip 2 */
+    if (wayland->data_device_manager && wayland->seat) {
+        wayland->data_device = wl_data_device_manager_get_data_device(wayland->data_device_manager, wayland->seat);
+        wl_data_device_add_listener(wayland->data_device, &data_device_listener, wayland);
+    }
+
+    return (wayland->compositor && wayland->seat && wayland->shm && wayland->layer_shell);
+}
+
+/**
+ * Wait for events of bound globals.
+ * Windows should be created before, so their setup requests and first configure ride along with the same roundtrip.
+ */
+bool
+bm_wl_registry_sync(struct wayland *wayland)
+{
+    assert(wayland);
 
     wl_display_roundtrip(wayland->display); // trip 2, global listeners
-    if (!wayland->input.keyboard || !(wayland->formats & (1 << WL_SHM_FORMAT_ARGB8888)))
+    return (wayland->input.keyboard && (wayland->formats & (1 << WL_SHM_FORMAT_ARGB8888)));
+}
+
+/**
+ * Ask clipboard owner for text of current selection, replacing pending paste.
+ * Owner writes text to a pipe, whose non-blocking read end is left in fds.paste for bm_wl_registry_read_selection.
+ *
+ * @return true if text was asked for, false if clipboard has no text.
+ */
+bool
+bm_wl_registry_receive_selection(struct wayland *wayland)
+{
+    assert(wayland);
+
+    const char *mime;
+    if (!wayland->selection || !(mime = wl_data_offer_get_user_data(wayland->selection)))
         return false;
 
-    set_repeat_info(&wayland->input, 40, 400);
-    wayland->input.last_code = 0xDEADBEEF;
+    stop_receiving(wayland);
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+
+    if (fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(fds[0], F_SETFD, FD_CLOEXEC) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    wl_data_offer_receive(wayland->selection, mime, fds[1]);
+    close(fds[1]);
+    wl_display_flush(wayland->display);
+
+    wayland->fds.paste = fds[0];
+    return true;
+}
+
+/**
+ * Read text clipboard owner has sent so far.
+ * Once owner closes the pipe, fds.paste is closed and set to -1.
+ *
+ * @return true if paste now holds the whole text, false if more is expected or clipboard had no text.
+ */
+bool
+bm_wl_registry_read_selection(struct wayland *wayland)
+{
+    assert(wayland && wayland->fds.paste >= 0);
+
+    while (wayland->receiving.len < paste_max) {
+        if (wayland->receiving.len + 1 >= wayland->receiving.size) {
+            size_t nsize = (wayland->receiving.size ? wayland->receiving.size * 2 : 4096);
+            char *tmp;
+            if (!(tmp = bm_realloc(BM_MEMORY_RENDER, wayland->receiving.text, nsize)))
+                break;
+
+            wayland->receiving.text = tmp;
+            wayland->receiving.size = nsize;
+        }
+
+        ssize_t got;
+        if ((got = read(wayland->fds.paste, wayland->receiving.text + wayland->receiving.len, wayland->receiving.size - wayland->receiving.len - 1)) < 0 && errno == EINTR)
+            continue;
+
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+
+        if (got <= 0)
+            break;
+
+        wayland->receiving.len += got;
+    }
+
+    const size_t len = wayland->receiving.len;
+    stop_receiving(wayland);
+
+    if (len == 0)
+        return false;
+
+    /* buffer becomes the paste, next paste starts a new one */
+    wayland->receiving.text[len] = 0;
+    bm_free(wayland->paste);
+    wayland->paste = wayland->receiving.text;
+    wayland->receiving.text = NULL;
+    wayland->receiving.size = 0;
     return true;
 }
 
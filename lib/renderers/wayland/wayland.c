@@ -26,13 +26,12 @@ render(const struct bm_menu *menu)
 
     struct window *window;
     wl_list_for_each(window, &wayland->windows, link) {
-        if (window->render_pending)
-            bm_wl_window_render(window, wayland->display, menu);
+        bm_wl_window_render(window, menu);
     }
     wl_display_flush(wayland->display);
 
     struct epoll_event ep[16];
-    uint32_t num = epoll_wait(efd, ep, 16, -1);
+    uint32_t num = epoll_wait(efd, ep, 16, (bm_menu_wait_fd(menu, efd, -1) ? -1 : 0));
     for (uint32_t i = 0; i < num; ++i) {
         if (ep[i].data.ptr == &wayland->fds.display) {
             if (ep[i].events & EPOLLERR || ep[i].events & EPOLLHUP ||
@@ -40,7 +39,13 @@ render(const struct bm_menu *menu)
                 wayland->input.sym = XKB_KEY_Escape;
         } else if (ep[i].data.ptr == &wayland->fds.repeat) {
             bm_wl_repeat(wayland);
+        } else if (ep[i].data.ptr == &wayland->fds.paste) {
+            /* clipboard text arrives in pieces, it is pasted once its owner closes the pipe, closing our end drops it from epoll */
+            if (bm_wl_registry_read_selection(wayland))
+                wayland->pasted = true;
         }
+
+        /* painted frames of render threads are acquired on next render */
     }
 
     if (wayland->input.code != wayland->input.last_code) {
@@ -59,6 +64,11 @@ poll_key(const struct bm_menu *menu, unsigned int *unicode)
     assert(wayland && unicode);
     *unicode = 0;
 
+    if (wayland->pasted) {
+        wayland->pasted = false;
+        return BM_KEY_PASTE;
+    }
+
     if (wayland->input.sym == XKB_KEY_NoSymbol)
         return BM_KEY_UNICODE;
 
@@ -169,12 +179,34 @@ poll_key(const struct bm_menu *menu, unsigned int *unicode)
         case XKB_KEY_m:
             return (mods & MOD_CTRL ? BM_KEY_RETURN : BM_KEY_UNICODE);
 
+        case XKB_KEY_y:
+        case XKB_KEY_Y:
+            if (!(mods & MOD_CTRL))
+                return BM_KEY_UNICODE;
+
+            /* core protocol has no primary selection, so both bindings paste clipboard */
+            if (bm_wl_registry_receive_selection(wayland)) {
+                struct epoll_event ep;
+                ep.events = EPOLLIN;
+                ep.data.ptr = &wayland->fds.paste;
+                epoll_ctl(efd, EPOLL_CTL_ADD, wayland->fds.paste, &ep);
+            }
+            return BM_KEY_NONE;
+
         default: break;
     }
 
     return BM_KEY_UNICODE;
 }
 
+static const char*
+get_paste(const struct bm_menu *menu)
+{
+    struct wayland *wayland = menu->renderer->internal;
+    assert(wayland);
+    return wayland->paste;
+}
+
 static uint32_t
 get_displayed_count(const struct bm_menu *menu)
 {
@@ -197,7 +229,7 @@ set_bottom(const struct bm_menu *menu, bool bottom)
 
     struct window *window;
     wl_list_for_each(window, &wayland->windows, link) {
-        bm_wl_window_set_bottom(window, wayland->display, bottom);
+        bm_wl_window_set_bottom(window, bottom);
     }
 }
 
@@ -209,7 +241,7 @@ grab_keyboard(const struct bm_menu *menu, bool grab)
 
     struct window *window;
     wl_list_for_each(window, &wayland->windows, link) {
-        bm_wl_window_grab_keyboard(window, wayland->display, grab);
+        bm_wl_window_grab_keyboard(window, grab);
     }
 }
 
@@ -221,7 +253,27 @@ set_overlap(const struct bm_menu *menu, bool overlap)
 
     struct window *window;
     wl_list_for_each(window, &wayland->windows, link) {
-        bm_wl_window_set_overlap(window, wayland->display, overlap);
+        bm_wl_window_set_overlap(window, overlap);
+    }
+}
+
+static void
+set_visible(const struct bm_menu *menu, bool visible)
+{
+    struct wayland *wayland = menu->renderer->internal;
+    assert(wayland);
+
+    if (!visible) {
+        /* key held while hiding must not repeat into the hidden menu */
+        struct itimerspec its = {{0, 0}, {0, 0}};
+        timerfd_settime(wayland->fds.repeat, 0, &its, NULL);
+        wayland->input.sym = XKB_KEY_NoSymbol;
+        wayland->input.code = 0;
+    }
+
+    struct window *window;
+    wl_list_for_each(window, &wayland->windows, link) {
+        bm_wl_window_set_visible(window, wayland->display, visible);
     }
 }
 
@@ -230,6 +282,8 @@ destroy_windows(struct wayland *wayland)
 {
     struct window *window;
     wl_list_for_each(window, &wayland->windows, link) {
+        if (bm_cairo_thread_get_fd(&window->thread) >= 0)
+            epoll_ctl(efd, EPOLL_CTL_DEL, bm_cairo_thread_get_fd(&window->thread), NULL);
         bm_wl_window_destroy(window);
     }
     wl_list_init(&wayland->windows);
@@ -258,22 +312,27 @@ recreate_windows(const struct bm_menu *menu, struct wayland *wayland)
 
         wl_surface_set_buffer_scale(surface, output->scale);
 
-        struct window *window = calloc(1, sizeof(struct window));
+        struct window *window = bm_calloc(BM_MEMORY_RENDER, 1, sizeof(struct window));
         window->bottom = menu->bottom;
         window->scale = output->scale;
 
-        if (!bm_wl_window_create(window, wayland->display, wayland->shm, output->output, wayland->layer_shell, surface))
-            free(window);
+        if (!bm_wl_window_create(window, wayland->shm, output, wayland->layer_shell, surface, menu->overlap, menu->grabbed)) {
+            bm_free(window);
+            goto fail;
+        }
+
+        struct epoll_event ep;
+        ep.events = EPOLLIN;
+        ep.data.ptr = &window->thread;
+        epoll_ctl(efd, EPOLL_CTL_ADD, bm_cairo_thread_get_fd(&window->thread), &ep);
 
-        window->notify.render = bm_cairo_paint;
         window->max_height = output->height;
         window->render_pending = true;
         wl_list_insert(&wayland->windows, &window->link);
         break;
     }
 
-    set_overlap(menu, menu->overlap);
-    grab_keyboard(menu, menu->grabbed);
+    wl_display_flush(wayland->display);
     return;
 
 fail:
@@ -312,7 +371,8 @@ destructor(struct bm_menu *menu)
         wl_display_disconnect(wayland->display);
     }
 
-    free(wayland);
+    bm_free(wayland->paste);
+    bm_free(wayland);
     menu->renderer->internal = NULL;
 }
 
@@ -323,9 +383,11 @@ constructor(struct bm_menu *menu)
         return false;
 
     struct wayland *wayland;
-    if (!(menu->renderer->internal = wayland = calloc(1, sizeof(struct wayland))))
+    if (!(menu->renderer->internal = wayland = bm_calloc(BM_MEMORY_RENDER, 1, sizeof(struct wayland))))
         goto fail;
 
+    wayland->fds.paste = -1;
+
     wl_list_init(&wayland->windows);
     wl_list_init(&wayland->outputs);
 
@@ -341,11 +403,15 @@ constructor(struct bm_menu *menu)
     wayland->fds.display = wl_display_get_fd(wayland->display);
     wayland->fds.repeat = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
     wayland->input.repeat_fd = &wayland->fds.repeat;
-    recreate_windows(menu, wayland);
 
     if (!efd && (efd = epoll_create1(EPOLL_CLOEXEC)) < 0)
         goto fail;
 
+    recreate_windows(menu, wayland);
+
+    if (!bm_wl_registry_sync(wayland))
+        goto fail;
+
     struct epoll_event ep;
     ep.events = EPOLLIN | EPOLLERR | EPOLLHUP;
     ep.data.ptr = &wayland->fds.display;
@@ -374,6 +440,8 @@ register_renderer(struct render_api *api)
     api->grab_keyboard = grab_keyboard;
     api->set_overlap = set_overlap;
     api->set_monitor = set_monitor;
+    api->set_visible = set_visible;
+    api->get_paste = get_paste;
     api->priorty = BM_PRIO_GUI;
     api->version = BM_PLUGIN_VERSION;
     return "wayland";
@@ -6,7 +6,7 @@
 
 #include "wlr-layer-shell-unstable-v1.h"
 
-#include "renderers/cairo.h"
+#include "renderers/cairo_thread.h"
 
 struct bm_menu;
 
@@ -87,14 +87,29 @@ struct window {
     bool bottom;
     bool render_pending;
 
-    struct {
-        void (*render)(struct cairo *cairo, uint32_t width, uint32_t max_height, const struct bm_menu *menu, struct cairo_paint_result *result);
-    } notify;
+    /**
+     * Paints menu, newest frame waits in frame until compositor is ready for it.
+     */
+    struct cairo_thread thread;
+    const struct cairo_frame *frame;
+    bool presented;
+
+    /**
+     * Output of window, its size and scale may arrive after window was created.
+     */
+    struct output *output;
+
+    /**
+     * Height asked from compositor, nothing is attached until its configure arrives.
+     */
+    uint32_t requested_height;
+    bool configured;
 };
 
 struct output {
     struct wl_output *output;
     struct wl_list link;
+    int width;
     int height;
     int scale;
 };
@@ -103,6 +118,11 @@ struct wayland {
     struct {
         int32_t display;
         int32_t repeat;
+
+        /**
+         * Pipe clipboard text is read from, -1 when no paste is pending.
+         */
+        int32_t paste;
     } fds;
 
     struct wl_display *display;
@@ -115,17 +135,43 @@ struct wayland {
     struct input input;
     struct wl_list windows;
     uint32_t formats;
+
+    /**
+     * Clipboard of seat, selection is the offer of its current content.
+     */
+    struct wl_data_device_manager *data_device_manager;
+    struct wl_data_device *data_device;
+    struct wl_data_offer *selection;
+
+    /**
+     * Clipboard text read so far, until its owner closes the pipe.
+     */
+    struct {
+        char *text;
+        size_t len, size;
+    } receiving;
+
+    /**
+     * Text last read from clipboard, returned by get_paste.
+     * Pasted is set once it is complete, until poll_key returns it.
+     */
+    char *paste;
+    bool pasted;
 };
 
 void bm_wl_repeat(struct wayland *wayland);
 bool bm_wl_registry_register(struct wayland *wayland);
+bool bm_wl_registry_sync(struct wayland *wayland);
 void bm_wl_registry_destroy(struct wayland *wayland);
+bool bm_wl_registry_receive_selection(struct wayland *wayland);
+bool bm_wl_registry_read_selection(struct wayland *wayland);
 void bm_wl_window_schedule_render(struct window *window);
-void bm_wl_window_render(struct window *window, struct wl_display *display, const struct bm_menu *menu);
-void bm_wl_window_set_bottom(struct window *window, struct wl_display *display, bool bottom);
-void bm_wl_window_grab_keyboard(struct window *window, struct wl_display *display, bool grab);
-void bm_wl_window_set_overlap(struct window *window, struct wl_display *display, bool overlap);
-bool bm_wl_window_create(struct window *window, struct wl_display *display, struct wl_shm *shm, struct wl_output *output, struct zwlr_layer_shell_v1 *layer_shell, struct wl_surface *surface);
+void bm_wl_window_render(struct window *window, const struct bm_menu *menu);
+void bm_wl_window_set_bottom(struct window *window, bool bottom);
+void bm_wl_window_grab_keyboard(struct window *window, bool grab);
+void bm_wl_window_set_overlap(struct window *window, bool overlap);
+void bm_wl_window_set_visible(struct window *window, struct wl_display *display, bool visible);
+bool bm_wl_window_create(struct window *window, struct wl_shm *shm, struct output *output, struct zwlr_layer_shell_v1 *layer_shell, struct wl_surface *surface, bool overlap, bool grab);
 void bm_wl_window_destroy(struct window *window);
 
 #endif /* _BM_WAYLAND_H_ */
@@ -60,11 +60,11 @@ os_create_anonymous_file(off_t size)
 
     char *name;
     int ts = (path[strlen(path) - 1] == '/');
-    if (!(name = bm_dprintf("%s%s%s", path, (ts ? "" : "/"), template)))
+    if (!(name = bm_dprintf(BM_MEMORY_RENDER, "%s%s%s", path, (ts ? "" : "/"), template)))
         return -1;
 
     fd = create_tmpfile_cloexec(name);
-    free(name);
+    bm_free(name);
 
     if (fd < 0)
         return -1;
@@ -218,37 +218,78 @@ bm_wl_window_schedule_render(struct window *window)
 }
 
 void
-bm_wl_window_render(struct window *window, struct wl_display *display, const struct bm_menu *menu)
+bm_wl_window_render(struct window *window, const struct bm_menu *menu)
 {
     assert(window && menu);
-    struct buffer *buffer;
-    for (int tries = 0; tries < 2; ++tries) {
-        if (!(buffer = next_buffer(window))) {
-            fprintf(stderr, "could not get next buffer");
-            exit(EXIT_FAILURE);
+
+    /* mode and scale of output arrive with the same roundtrip as first configure, and may change later */
+    if (window->output) {
+        window->max_height = window->output->height;
+
+        if (window->scale != window->output->scale) {
+            window->scale = window->output->scale;
+            wl_surface_set_buffer_scale(window->surface, window->scale);
         }
+    }
+
+    /* until first configure, menu is painted for width of output, so painting overlaps waiting for compositor */
+    uint32_t width = window->width;
+    if (!width && window->output && window->scale > 0)
+        width = window->output->width / window->scale;
+
+    if (!bm_cairo_thread_submit(&window->thread, menu, width * window->scale, window->max_height * window->scale, window->scale)) {
+        fprintf(stderr, "could not capture menu for rendering");
+        exit(EXIT_FAILURE);
+    }
 
-        if (!window->notify.render)
-            break;
+    /* first frame is waited for, so surface is never mapped without contents */
+    const struct cairo_frame *frame;
+    if ((frame = bm_cairo_thread_acquire(&window->thread, !window->presented)))
+        window->frame = frame;
 
-        struct cairo_paint_result result;
-        window->notify.render(&buffer->cairo, buffer->width, window->max_height * window->scale, menu, &result);
-        window->displayed = result.displayed;
+    /* configure is dispatched from display fd, which wakes up render loop again */
+    if (!window->frame || !window->configured)
+        return;
 
-        if (window->height == result.height)
-            break;
+    /* painted for guessed width, newer frame for configured width is on its way */
+    if (window->frame->width != window->width * window->scale) {
+        window->frame = NULL;
+        return;
+    }
 
-        window->height = result.height;
-        zwlr_layer_surface_v1_set_size(window->layer_surface, 0, window->height);
+    if (window->requested_height != window->frame->result.height) {
+        window->requested_height = window->frame->result.height;
+        zwlr_layer_surface_v1_set_size(window->layer_surface, 0, window->requested_height);
         wl_surface_commit(window->surface);
-        wl_display_roundtrip(display);
-        destroy_buffer(buffer);
+        window->configured = false;
+        return;
     }
 
+    if (!window->render_pending) {
+        bm_wl_window_schedule_render(window);
+        return;
+    }
+
+    struct buffer *buffer;
+    if (!(buffer = next_buffer(window))) {
+        fprintf(stderr, "could not get next buffer");
+        exit(EXIT_FAILURE);
+    }
+
+    cairo_save(buffer->cairo.cr);
+    cairo_set_operator(buffer->cairo.cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(buffer->cairo.cr, window->frame->cairo.surface, 0, 0);
+    cairo_paint(buffer->cairo.cr);
+    cairo_restore(buffer->cairo.cr);
+    cairo_surface_flush(buffer->cairo.surface);
+
     wl_surface_damage(window->surface, 0, 0, buffer->width, buffer->height);
     wl_surface_attach(window->surface, buffer->buffer, 0, 0);
     wl_surface_commit(window->surface);
     buffer->busy = true;
+    window->displayed = window->frame->result.displayed;
+    window->frame = NULL;
+    window->presented = true;
     window->render_pending = false;
 }
 
@@ -257,6 +298,9 @@ bm_wl_window_destroy(struct window *window)
 {
     assert(window);
 
+    bm_cairo_thread_stop(&window->thread);
+    window->frame = NULL;
+
     for (int32_t i = 0; i < 2; ++i)
         destroy_buffer(&window->buffers[i]);
 
@@ -273,6 +317,7 @@ layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *layer_surface,
     struct window *window = data;
     window->width = width;
     window->height = height;
+    window->configured = true;
     zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
 }
 
@@ -290,52 +335,97 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
     .closed = layer_surface_closed,
 };
 
+static void
+set_anchor(struct window *window)
+{
+    zwlr_layer_surface_v1_set_anchor(window->layer_surface, (window->bottom ? ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM : ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP) | ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
+}
+
+/*
+ * Layer surface state is double buffered, so setters only commit it.
+ * Compositor answers with configure when needed, which is handled whenever it arrives instead of waiting for it.
+ */
+
 void
-bm_wl_window_set_bottom(struct window *window, struct wl_display *display, bool bottom)
+bm_wl_window_set_bottom(struct window *window, bool bottom)
 {
     if (window->bottom == bottom)
         return;
 
     window->bottom = bottom;
-
-    zwlr_layer_surface_v1_set_anchor(window->layer_surface, (window->bottom ? ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM : ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP) | ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
+    set_anchor(window);
     wl_surface_commit(window->surface);
-    wl_display_roundtrip(display);
 }
 
 void
-bm_wl_window_grab_keyboard(struct window *window, struct wl_display *display, bool grab)
+bm_wl_window_grab_keyboard(struct window *window, bool grab)
 {
     zwlr_layer_surface_v1_set_keyboard_interactivity(window->layer_surface, grab);
     wl_surface_commit(window->surface);
-    wl_display_roundtrip(display);
 }
 
 void
-bm_wl_window_set_overlap(struct window *window, struct wl_display *display, bool overlap)
+bm_wl_window_set_overlap(struct window *window, bool overlap)
 {
     zwlr_layer_surface_v1_set_exclusive_zone(window->layer_surface, overlap ? -1 : 0);
     wl_surface_commit(window->surface);
-    wl_display_roundtrip(display);
 }
 
-bool
-bm_wl_window_create(struct window *window, struct wl_display *display, struct wl_shm *shm, struct wl_output *output, struct zwlr_layer_shell_v1 *layer_shell, struct wl_surface *surface)
+void
+bm_wl_window_set_visible(struct window *window, struct wl_display *display, bool visible)
 {
-    assert(window);
+    /* frame callbacks of unmapped surface may never fire */
+    if (window->frame_cb) {
+        wl_callback_destroy(window->frame_cb);
+        window->frame_cb = NULL;
+    }
+
+    if (visible) {
+        /* layer surface unmapped with null buffer needs a commit without buffer to be configured again */
+        zwlr_layer_surface_v1_set_size(window->layer_surface, 0, window->requested_height);
+        wl_surface_commit(window->surface);
+        window->configured = false;
+        window->render_pending = true;
 
-    if (layer_shell && (window->layer_surface = zwlr_layer_shell_v1_get_layer_surface(layer_shell, surface, output, ZWLR_LAYER_SHELL_V1_LAYER_TOP, "menu"))) {
-        zwlr_layer_surface_v1_add_listener(window->layer_surface, &layer_surface_listener, window);
-        zwlr_layer_surface_v1_set_anchor(window->layer_surface, (window->bottom ? ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM : ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP) | ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
-        zwlr_layer_surface_v1_set_size(window->layer_surface, 0, 32);
-        wl_surface_commit(surface);
-        wl_display_roundtrip(display);
+        /* contents went away with the null buffer, so paint again even if menu did not change */
+        bm_cairo_thread_invalidate(&window->thread);
+        window->presented = false;
     } else {
+        wl_surface_attach(window->surface, NULL, 0, 0);
+        wl_surface_commit(window->surface);
+    }
+
+    wl_display_flush(display);
+}
+
+/**
+ * Create layer surface for window.
+ * Whole initial state goes with one commit, and first configure is not waited for.
+ */
+bool
+bm_wl_window_create(struct window *window, struct wl_shm *shm, struct output *output, struct zwlr_layer_shell_v1 *layer_shell, struct wl_surface *surface, bool overlap, bool grab)
+{
+    assert(window && output);
+
+    if (!bm_cairo_thread_start(&window->thread))
+        return false;
+
+    if (!layer_shell || !(window->layer_surface = zwlr_layer_shell_v1_get_layer_surface(layer_shell, surface, output->output, ZWLR_LAYER_SHELL_V1_LAYER_TOP, "menu"))) {
+        bm_cairo_thread_stop(&window->thread);
         return false;
     }
 
     window->shm = shm;
     window->surface = surface;
+    window->output = output;
+    window->requested_height = 32;
+
+    zwlr_layer_surface_v1_add_listener(window->layer_surface, &layer_surface_listener, window);
+    set_anchor(window);
+    zwlr_layer_surface_v1_set_size(window->layer_surface, 0, window->requested_height);
+    zwlr_layer_surface_v1_set_exclusive_zone(window->layer_surface, overlap ? -1 : 0);
+    zwlr_layer_surface_v1_set_keyboard_interactivity(window->layer_surface, grab);
+    wl_surface_commit(surface);
     return true;
 }
 
@@ -59,30 +59,23 @@ void
 bm_x11_window_render(struct window *window, const struct bm_menu *menu)
 {
     assert(window && menu);
-    uint32_t oldw = window->width, oldh = window->height;
 
-    struct buffer *buffer;
-    for (int32_t tries = 0; tries < 2; ++tries) {
-        if (!(buffer = next_buffer(window))) {
-            fprintf(stderr, "could not get next buffer");
-            exit(EXIT_FAILURE);
-        }
-
-        if (!window->notify.render)
-            break;
+    if (!bm_cairo_thread_submit(&window->thread, menu, window->width, window->max_height, 1)) {
+        fprintf(stderr, "could not capture menu for rendering");
+        exit(EXIT_FAILURE);
+    }
 
-        cairo_push_group(buffer->cairo.cr);
-        struct cairo_paint_result result;
-        window->notify.render(&buffer->cairo, buffer->width, window->max_height, menu, &result);
-        window->displayed = result.displayed;
-        cairo_pop_group_to_source(buffer->cairo.cr);
+    /* first frame is waited for, so window is never shown without contents */
+    const struct cairo_frame *frame;
+    if ((frame = bm_cairo_thread_acquire(&window->thread, !window->frame)))
+        window->frame = frame;
 
-        if (window->height == result.height)
-            break;
+    if (!window->frame)
+        return;
 
-        window->height = result.height;
-        destroy_buffer(buffer);
-    }
+    uint32_t oldw = window->width, oldh = window->height;
+    window->height = window->frame->result.height;
+    window->displayed = window->frame->result.displayed;
 
     if (oldw != window->width || oldh != window->height) {
         if (window->bottom) {
@@ -92,10 +85,22 @@ bm_x11_window_render(struct window *window, const struct bm_menu *menu)
         }
     }
 
-    if (buffer->created) {
-        cairo_paint(buffer->cairo.cr);
-        cairo_surface_flush(buffer->cairo.surface);
+    /* mapped only now, so the first frame is shown at final geometry */
+    if (window->visible && !window->mapped) {
+        XMapRaised(window->display, window->drawable);
+        window->mapped = true;
     }
+
+    struct buffer *buffer;
+    if (!(buffer = next_buffer(window))) {
+        fprintf(stderr, "could not get next buffer");
+        exit(EXIT_FAILURE);
+    }
+
+    /* copying painted frame is cheap, so it is done every time in case window was exposed */
+    cairo_set_source_surface(buffer->cairo.cr, window->frame->cairo.surface, 0, 0);
+    cairo_paint(buffer->cairo.cr);
+    cairo_surface_flush(buffer->cairo.surface);
 }
 
 void
@@ -114,12 +119,40 @@ void
 bm_x11_window_destroy(struct window *window)
 {
     assert(window);
+    bm_cairo_thread_stop(&window->thread);
+    window->frame = NULL;
     destroy_buffer(&window->buffer);
 
     if (window->display && window->drawable)
         XDestroyWindow(window->display, window->drawable);
 }
 
+/**
+ * Get area of window in root window coordinates.
+ */
+static bool
+get_root_area(struct window *window, Window w, int32_t *out_x, int32_t *out_y, uint32_t *out_width, uint32_t *out_height)
+{
+    Window root, child;
+    int32_t x, y;
+    uint32_t border, depth;
+    if (!XGetGeometry(window->display, w, &root, &x, &y, out_width, out_height, &border, &depth))
+        return false;
+
+    return XTranslateCoordinates(window->display, w, root, 0, 0, out_x, out_y, &child);
+}
+
+static void
+move_to_area(struct window *window)
+{
+    window->x = window->area.x;
+    window->y = window->area.y + (window->bottom ? window->area.height - window->height : 0);
+    window->width = window->area.width;
+    window->max_height = window->area.height;
+    XMoveResizeWindow(window->display, window->drawable, window->x, window->y, window->width, window->height);
+    XFlush(window->display);
+}
+
 void
 bm_x11_window_set_monitor(struct window *window, uint32_t monitor)
 {
@@ -129,32 +162,27 @@ bm_x11_window_set_monitor(struct window *window, uint32_t monitor)
     Window root = DefaultRootWindow(window->display);
 
     {
-        /* xinerama logic straight from dmenu */
+        /* xinerama logic from dmenu, with the focused window located in root coordinates
+         * instead of walking to its top-level window with a round trip per level */
 #define INTERSECT(x,y,w,h,r)  (fmax(0, fmin((x)+(w),(r).x_org+(r).width) - fmax((x),(r).x_org)) * fmax(0, fmin((y)+(h),(r).y_org+(r).height) - fmax((y),(r).y_org)))
 
         int32_t n;
         XineramaScreenInfo *info;
         if ((info = XineramaQueryScreens(window->display, &n))) {
             int32_t x, y, a, j, di, i = 0, area = 0;
-            uint32_t du;
-            Window w, pw, dw, *dws;
-            XWindowAttributes wa;
+            uint32_t du, w, h;
+            Window focus, dw;
 
-            XGetInputFocus(window->display, &w, &di);
             if (monitor > 0)
                 i = ((int32_t)monitor > n ? n : (int32_t)monitor) - 1;
 
-            if (monitor == 0 && w != root && w != PointerRoot && w != None) {
-                /* find top-level window containing current input focus */
-                do {
-                    if (XQueryTree(window->display, (pw = w), &dw, &w, &dws, &du) && dws)
-                        XFree(dws);
-                } while(w != root && w != pw);
+            if (monitor == 0) {
+                XGetInputFocus(window->display, &focus, &di);
 
-                /* find xinerama screen with which the window intersects most */
-                if (XGetWindowAttributes(window->display, pw, &wa)) {
+                /* find xinerama screen with which the focused window intersects most */
+                if (focus != root && focus != PointerRoot && focus != None && get_root_area(window, focus, &x, &y, &w, &h)) {
                     for (j = 0; j < n; j++)
-                        if ((a = INTERSECT(wa.x, wa.y, wa.width, wa.height, info[j])) > area) {
+                        if ((a = INTERSECT(x, y, w, h, info[j])) > area) {
                             area = a;
                             i = j;
                         }
@@ -169,24 +197,22 @@ bm_x11_window_set_monitor(struct window *window, uint32_t monitor)
                 }
             }
 
-            window->x = info[i].x_org;
-            window->y = info[i].y_org + (window->bottom ? info[i].height - window->height : 0);
-            window->width = info[i].width;
-            window->max_height = info[i].height;
+            window->area.x = info[i].x_org;
+            window->area.y = info[i].y_org;
+            window->area.width = info[i].width;
+            window->area.height = info[i].height;
             XFree(info);
         } else {
-            window->max_height = DisplayHeight(window->display, window->screen);
-            window->x = 0;
-            window->y = (window->bottom ? window->max_height - window->height : 0);
-            window->width = DisplayWidth(window->display, window->screen);
+            window->area.x = window->area.y = 0;
+            window->area.width = DisplayWidth(window->display, window->screen);
+            window->area.height = DisplayHeight(window->display, window->screen);
         }
 
 #undef INTERSECT
     }
 
     window->monitor = monitor;
-    XMoveResizeWindow(window->display, window->drawable, window->x, window->y, window->width, window->height);
-    XFlush(window->display);
+    move_to_area(window);
 }
 
 void
@@ -196,7 +222,26 @@ bm_x11_window_set_bottom(struct window *window, bool bottom)
         return;
 
     window->bottom = bottom;
-    bm_x11_window_set_monitor(window, window->monitor);
+
+    /* monitor is not looked up again, its area is known */
+    if (window->area.width > 0)
+        move_to_area(window);
+}
+
+void
+bm_x11_window_set_visible(struct window *window, bool visible)
+{
+    assert(window);
+
+    window->visible = visible;
+
+    /* window is mapped again on next render, with its contents */
+    if (!visible) {
+        XUnmapWindow(window->display, window->drawable);
+        XFlush(window->display);
+        window->mapped = false;
+        window->keysym = NoSymbol;
+    }
 }
 
 bool
@@ -209,14 +254,17 @@ bm_x11_window_create(struct window *window, Display *display)
     window->width = window->height = 1;
     window->monitor = -1;
 
+    if (!bm_cairo_thread_start(&window->thread))
+        return false;
+
     XSetWindowAttributes wa = {
         .override_redirect = True,
-        .event_mask = ExposureMask | KeyPressMask | VisibilityChangeMask
+        .event_mask = ExposureMask | KeyPressMask | ButtonPressMask | VisibilityChangeMask | StructureNotifyMask
     };
 
+    /* not mapped before first render, when its size is known */
     window->drawable = XCreateWindow(display, DefaultRootWindow(display), 0, 0, window->width, window->height, 0, DefaultDepth(display, window->screen), CopyFromParent, DefaultVisual(display, window->screen), CWOverrideRedirect | CWBackPixel | CWEventMask, &wa);
-    XSelectInput(display, window->drawable, ButtonPressMask | KeyPressMask);
-    XMapRaised(display, window->drawable);
+    window->visible = true;
     window->xim = XOpenIM(display, NULL, NULL, NULL);
     window->xic = XCreateIC(window->xim, XNInputStyle, XIMPreeditNothing | XIMStatusNothing, XNClientWindow, window->drawable, XNFocusWindow, window->drawable, NULL);
     return true;
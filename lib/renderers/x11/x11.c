@@ -3,8 +3,72 @@
 #include "xkb_unicode.h"
 
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
+#include <time.h>
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
+
+/**
+ * Milliseconds keyboard grab is retried, before giving up.
+ */
+static const uint32_t grab_timeout = 1000;
+
+/**
+ * Milliseconds between retries of keyboard grab, when no events arrive meanwhile.
+ */
+static const int32_t grab_retry_interval = 10;
+
+/**
+ * Most text read from a selection, in 32-bit units.
+ */
+static const long paste_max = 1 << 16;
+
+static uint64_t
+get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool
+try_grab_keyboard(struct x11 *x11)
+{
+    if (XGrabKeyboard(x11->display, DefaultRootWindow(x11->display), True, GrabModeAsync, GrabModeAsync, CurrentTime) != GrabSuccess)
+        return false;
+
+    x11->grab_pending = false;
+    return true;
+}
+
+/**
+ * Keep text of converted selection, so next poll_key returns it as paste.
+ */
+static void
+read_selection(struct x11 *x11, const XSelectionEvent *ev)
+{
+    if (ev->property == None)
+        return;
+
+    Atom type;
+    int format;
+    unsigned long nitems, after;
+    unsigned char *data = NULL;
+    if (XGetWindowProperty(x11->display, x11->window.drawable, ev->property, 0, paste_max, True, x11->utf8, &type, &format, &nitems, &after, &data) != Success)
+        return;
+
+    char *text;
+    if (type == x11->utf8 && format == 8 && nitems > 0 && (text = bm_malloc(BM_MEMORY_RENDER, nitems + 1))) {
+        memcpy(text, data, nitems);
+        text[nitems] = 0;
+        bm_free(x11->paste);
+        x11->paste = text;
+        x11->paste_ready = true;
+    }
+
+    if (data)
+        XFree(data);
+}
 
 static void
 render(const struct bm_menu *menu)
@@ -12,8 +76,23 @@ render(const struct bm_menu *menu)
     struct x11 *x11 = menu->renderer->internal;
 
     bm_x11_window_render(&x11->window, menu);
+
+    /* retried after render and on every event, so a keyboard grabbed elsewhere does not delay the first frame */
+    int32_t timeout = -1;
+    if (x11->grab_pending && !try_grab_keyboard(x11)) {
+        if (get_time_ms() >= x11->grab_deadline) {
+            fprintf(stderr, "x11: cannot grab keyboard\n");
+            x11->grab_pending = false;
+        } else {
+            timeout = grab_retry_interval;
+        }
+    }
+
     XFlush(x11->display);
 
+    if (!XPending(x11->display) && !bm_menu_wait_fd(menu, ConnectionNumber(x11->display), timeout))
+        return;
+
     XEvent ev;
     if (XNextEvent(x11->display, &ev) || XFilterEvent(&ev, x11->window.drawable))
         return;
@@ -23,7 +102,7 @@ render(const struct bm_menu *menu)
             bm_x11_window_key_press(&x11->window, &ev.xkey);
             break;
         case SelectionNotify:
-            // paste here
+            read_selection(x11, &ev.xselection);
             break;
         case VisibilityNotify:
             if (ev.xvisibility.state != VisibilityUnobscured) {
@@ -40,6 +119,11 @@ poll_key(const struct bm_menu *menu, unsigned int *unicode)
     struct x11 *x11 = menu->renderer->internal;
     assert(x11 && unicode);
 
+    if (x11->paste_ready) {
+        x11->paste_ready = false;
+        return BM_KEY_PASTE;
+    }
+
     if (x11->window.keysym == NoSymbol)
         return BM_KEY_UNICODE;
 
@@ -149,12 +233,37 @@ poll_key(const struct bm_menu *menu, unsigned int *unicode)
         case XK_m:
             return (mods & MOD_CTRL ? BM_KEY_RETURN : BM_KEY_UNICODE);
 
+        case XK_y:
+        case XK_Y:
+            if (!(mods & MOD_CTRL))
+                return BM_KEY_UNICODE;
+
+            /* atoms are interned on first paste, so they don't cost a roundtrip at startup */
+            if (!x11->utf8) {
+                Atom atoms[2];
+                XInternAtoms(x11->display, (char*[]){ "CLIPBOARD", "UTF8_STRING" }, 2, False, atoms);
+                x11->clipboard = atoms[0];
+                x11->utf8 = atoms[1];
+            }
+
+            /* text arrives with SelectionNotify, and is returned as paste then */
+            XConvertSelection(x11->display, (mods & MOD_SHIFT ? x11->clipboard : XA_PRIMARY), x11->utf8, x11->utf8, x11->window.drawable, CurrentTime);
+            return BM_KEY_NONE;
+
         default: break;
     }
 
     return BM_KEY_UNICODE;
 }
 
+static const char*
+get_paste(const struct bm_menu *menu)
+{
+    struct x11 *x11 = menu->renderer->internal;
+    assert(x11);
+    return x11->paste;
+}
+
 static uint32_t
 get_displayed_count(const struct bm_menu *menu)
 {
@@ -186,18 +295,23 @@ grab_keyboard(const struct bm_menu *menu, bool grab)
     assert(x11);
 
     if (grab) {
-        for (uint32_t i = 0; i < 1000; ++i) {
-            if (XGrabKeyboard(x11->display, DefaultRootWindow(x11->display), True, GrabModeAsync, GrabModeAsync, CurrentTime) == GrabSuccess)
-                return;
-            usleep(1000);
-        }
-
-        fprintf(stderr, "x11: cannot grab keyboard\n");
+        /* keyboard grabbed by another client is retried while rendering, instead of sleeping here */
+        x11->grab_pending = !try_grab_keyboard(x11);
+        x11->grab_deadline = get_time_ms() + grab_timeout;
     } else {
+        x11->grab_pending = false;
         XUngrabKeyboard(x11->display, CurrentTime);
     }
 }
 
+static void
+set_visible(const struct bm_menu *menu, bool visible)
+{
+    struct x11 *x11 = menu->renderer->internal;
+    assert(x11);
+    bm_x11_window_set_visible(&x11->window, visible);
+}
+
 static void
 destructor(struct bm_menu *menu)
 {
@@ -206,12 +320,16 @@ destructor(struct bm_menu *menu)
     if (!x11)
         return;
 
+    if (bm_cairo_thread_get_fd(&x11->window.thread) >= 0)
+        bm_menu_remove_watch_fd(menu, bm_cairo_thread_get_fd(&x11->window.thread));
+
     bm_x11_window_destroy(&x11->window);
 
     if (x11->display)
         XCloseDisplay(x11->display);
 
-    free(x11);
+    bm_free(x11->paste);
+    bm_free(x11);
     menu->renderer->internal = NULL;
 }
 
@@ -222,7 +340,7 @@ constructor(struct bm_menu *menu)
         return false;
 
     struct x11 *x11;
-    if (!(menu->renderer->internal = x11 = calloc(1, sizeof(struct x11))))
+    if (!(menu->renderer->internal = x11 = bm_calloc(BM_MEMORY_RENDER, 1, sizeof(struct x11))))
         goto fail;
 
     if (!(x11->display = XOpenDisplay(NULL)))
@@ -231,12 +349,14 @@ constructor(struct bm_menu *menu)
     if (!bm_x11_window_create(&x11->window, x11->display))
         goto fail;
 
+    /* painted frames wake up the menu loop, so they are shown without waiting for input */
+    if (!bm_menu_add_watch_fd(menu, bm_cairo_thread_get_fd(&x11->window.thread)))
+        goto fail;
+
     XSetClassHint(x11->window.display, x11->window.drawable, (XClassHint[]){{.res_name = (menu->title ? menu->title : "bemenu"), .res_class = "bemenu"}});
 
     x11->window.bottom = menu->bottom;
     bm_x11_window_set_monitor(&x11->window, menu->monitor);
-
-    x11->window.notify.render = bm_cairo_paint;
     return true;
 
 fail:
@@ -255,6 +375,8 @@ register_renderer(struct render_api *api)
     api->set_bottom = set_bottom;
     api->set_monitor = set_monitor;
     api->grab_keyboard = grab_keyboard;
+    api->set_visible = set_visible;
+    api->get_paste = get_paste;
     api->priorty = BM_PRIO_GUI;
     api->version = BM_PLUGIN_VERSION;
     return "x11";
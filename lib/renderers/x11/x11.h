@@ -4,7 +4,7 @@
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
 
-#include "renderers/cairo.h"
+#include "renderers/cairo_thread.h"
 
 enum mod_bit {
     MOD_SHIFT = 1<<0,
@@ -32,23 +32,56 @@ struct window {
     uint32_t x, y, width, height, max_height;
     uint32_t displayed;
 
+    /**
+     * Paints menu, newest frame is copied to buffer on every render.
+     */
+    struct cairo_thread thread;
+    const struct cairo_frame *frame;
+
+    /**
+     * Area of selected monitor, so moving window to bottom needs no queries.
+     */
+    struct {
+        int32_t x, y;
+        uint32_t width, height;
+    } area;
+
     uint32_t monitor;
     bool bottom;
 
-    struct {
-        void (*render)(struct cairo *cairo, uint32_t width, uint32_t max_height, const struct bm_menu *menu, struct cairo_paint_result *result);
-    } notify;
+    /**
+     * Window is mapped on first render, once its final size is known.
+     */
+    bool visible, mapped;
 };
 
 struct x11 {
     Display *display;
     struct window window;
+
+    /**
+     * Keyboard grab is retried while rendering until it succeeds, or deadline passes.
+     */
+    bool grab_pending;
+    uint64_t grab_deadline;
+
+    /**
+     * Atoms selections are converted with.
+     */
+    Atom clipboard, utf8;
+
+    /**
+     * Text of last converted selection, returned by next poll_key when paste_ready is set.
+     */
+    char *paste;
+    bool paste_ready;
 };
 
 void bm_x11_window_render(struct window *window, const struct bm_menu *menu);
 void bm_x11_window_key_press(struct window *window, XKeyEvent *ev);
 void bm_x11_window_set_monitor(struct window *window, uint32_t monitor);
 void bm_x11_window_set_bottom(struct window *window, bool bottom);
+void bm_x11_window_set_visible(struct window *window, bool visible);
 bool bm_x11_window_create(struct window *window, Display *display);
 void bm_x11_window_destroy(struct window *window);
 
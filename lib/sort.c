@@ -0,0 +1,356 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Results smaller than this are sorted on the calling thread only.
+ */
+static const uint32_t parallel_threshold = 1 << 16;
+
+/**
+ * Ties shorter than this are finished with insertion sort.
+ */
+static const uint32_t insertion_threshold = 32;
+
+/**
+ * Precomputed sort key, index of the item it belongs to and filter rank carried along.
+ */
+struct sort_entry {
+    uint64_t key;
+    uint32_t index;
+    uint8_t rank;
+};
+
+/**
+ * One slice of a radix pass, ran by a single thread.
+ */
+struct radix_job {
+    const struct sort_entry *src;
+    struct sort_entry *dst;
+    uint32_t begin, end;
+    uint32_t shift;
+    uint32_t histogram[256];
+};
+
+/**
+ * Pack up to 8 bytes of text into big endian integer, so that integer order matches byte order.
+ *
+ * @param text C "string" to pack, may be **NULL**.
+ * @return Packed key, shorter strings are padded with zeroes.
+ */
+static uint64_t
+prefix_key(const char *text)
+{
+    uint64_t key = 0;
+    for (uint32_t i = 0; i < 8; ++i) {
+        const uint8_t c = (text && *text ? (uint8_t)*text++ : 0);
+        key = (key << 8) | c;
+    }
+    return key;
+}
+
+static void
+radix_count(void *data, uint32_t begin, uint32_t end)
+{
+    for (struct radix_job *job = (struct radix_job*)data + begin; begin < end; ++begin, ++job) {
+        memset(job->histogram, 0, sizeof(job->histogram));
+
+        for (uint32_t i = job->begin; i < job->end; ++i)
+            job->histogram[(job->src[i].key >> job->shift) & 0xff]++;
+    }
+}
+
+static void
+radix_scatter(void *data, uint32_t begin, uint32_t end)
+{
+    for (struct radix_job *job = (struct radix_job*)data + begin; begin < end; ++begin, ++job) {
+        for (uint32_t i = job->begin; i < job->end; ++i) {
+            const struct sort_entry *entry = &job->src[i];
+            job->dst[job->histogram[(entry->key >> job->shift) & 0xff]++] = *entry;
+        }
+    }
+}
+
+/**
+ * Stable LSD radix sort over the 64-bit keys.
+ * Passes where every key shares the same digit are skipped.
+ *
+ * @param entries Entries to sort.
+ * @param scratch Scratch space for at least count entries.
+ * @param count Number of entries.
+ * @param jobs Job slots, one per thread.
+ * @param njobs Number of threads to use.
+ * @param pool bm_pool that runs the jobs, may be **NULL** for single job.
+ */
+static void
+radix_sort(struct sort_entry *entries, struct sort_entry *scratch, uint32_t count, struct radix_job *jobs, uint32_t njobs, struct bm_pool *pool)
+{
+    assert(entries && scratch && jobs && njobs > 0);
+
+    const uint32_t chunk = count / njobs;
+    struct sort_entry *src = entries, *dst = scratch;
+
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        for (uint32_t j = 0; j < njobs; ++j) {
+            jobs[j].src = src;
+            jobs[j].dst = dst;
+            jobs[j].shift = shift;
+            jobs[j].begin = j * chunk;
+            jobs[j].end = (j + 1 == njobs ? count : (j + 1) * chunk);
+        }
+
+        bm_pool_parallel_for(pool, njobs, 1, radix_count, jobs);
+
+        bool trivial = false;
+        uint32_t offset = 0;
+        for (uint32_t b = 0; b < 256 && !trivial; ++b) {
+            for (uint32_t j = 0; j < njobs; ++j) {
+                const uint32_t n = jobs[j].histogram[b];
+                jobs[j].histogram[b] = offset;
+                offset += n;
+            }
+            trivial = (offset - jobs[0].histogram[b] == count);
+        }
+
+        if (trivial)
+            continue;
+
+        bm_pool_parallel_for(pool, njobs, 1, radix_scatter, jobs);
+
+        struct sort_entry *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != entries)
+        memcpy(entries, src, sizeof(struct sort_entry) * count);
+}
+
+static void
+insertion_sort(struct bm_item **items, struct sort_entry *entries, uint32_t count, size_t depth)
+{
+    for (uint32_t i = 1; i < count; ++i) {
+        const struct sort_entry entry = entries[i];
+        uint32_t j = i;
+        for (; j > 0 && strcmp(bm_item_get_text(items[entries[j - 1].index]) + depth, bm_item_get_text(items[entry.index]) + depth) > 0; --j)
+            entries[j] = entries[j - 1];
+        entries[j] = entry;
+    }
+}
+
+/**
+ * Resolve ties left by lexicographic prefix keys.
+ * Runs of equal keys whose strings continue past the packed bytes are sorted again by the next 8 bytes.
+ *
+ * @param items Array of bm_item pointers the entries refer to.
+ * @param entries Entries sorted by key packed from depth.
+ * @param scratch Scratch space for at least count entries.
+ * @param count Number of entries.
+ * @param depth Byte offset the current keys were packed from.
+ * @param jobs Job slot for the serial radix passes.
+ */
+static void
+refine_ties(struct bm_item **items, struct sort_entry *entries, struct sort_entry *scratch, uint32_t count, size_t depth, struct radix_job *jobs)
+{
+    for (uint32_t i = 0, j; i < count; i = j) {
+        for (j = i + 1; j < count && entries[j].key == entries[i].key; ++j);
+
+        /* last packed byte is zero when the string ended, thus equal keys are equal strings */
+        if (j - i < 2 || !(entries[i].key & 0xff))
+            continue;
+
+        if (j - i < insertion_threshold) {
+            insertion_sort(items, entries + i, j - i, depth + 8);
+            continue;
+        }
+
+        for (uint32_t k = i; k < j; ++k)
+            entries[k].key = prefix_key(bm_item_get_text(items[entries[k].index]) + depth + 8);
+
+        radix_sort(entries + i, scratch + i, j - i, jobs, 1, NULL);
+        refine_ties(items, entries + i, scratch + i, j - i, depth + 8, jobs);
+    }
+}
+
+static uint32_t
+get_thread_count(uint32_t count, const struct bm_pool *pool)
+{
+    if (count < parallel_threshold)
+        return 1;
+
+    return bm_pool_get_thread_count(pool);
+}
+
+/**
+ * Sort list of item indices stably.
+ *
+ * Keys are computed once per item and sorted with LSD radix sort.
+ * Large lists are counted and scattered in parallel.
+ *
+ * @param items Array of bm_item pointers the indices refer to.
+ * @param indices Array of item indices to sort in place.
+ * @param ranks Filter ranks of indices, reordered along with them. May be **NULL**.
+ * @param count Number of indices in array.
+ * @param mode bm_sort_mode constant, BM_SORT_MODE_NONE is no-op.
+ * @param pool bm_pool used for large lists, may be **NULL**.
+ * @return true on success, false if out of memory.
+ */
+bool
+bm_sort_items(struct bm_item **items, uint32_t *indices, uint8_t *ranks, uint32_t count, enum bm_sort_mode mode, struct bm_pool *pool)
+{
+    if (mode == BM_SORT_MODE_NONE || mode >= BM_SORT_MODE_LAST || count < 2)
+        return true;
+
+    assert(items && indices);
+
+    struct radix_job *jobs = NULL;
+    struct sort_entry *entries = NULL;
+    if (!(entries = bm_calloc(BM_MEMORY_FILTER, count, sizeof(struct sort_entry) * 2)))
+        goto fail;
+
+    const uint32_t njobs = get_thread_count(count, pool);
+    if (!(jobs = bm_calloc(BM_MEMORY_FILTER, njobs, sizeof(struct radix_job))))
+        goto fail;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct bm_item *item = items[indices[i]];
+        entries[i].index = indices[i];
+        entries[i].rank = (ranks ? ranks[i] : 0);
+
+        switch (mode) {
+            case BM_SORT_MODE_LENGTH:
+                entries[i].key = item->len;
+                break;
+            case BM_SORT_MODE_ALPHABETICAL:
+                entries[i].key = prefix_key(bm_item_get_text(item));
+                break;
+            case BM_SORT_MODE_KEY:
+                entries[i].key = item->sort_key;
+                break;
+            default: break;
+        }
+    }
+
+    struct sort_entry *scratch = entries + count;
+    radix_sort(entries, scratch, count, jobs, njobs, pool);
+
+    if (mode == BM_SORT_MODE_ALPHABETICAL)
+        refine_ties(items, entries, scratch, count, 0, jobs);
+
+    for (uint32_t i = 0; i < count; ++i)
+        indices[i] = entries[i].index;
+
+    if (ranks) {
+        for (uint32_t i = 0; i < count; ++i)
+            ranks[i] = entries[i].rank;
+    }
+
+    bm_free(jobs);
+    bm_free(entries);
+    return true;
+
+fail:
+    bm_free(jobs);
+    bm_free(entries);
+    return false;
+}
+
+/**
+ * Compare items the way stable sort of rank grouped filter results orders them:
+ * by sort key first, then by filter rank.
+ *
+ * @return Negative, zero or positive like strcmp.
+ */
+static int
+compare_items(const struct bm_item *a, uint8_t a_rank, const struct bm_item *b, uint8_t b_rank, enum bm_sort_mode mode)
+{
+    switch (mode) {
+        case BM_SORT_MODE_LENGTH:
+            if (a->len != b->len)
+                return (a->len < b->len ? -1 : 1);
+            break;
+        case BM_SORT_MODE_ALPHABETICAL: {
+            const char *a_text = bm_item_get_text(a), *b_text = bm_item_get_text(b);
+            const int cmp = strcmp((a_text ? a_text : ""), (b_text ? b_text : ""));
+            if (cmp)
+                return cmp;
+            break;
+        }
+        case BM_SORT_MODE_KEY:
+            if (a->sort_key != b->sort_key)
+                return (a->sort_key < b->sort_key ? -1 : 1);
+            break;
+        default: break;
+    }
+
+    return (int)a_rank - (int)b_rank;
+}
+
+/**
+ * Merge two sorted filter results.
+ *
+ * Both lists must be ordered as bm_sort_items leaves rank grouped filter results,
+ * and every index of a must be smaller than indices of b, so that a comes first on ties.
+ * The result is then the same as filtering and sorting both lists at once.
+ *
+ * @param items Array of bm_item pointers the indices refer to.
+ * @param a First list of item indices.
+ * @param a_ranks Filter ranks of a.
+ * @param a_count Number of indices in a.
+ * @param b Second list of item indices.
+ * @param b_ranks Filter ranks of b.
+ * @param b_count Number of indices in b.
+ * @param mode bm_sort_mode the lists are sorted with.
+ * @param out_ranks Reference to array where ranks of merged list are stored.
+ * @return Merged list of item indices, **NULL** if out of memory.
+ */
+uint32_t*
+bm_sort_merge(struct bm_item **items, const uint32_t *a, const uint8_t *a_ranks, uint32_t a_count, const uint32_t *b, const uint8_t *b_ranks, uint32_t b_count, enum bm_sort_mode mode, uint8_t **out_ranks)
+{
+    assert(items && out_ranks);
+    assert((a && a_ranks) || !a_count);
+    assert((b && b_ranks) || !b_count);
+    *out_ranks = NULL;
+
+    const uint32_t count = a_count + b_count;
+
+    uint8_t *ranks = NULL;
+    uint32_t *indices = NULL;
+    if (!(indices = bm_calloc(BM_MEMORY_FILTER, count, sizeof(uint32_t))))
+        goto fail;
+
+    if (!(ranks = bm_malloc(BM_MEMORY_FILTER, count)))
+        goto fail;
+
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < a_count && j < b_count) {
+        if (compare_items(items[a[i]], a_ranks[i], items[b[j]], b_ranks[j], mode) <= 0) {
+            ranks[n] = a_ranks[i];
+            indices[n++] = a[i++];
+        } else {
+            ranks[n] = b_ranks[j];
+            indices[n++] = b[j++];
+        }
+    }
+
+    for (; i < a_count; ++i, ++n) {
+        ranks[n] = a_ranks[i];
+        indices[n] = a[i];
+    }
+
+    for (; j < b_count; ++j, ++n) {
+        ranks[n] = b_ranks[j];
+        indices[n] = b[j];
+    }
+
+    *out_ranks = ranks;
+    return indices;
+
+fail:
+    bm_free(indices);
+    bm_free(ranks);
+    return NULL;
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
@@ -0,0 +1,525 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+/**
+ * Most characters filtered ahead.
+ */
+#define MAX_SPECULATIONS 8
+
+/**
+ * Entries of base results filtered between checks for cancellation.
+ */
+static const uint32_t speculation_chunk = 1 << 14;
+
+/**
+ * Most base results sampled for character statistics.
+ */
+static const uint32_t speculation_samples = 1 << 14;
+
+/**
+ * Results of filter text extended with one likely character.
+ */
+struct speculation {
+    /**
+     * Copy of speculated menu with the extended filter, filters only read from menu.
+     */
+    struct bm_menu menu;
+
+    /**
+     * Extended filter text.
+     */
+    char *filter;
+
+    /**
+     * Filtered and sorted item indices and their ranks, valid once done is set.
+     */
+    uint32_t *indices;
+    uint8_t *ranks;
+    uint32_t count;
+    bool done;
+};
+
+struct bm_speculation {
+    /**
+     * Number of characters filtered ahead.
+     */
+    uint32_t max;
+
+    /**
+     * Filter of speculated menu, pool it runs on and group that is joined to wait for it.
+     */
+    bm_filter_fun filter;
+    struct bm_pool *pool;
+    struct bm_pool_group group;
+
+    /**
+     * Filter text that results were speculated from, **NULL** if nothing is speculated.
+     */
+    char *base;
+    size_t base_len;
+
+    /**
+     * Results of base, **NULL** when base is empty and all items are filtered.
+     * Borrowed from menu, which cancels speculation before changing them.
+     */
+    const uint32_t *source;
+    uint32_t source_count;
+
+    /**
+     * Properties of menu results were speculated with.
+     */
+    struct bm_menu menu;
+
+    struct speculation speculations[MAX_SPECULATIONS];
+    uint32_t count;
+
+    /**
+     * Has base been planned, with count speculations spawned?
+     */
+    bool planned;
+
+    /**
+     * Is work spawned to pool that has not been joined?
+     */
+    bool running;
+
+    /**
+     * Set by input thread to stop spawned work early.
+     */
+    bool cancel;
+
+    struct bm_speculation_stats stats;
+};
+
+static bool
+is_cancelled(const struct bm_speculation *spec)
+{
+    return __atomic_load_n(&spec->cancel, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Filters other than dmenu and path fold case, so speculated characters are folded as well.
+ */
+static bool
+is_case_insensitive(enum bm_filter_mode mode)
+{
+    return (mode != BM_FILTER_MODE_DMENU && mode != BM_FILTER_MODE_PATH);
+}
+
+static unsigned char
+fold(const struct bm_speculation *spec, unsigned char c)
+{
+    return (is_case_insensitive(spec->menu.filter_mode) ? tolower(c) : c);
+}
+
+/**
+ * Filter base results with one extended filter, in chunks so cancellation is noticed quickly.
+ */
+static void
+speculate(void *data, uint32_t begin, uint32_t end)
+{
+    struct bm_speculation *spec = data;
+
+    for (uint32_t s = begin; s < end; ++s) {
+        struct speculation *speculation = &spec->speculations[s];
+
+        uint32_t n = 0;
+        if (!(speculation->indices = bm_calloc(BM_MEMORY_FILTER, spec->source_count, sizeof(uint32_t))))
+            goto fail;
+
+        if (!(speculation->ranks = bm_calloc(BM_MEMORY_FILTER, spec->source_count, sizeof(uint8_t))))
+            goto fail;
+
+        for (uint32_t first = 0; first < spec->source_count; first += speculation_chunk) {
+            if (is_cancelled(spec))
+                goto fail;
+
+            const uint32_t last = (spec->source_count - first > speculation_chunk ? first + speculation_chunk : spec->source_count);
+
+            uint8_t *ranks;
+            uint32_t count;
+            uint32_t *filtered = spec->filter(&speculation->menu, spec->source, first, last, &ranks, &count);
+
+            if (count > 0 && (!filtered || !ranks)) {
+                bm_free(filtered);
+                bm_free(ranks);
+                goto fail;
+            }
+
+            memcpy(speculation->indices + n, filtered, sizeof(uint32_t) * count);
+            memcpy(speculation->ranks + n, ranks, count);
+            n += count;
+            bm_free(filtered);
+            bm_free(ranks);
+        }
+
+        /* chunks of narrowed down results follow previous ranks, put them back to item order for ties */
+        if (spec->source && n > 1 && !bm_filter_sort_by_index(speculation->indices, speculation->ranks, n))
+            goto fail;
+
+        /* every chunk is grouped by rank, so group them again as if filtered at once */
+        if (!bm_filter_group_by_rank(&speculation->indices, speculation->ranks, n, 256))
+            goto fail;
+
+        if (is_cancelled(spec))
+            goto fail;
+
+        if (!bm_sort_items((struct bm_item**)spec->menu.items.items, speculation->indices, speculation->ranks, n, spec->menu.sort_mode, NULL))
+            goto fail;
+
+        speculation->count = n;
+        speculation->done = true;
+        continue;
+
+fail:
+        bm_free(speculation->indices);
+        bm_free(speculation->ranks);
+        speculation->indices = NULL;
+        speculation->ranks = NULL;
+    }
+}
+
+/**
+ * Pick most likely next characters from characters following the last token of filter in base results,
+ * and spawn a filter for each.
+ */
+static void
+plan(void *data, uint32_t begin, uint32_t end)
+{
+    (void)begin, (void)end;
+    struct bm_speculation *spec = data;
+
+    if (is_cancelled(spec))
+        return;
+
+    /* when a token is about to start, any character of results may follow */
+    const char *token = spec->base + spec->base_len;
+    while (token > spec->base && token[-1] != ' ')
+        --token;
+
+    const size_t token_len = spec->base + spec->base_len - token;
+    char* (*fstrstr)(const char*, size_t, const char*, size_t) = (is_case_insensitive(spec->menu.filter_mode) ? bm_strnupstr : bm_strnstr);
+
+    uint32_t counts[128] = {0};
+    const struct bm_item_store *store = &spec->menu.store;
+
+    struct bm_pack_reader reader;
+    bm_pack_reader_init(&reader, store->pack);
+
+    const uint32_t stride = (spec->source_count > speculation_samples ? spec->source_count / speculation_samples : 1);
+    for (uint32_t i = 0; i < spec->source_count; i += stride) {
+        const uint32_t index = (spec->source ? spec->source[i] : i);
+        const char *text = (store->pack ? bm_pack_read(&reader, index, NULL) : store->text[index]);
+        if (!text)
+            continue;
+
+        if (!token_len) {
+            for (uint32_t j = 0; j < store->len[index]; ++j) {
+                const unsigned char c = fold(spec, text[j]);
+                if (c > ' ' && c < 127)
+                    counts[c]++;
+            }
+            continue;
+        }
+
+        const char *hit;
+        if (!(hit = fstrstr(text, store->len[index], token, token_len)))
+            continue;
+
+        if (hit + token_len >= text + store->len[index])
+            continue;
+
+        const unsigned char c = fold(spec, hit[token_len]);
+        if (c > ' ' && c < 127)
+            counts[c]++;
+    }
+
+    for (spec->count = 0; spec->count < spec->max; ++spec->count) {
+        unsigned char best = 0;
+        for (unsigned char c = '!'; c < 127; ++c) {
+            if (counts[c] > counts[best])
+                best = c;
+        }
+
+        if (!counts[best])
+            break;
+
+        counts[best] = 0;
+
+        struct speculation *speculation = &spec->speculations[spec->count];
+        if (!(speculation->filter = bm_malloc(BM_MEMORY_FILTER, spec->base_len + 2)))
+            break;
+
+        memcpy(speculation->filter, spec->base, spec->base_len);
+        speculation->filter[spec->base_len] = best;
+        speculation->filter[spec->base_len + 1] = 0;
+
+        speculation->menu = spec->menu;
+        speculation->menu.filter = speculation->filter;
+    }
+
+    spec->planned = true;
+
+    for (uint32_t s = 0; s < spec->count; ++s)
+        bm_pool_spawn(spec->pool, &spec->group, speculate, spec, s, s + 1);
+}
+
+/**
+ * Release results and forget what was speculated.
+ */
+static void
+discard(struct bm_speculation *spec)
+{
+    assert(!spec->running);
+
+    for (uint32_t s = 0; s < spec->count; ++s) {
+        bm_free(spec->speculations[s].filter);
+        bm_free(spec->speculations[s].indices);
+        bm_free(spec->speculations[s].ranks);
+        memset(&spec->speculations[s], 0, sizeof(struct speculation));
+    }
+
+    bm_free(spec->base);
+    spec->base = NULL;
+    spec->base_len = 0;
+    spec->source = NULL;
+    spec->source_count = 0;
+    spec->count = 0;
+    spec->planned = false;
+}
+
+/**
+ * Did speculation finish before it was cancelled?
+ */
+static bool
+is_complete(const struct bm_speculation *spec)
+{
+    if (!spec->planned)
+        return false;
+
+    for (uint32_t s = 0; s < spec->count; ++s) {
+        if (!spec->speculations[s].done)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Create speculative filter.
+ *
+ * @param max Number of likely next characters filtered ahead.
+ * @return bm_speculation for success, **NULL** on failure.
+ */
+struct bm_speculation*
+bm_speculation_new(uint32_t max)
+{
+    struct bm_speculation *spec;
+    if (!(spec = bm_calloc(BM_MEMORY_FILTER, 1, sizeof(struct bm_speculation))))
+        return NULL;
+
+    spec->max = (max > MAX_SPECULATIONS ? MAX_SPECULATIONS : max);
+    return spec;
+}
+
+/**
+ * Cancel running speculation and release speculative filter.
+ *
+ * @param spec bm_speculation to free, may be **NULL**.
+ */
+void
+bm_speculation_free(struct bm_speculation *spec)
+{
+    if (!spec)
+        return;
+
+    bm_speculation_cancel(spec);
+    discard(spec);
+    bm_free(spec);
+}
+
+/**
+ * Get number of likely next characters filtered ahead.
+ *
+ * @param spec bm_speculation to query, may be **NULL**.
+ * @return Number of characters, 0 for **NULL**.
+ */
+uint32_t
+bm_speculation_get_max(const struct bm_speculation *spec)
+{
+    return (spec ? spec->max : 0);
+}
+
+/**
+ * Stop spawned work and wait for it.
+ * Results finished so far are kept, until menu filters again.
+ *
+ * @param spec bm_speculation to cancel, may be **NULL**.
+ */
+void
+bm_speculation_cancel(struct bm_speculation *spec)
+{
+    if (!spec || !spec->running)
+        return;
+
+    __atomic_store_n(&spec->cancel, true, __ATOMIC_RELEASE);
+    bm_pool_join(spec->pool, &spec->group);
+    spec->running = false;
+
+    spec->stats.cancelled += !is_complete(spec);
+    for (uint32_t s = 0; s < spec->count; ++s)
+        spec->stats.computed += spec->speculations[s].done;
+}
+
+/**
+ * Cancel running speculation and release its results.
+ * Used when items change, so results speculated from them are never taken.
+ *
+ * @param spec bm_speculation to reset, may be **NULL**.
+ */
+void
+bm_speculation_reset(struct bm_speculation *spec)
+{
+    if (!spec)
+        return;
+
+    bm_speculation_cancel(spec);
+    discard(spec);
+}
+
+/**
+ * Start filtering current results ahead with likely next characters, if not done already.
+ * Work runs on threads of the menu's pool, and is only started when results of current filter are known.
+ *
+ * @param spec bm_speculation to start.
+ * @param menu bm_menu whose results are filtered ahead.
+ * @param filter Filter function of the menu's filter mode.
+ */
+void
+bm_speculation_start(struct bm_speculation *spec, struct bm_menu *menu, bm_filter_fun filter)
+{
+    assert(spec && menu && filter);
+
+    const char *base = (menu->filter ? menu->filter : "");
+    if (spec->base && !strcmp(spec->base, base) && spec->menu.items.count == menu->items.count && spec->menu.filter_mode == menu->filter_mode && spec->menu.sort_mode == menu->sort_mode) {
+        if (spec->running || is_complete(spec))
+            return;
+    }
+
+    bm_speculation_cancel(spec);
+    discard(spec);
+
+    /* fuzzy filter continues from match progress kept in menu, which filtering ahead would overwrite */
+    if (!spec->max || menu->filter_mode == BM_FILTER_MODE_FUZZY || bm_pool_get_thread_count(menu->pool) < 2)
+        return;
+
+    /* store is only built by filtering, so before first filter nothing can be speculated */
+    if (!bm_item_store_is_valid(&menu->store, menu->items.count) || !menu->items.count)
+        return;
+
+    if (*base) {
+        /* results must belong to current filter, and an appended character can't match more */
+        if (!menu->old_filter || strcmp(menu->old_filter, base) || !menu->filtered.count)
+            return;
+
+        spec->source = menu->filtered.indices;
+        spec->source_count = menu->filtered.count;
+    } else {
+        spec->source = NULL;
+        spec->source_count = menu->items.count;
+    }
+
+    /* bm_strdup gives no copy of empty filter, which is speculated from as well */
+    spec->base_len = strlen(base);
+    if (!(spec->base = bm_malloc(BM_MEMORY_FILTER, spec->base_len + 1)))
+        return;
+
+    memcpy(spec->base, base, spec->base_len + 1);
+    spec->filter = filter;
+    spec->pool = menu->pool;
+    spec->menu = *menu;
+
+    /* speculative filters run on pool threads, so they don't split their work further, nor touch token cache */
+    spec->menu.pool = NULL;
+    spec->menu.tokens = NULL;
+
+    spec->group = (struct bm_pool_group){0};
+    spec->cancel = false;
+    spec->running = true;
+    spec->stats.started++;
+    bm_pool_spawn(spec->pool, &spec->group, plan, spec, 0, 1);
+}
+
+/**
+ * Take results for current filter of menu, if they were filtered ahead.
+ * Running speculation is cancelled, and other results are released.
+ *
+ * @param spec bm_speculation to take results from, may be **NULL**.
+ * @param menu bm_menu whose old filter results were speculated from.
+ * @param out_indices Reference to array of sorted item indices.
+ * @param out_ranks Reference to array of their filter ranks.
+ * @param out_count Reference to number of indices.
+ * @return true if results were taken, false if menu has to filter.
+ */
+bool
+bm_speculation_take(struct bm_speculation *spec, struct bm_menu *menu, uint32_t **out_indices, uint8_t **out_ranks, uint32_t *out_count)
+{
+    assert(menu && out_indices && out_ranks && out_count);
+    *out_indices = NULL;
+    *out_ranks = NULL;
+    *out_count = 0;
+
+    if (!spec)
+        return false;
+
+    bm_speculation_cancel(spec);
+
+    const char *old = (menu->old_filter ? menu->old_filter : "");
+    const char *filter = (menu->filter ? menu->filter : "");
+    if (!spec->base || strcmp(spec->base, old) || spec->menu.items.count != menu->items.count ||
+        spec->menu.filter_mode != menu->filter_mode || spec->menu.sort_mode != menu->sort_mode ||
+        !bm_item_store_is_valid(&menu->store, menu->items.count)) {
+        discard(spec);
+        return false;
+    }
+
+    /* only appended characters are predicted, so other edits don't count as misses */
+    const bool appended = (strlen(filter) == spec->base_len + 1 && !strncmp(filter, spec->base, spec->base_len));
+
+    for (uint32_t s = 0; appended && s < spec->count; ++s) {
+        struct speculation *speculation = &spec->speculations[s];
+        if (!speculation->done || fold(spec, filter[spec->base_len]) != (unsigned char)speculation->filter[spec->base_len])
+            continue;
+
+        *out_indices = speculation->indices;
+        *out_ranks = speculation->ranks;
+        *out_count = speculation->count;
+        speculation->indices = NULL;
+        speculation->ranks = NULL;
+        spec->stats.hits++;
+        discard(spec);
+        return true;
+    }
+
+    spec->stats.misses += appended;
+    discard(spec);
+    return false;
+}
+
+/**
+ * Get counters of speculative filter.
+ *
+ * @param spec bm_speculation to query, may be **NULL**.
+ * @param out_stats Reference to bm_speculation_stats where counters are stored, zeroed for **NULL**.
+ */
+void
+bm_speculation_get_stats(const struct bm_speculation *spec, struct bm_speculation_stats *out_stats)
+{
+    assert(out_stats);
+    *out_stats = (spec ? spec->stats : (struct bm_speculation_stats){0});
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
@@ -0,0 +1,395 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+/**
+ * Bit for character in signature.
+ * Letters and digits get their own bits, everything else shares the rest.
+ */
+static uint64_t
+signature_bit(unsigned char c)
+{
+    c = toupper(c);
+
+    if (c >= 'A' && c <= 'Z')
+        return (uint64_t)1 << (c - 'A');
+
+    if (c >= '0' && c <= '9')
+        return (uint64_t)1 << (26 + c - '0');
+
+    return (uint64_t)1 << (36 + c % 28);
+}
+
+/**
+ * Compute character signature of text.
+ * Signature is case folded, so it is a valid prefilter for both case sensitive and insensitive matching.
+ *
+ * @param text Text to compute signature for, does not need to be null terminated.
+ * @param len Length of text in bytes.
+ * @return Bit set of characters present in text.
+ */
+uint64_t
+bm_signature(const char *text, size_t len)
+{
+    uint64_t signature = 0;
+    for (size_t i = 0; i < len; ++i)
+        signature |= signature_bit(text[i]);
+    return signature;
+}
+
+/**
+ * Compute case folded hash of text.
+ *
+ * @param text Text to hash, does not need to be null terminated.
+ * @param len Length of text in bytes.
+ * @return 64-bit FNV-1a hash of upper cased text.
+ */
+uint64_t
+bm_hash(const char *text, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ (unsigned char)toupper((unsigned char)text[i])) * 0x100000001b3;
+    return hash;
+}
+
+static bool
+is_valid_utf8(const char *text, size_t len)
+{
+    const unsigned char *s = (const unsigned char*)text;
+    for (size_t i = 0; i < len;) {
+        size_t n;
+        if (s[i] < 0x80) {
+            n = 0;
+        } else if ((s[i] & 0xe0) == 0xc0 && s[i] >= 0xc2) {
+            n = 1;
+        } else if ((s[i] & 0xf0) == 0xe0) {
+            n = 2;
+        } else if ((s[i] & 0xf8) == 0xf0 && s[i] <= 0xf4) {
+            n = 3;
+        } else {
+            return false;
+        }
+
+        if (len - i <= n)
+            return false;
+
+        for (size_t j = 1; j <= n; ++j) {
+            if ((s[i + j] & 0xc0) != 0x80)
+                return false;
+        }
+
+        i += n + 1;
+    }
+
+    return true;
+}
+
+static bool
+is_word_byte(unsigned char c)
+{
+    return (isalnum(c) || c >= 0x80);
+}
+
+/**
+ * Does word start at byte i of text?
+ * Words are separated by non-alphanumeric bytes, lower to upper case and letter to digit boundaries.
+ * Upper case letter followed by lower case letter also starts a word, so `XMLHttp` is `XML` `Http`.
+ */
+static bool
+is_word_start(const unsigned char *text, uint32_t len, uint32_t i)
+{
+    const unsigned char c = text[i];
+    if (!is_word_byte(c) || (c & 0xc0) == 0x80)
+        return false;
+
+    if (i == 0 || !is_word_byte(text[i - 1]))
+        return true;
+
+    const unsigned char p = text[i - 1];
+    if (p >= 0x80 || c >= 0x80)
+        return false;
+
+    if (!isdigit(c) != !isdigit(p))
+        return true;
+
+    if (isupper(c) && islower(p))
+        return true;
+
+    return (isupper(c) && isupper(p) && i + 1 < len && islower(text[i + 1]));
+}
+
+/**
+ * Offset of last path component, trailing slash is not considered a separator.
+ */
+static uint32_t
+basename_offset(const char *text, uint32_t len)
+{
+    uint32_t i = (len > 0 && text[len - 1] == '/' ? len - 1 : len);
+    for (; i > 0 && text[i - 1] != '/'; --i);
+    return i;
+}
+
+static bool
+store_grow(struct bm_item_store *store, uint32_t nmemb)
+{
+    if (nmemb <= store->allocated)
+        return true;
+
+    /* grow geometrically, so items streamed in are not copied over and over */
+    if (store->allocated > 0 && nmemb < store->allocated * 2)
+        nmemb = (store->allocated * 2 < store->allocated ? UINT32_MAX : store->allocated * 2);
+
+    void *tmp;
+    if (!store->pack) {
+        if (!(tmp = bm_realloc(BM_MEMORY_FILTER, store->text, sizeof(const char*) * nmemb)))
+            return false;
+        store->text = tmp;
+    }
+
+    if (!(tmp = bm_realloc(BM_MEMORY_FILTER, store->len, sizeof(uint32_t) * nmemb)))
+        return false;
+    store->len = tmp;
+
+    if (!(tmp = bm_realloc(BM_MEMORY_FILTER, store->hash, sizeof(uint64_t) * nmemb)))
+        return false;
+    store->hash = tmp;
+
+    if (!(tmp = bm_realloc(BM_MEMORY_FILTER, store->signature, sizeof(uint64_t) * nmemb)))
+        return false;
+    store->signature = tmp;
+
+    if (!(tmp = bm_realloc(BM_MEMORY_FILTER, store->basename, sizeof(uint32_t) * nmemb)))
+        return false;
+    store->basename = tmp;
+
+    if (!(tmp = bm_realloc(BM_MEMORY_FILTER, store->flags, sizeof(uint8_t) * nmemb)))
+        return false;
+    store->flags = tmp;
+
+    store->allocated = nmemb;
+    return true;
+}
+
+/**
+ * Items hashed by a single task of parallel store build.
+ */
+static const uint32_t build_grain = 1 << 14;
+
+struct build_job {
+    struct bm_item_store *store;
+    struct bm_item **items;
+
+    /**
+     * Index of first item built, ranges are relative to it.
+     */
+    uint32_t first;
+};
+
+static void
+build_range(void *data, uint32_t begin, uint32_t end)
+{
+    struct build_job *job = data;
+    struct bm_item_store *store = job->store;
+
+    struct bm_pack_reader reader;
+    bm_pack_reader_init(&reader, store->pack);
+
+    for (uint32_t i = job->first + begin; i < job->first + end; ++i) {
+        const struct bm_item *item = job->items[i];
+
+        /* packed items are packed in item order, and match their whole text */
+        if (store->pack) {
+            const char *text = bm_pack_read(&reader, i, &store->len[i]);
+            store->hash[i] = bm_hash(text, store->len[i]);
+            store->signature[i] = bm_signature(text, store->len[i]);
+            store->basename[i] = basename_offset(text, store->len[i]);
+            store->flags[i] = (!is_valid_utf8(text, store->len[i]) ? BM_ITEM_FLAG_INVALID_UTF8 : 0);
+            continue;
+        }
+
+        const char *text = (item->text ? item->text + item->match.offset : NULL);
+        store->text[i] = text;
+        store->len[i] = (text ? item->match.len : 0);
+        store->hash[i] = bm_hash(text, store->len[i]);
+        store->signature[i] = bm_signature(text, store->len[i]);
+        store->basename[i] = basename_offset(text, store->len[i]);
+        store->flags[i] = (item->text && !is_valid_utf8(item->text, item->len) ? BM_ITEM_FLAG_INVALID_UTF8 : 0);
+    }
+}
+
+/**
+ * Rebuild item store from items.
+ * If store is valid and items were only appended since, just the appended items are added.
+ * Store with pack set reads texts of packed items from it, instead of keeping pointers to their text.
+ *
+ * @param store bm_item_store to rebuild.
+ * @param items Array of bm_item pointers the store describes.
+ * @param count Number of items in array.
+ * @param pool bm_pool that builds large stores in parallel, may be **NULL**.
+ * @return true on success, false if out of memory and store was left invalid.
+ */
+bool
+bm_item_store_build(struct bm_item_store *store, struct bm_item **items, uint32_t count, struct bm_pool *pool)
+{
+    assert(store && !store->shared);
+
+    const uint32_t first = (store->valid && store->count <= count ? store->count : 0);
+    store->valid = false;
+
+    if (!store_grow(store, count))
+        return false;
+
+    struct build_job job = { store, items, first };
+    bm_pool_parallel_for(pool, count - first, build_grain, build_range, &job);
+
+    if (first == 0)
+        store->initials_count = 0;
+
+    /* stores are built on any thread, corpora even before a menu exists */
+    static uint64_t generations = 0;
+    store->generation = __atomic_add_fetch(&generations, 1, __ATOMIC_RELAXED);
+
+    store->count = count;
+    return (store->valid = true);
+}
+
+/**
+ * Find first characters of words in text.
+ * ASCII letters are upper cased.
+ *
+ * @param text Text to find initials of, does not need to be null terminated.
+ * @param len Length of text in bytes.
+ * @param out_initials Array of at least len code points where initials are stored.
+ * @return Number of initials.
+ */
+uint32_t
+bm_initials(const char *text, uint32_t len, uint32_t *out_initials)
+{
+    assert(text || len == 0);
+
+    uint32_t n = 0;
+    for (uint32_t j = 0; j < len; ++j) {
+        if (!is_word_start((const unsigned char*)text, len, j))
+            continue;
+
+        /* whole rune is kept, many characters share their lead byte */
+        size_t u8len;
+        const uint32_t rune = bm_utf8_rune_decode(text + j, len - j, &u8len);
+        out_initials[n++] = (rune < 0x80 ? (uint32_t)toupper(rune) : rune);
+    }
+
+    return n;
+}
+
+/**
+ * Build word initials of valid item store, if not already built.
+ * Initials of items appended since the last build are added to the existing ones.
+ *
+ * @param store bm_item_store to build initials for.
+ * @return true on success, false if out of memory.
+ */
+bool
+bm_item_store_build_initials(struct bm_item_store *store)
+{
+    assert(store && store->valid);
+
+    if (store->pack || (store->initials_count == store->count && store->initials_offset))
+        return true;
+
+    void *tmp;
+    if (!(tmp = bm_realloc(BM_MEMORY_FILTER, store->initials_offset, sizeof(uint32_t) * (store->allocated + 1))))
+        return false;
+    store->initials_offset = tmp;
+
+    size_t n = (store->initials_count > 0 ? store->initials_len : 0);
+    for (uint32_t i = store->initials_count; i < store->count; ++i) {
+        store->initials_offset[i] = n;
+
+        /* every byte may start a word */
+        if (store->initials_allocated - n < store->len[i]) {
+            size_t nsize = (store->initials_allocated ? store->initials_allocated * 2 : 1024);
+            for (; nsize - n < store->len[i]; nsize *= 2);
+
+            if (!(tmp = bm_realloc(BM_MEMORY_FILTER, store->initials, sizeof(uint32_t) * nsize)))
+                return false;
+            store->initials = tmp;
+            store->initials_allocated = nsize;
+        }
+
+        n += bm_initials(store->text[i], store->len[i], store->initials + n);
+    }
+
+    store->initials_offset[store->count] = store->initials_len = n;
+    store->initials_count = store->count;
+    return true;
+}
+
+/**
+ * Check whether item store still describes the items.
+ *
+ * @param store bm_item_store to check.
+ * @param count Number of items currently in menu.
+ * @return true if store can be used as is.
+ */
+bool
+bm_item_store_is_valid(const struct bm_item_store *store, uint32_t count)
+{
+    assert(store);
+    return (store->valid && store->count == count);
+}
+
+/**
+ * Share item store of corpus, borrowing all arrays but flags.
+ *
+ * @param store bm_item_store to set up, must be released.
+ * @param corpus bm_item_store of corpus to share.
+ * @return true on success, false if out of memory.
+ */
+bool
+bm_item_store_share(struct bm_item_store *store, const struct bm_item_store *corpus)
+{
+    assert(store && corpus && corpus->valid && (corpus->pack || corpus->initials_count == corpus->count));
+
+    uint8_t *flags;
+    if (!(flags = bm_malloc(BM_MEMORY_FILTER, corpus->count)))
+        return false;
+
+    memcpy(flags, corpus->flags, corpus->count);
+    *store = *corpus;
+    store->flags = flags;
+    store->allocated = corpus->count;
+    store->shared = true;
+    return true;
+}
+
+/**
+ * Release memory of item store.
+ *
+ * @param store bm_item_store to release.
+ */
+void
+bm_item_store_release(struct bm_item_store *store)
+{
+    assert(store);
+
+    if (store->shared) {
+        bm_free(store->flags);
+        memset(store, 0, sizeof(struct bm_item_store));
+        return;
+    }
+
+    bm_free(store->text);
+    bm_free(store->len);
+    bm_free(store->hash);
+    bm_free(store->signature);
+    bm_free(store->basename);
+    bm_free(store->flags);
+    bm_free(store->initials);
+    bm_free(store->initials_offset);
+    memset(store, 0, sizeof(struct bm_item_store));
+}
+
+/* vim: set ts=8 sw=4 tw=0 :*/
@@ -13,11 +13,12 @@
 /**
  * Portable strdup.
  *
+ * @param domain bm_memory_domain the copy is accounted to.
  * @param string C "string" to copy.
  * @return Copy of the given C "string".
  */
 char*
-bm_strdup(const char *string)
+bm_strdup(enum bm_memory_domain domain, const char *string)
 {
     assert(string);
 
@@ -25,7 +26,7 @@ bm_strdup(const char *string)
     if (len == 0)
         return NULL;
 
-    void *copy = calloc(1, len + 1);
+    void *copy = bm_calloc(domain, 1, len + 1);
     if (copy == NULL)
         return NULL;
 
@@ -36,13 +37,14 @@ bm_strdup(const char *string)
  * Small wrapper around realloc.
  * Resizes the buffer.
  *
+ * @param domain bm_memory_domain a new buffer is accounted to.
  * @param in_out_buffer Reference to the input buffer that will be modified on succesful resize.
  * @param in_out_size Current buffer size, will be modified with new size on succesful resize.
  * @param nsize New size to resize the buffer to.
  * @return true for succesful resize, false for failure.
  */
 bool
-bm_resize_buffer(char **in_out_buffer, size_t *in_out_size, size_t nsize)
+bm_resize_buffer(enum bm_memory_domain domain, char **in_out_buffer, size_t *in_out_size, size_t nsize)
 {
     assert(in_out_buffer && in_out_size);
 
@@ -50,7 +52,7 @@ bm_resize_buffer(char **in_out_buffer, size_t *in_out_size, size_t nsize)
         return false;
 
     void *tmp;
-    if (!(tmp = realloc(*in_out_buffer, nsize)))
+    if (!(tmp = bm_realloc(domain, *in_out_buffer, nsize)))
         return false;
 
     *in_out_buffer = tmp;
@@ -61,11 +63,12 @@ bm_resize_buffer(char **in_out_buffer, size_t *in_out_size, size_t nsize)
 /**
  * Formatted printf that returns allocated char array.
  *
+ * @param domain bm_memory_domain the array is accounted to.
  * @param fmt Format as C "string".
  * @return Copy of the formatted C "string".
  */
 char*
-bm_dprintf(const char *fmt, ...)
+bm_dprintf(enum bm_memory_domain domain, const char *fmt, ...)
 {
    assert(fmt);
 
@@ -75,7 +78,7 @@ bm_dprintf(const char *fmt, ...)
    va_end(args);
 
    char *buffer;
-   if (!(buffer = calloc(1, len)))
+   if (!(buffer = bm_calloc(domain, 1, len)))
       return NULL;
 
    va_start(args, fmt);
@@ -87,6 +90,7 @@ bm_dprintf(const char *fmt, ...)
 /**
  * Formatted printf that reuses and grows buffer when neccessary.
  *
+ * @param domain bm_memory_domain a new buffer is accounted to.
  * @param in_out_buffer Reference to buffer that holds the new formatted text.
  * @param in_out_len Reference to the length of current buffer and outs as resized length.
  * @param fmt Format as C "string".
@@ -94,7 +98,7 @@ bm_dprintf(const char *fmt, ...)
  * @return true if successful, false if failure.
  */
 bool
-bm_vrprintf(char **in_out_buffer, size_t *in_out_len, const char *fmt, va_list args)
+bm_vrprintf(enum bm_memory_domain domain, char **in_out_buffer, size_t *in_out_len, const char *fmt, va_list args)
 {
     assert(in_out_buffer && in_out_len && fmt);
 
@@ -103,7 +107,7 @@ bm_vrprintf(char **in_out_buffer, size_t *in_out_len, const char *fmt, va_list a
 
     size_t len = vsnprintf(NULL, 0, fmt, args) + 1;
 
-    if ((!*in_out_buffer || *in_out_len < len) && !bm_resize_buffer(in_out_buffer, in_out_len, len))
+    if ((!*in_out_buffer || *in_out_len < len) && !bm_resize_buffer(domain, in_out_buffer, in_out_len, len))
         return false;
 
     vsnprintf(*in_out_buffer, len, fmt, copy);
@@ -165,37 +169,49 @@ bm_strnupcmp(const char *hay, const char *needle, size_t len)
 }
 
 /**
- * Portable case-insensitive strstr.
+ * Length bounded strstr.
  *
- * @param hay C "string" to substring against.
- * @param needle C "string" to substring.
+ * @param hay Text to substring against, does not need to be null terminated.
+ * @param hay_len Length of hay in bytes.
+ * @param needle Text to substring, does not need to be null terminated.
+ * @param len Length of needle in bytes.
+ * @return Pointer to first occurrence of needle in hay, **NULL** if not found.
  */
 char*
-bm_strupstr(const char *hay, const char *needle)
+bm_strnstr(const char *hay, size_t hay_len, const char *needle, size_t len)
 {
-    size_t r = 0, p = 0, len, len2;
+    if (len == 0)
+        return (char*)hay;
 
-    if ((len = strlen(hay)) < (len2 = strlen(needle)))
-        return NULL;
+    for (const char *s = hay, *end = hay + hay_len; (size_t)(end - s) >= len; ++s) {
+        if (!(s = memchr(s, *needle, end - s - len + 1)))
+            return NULL;
 
-    if (!bm_strnupcmp(hay, needle, len2))
-        return (char*)hay;
+        if (!memcmp(s, needle, len))
+            return (char*)s;
+    }
 
-    for (size_t i = 0; i < len; ++i) {
-        if (p == len2)
-            return (char*)hay + r;
-
-        if (toupper(hay[i]) == toupper(needle[p++])) {
-            if (!r)
-                r = i;
-        } else {
-            if (r)
-                i = r;
-            r = p = 0;
-        }
+    return NULL;
+}
+
+/**
+ * Length bounded case-insensitive strstr.
+ *
+ * @param hay Text to substring against, does not need to be null terminated.
+ * @param hay_len Length of hay in bytes.
+ * @param needle Text to substring, does not need to be null terminated.
+ * @param len Length of needle in bytes.
+ * @return Pointer to first occurrence of needle in hay, **NULL** if not found.
+ */
+char*
+bm_strnupstr(const char *hay, size_t hay_len, const char *needle, size_t len)
+{
+    for (size_t i = 0; i + len <= hay_len; ++i) {
+        if (!bm_strnupcmp(hay + i, needle, len))
+            return (char*)hay + i;
     }
 
-    return (p == len2 ? (char*)hay + r : NULL);
+    return NULL;
 }
 
 /**
@@ -210,25 +226,25 @@ bm_utf8_string_screen_width(const char *string)
     assert(string);
 
     char *mstr;
-    if (!(mstr = bm_strdup(string)))
+    if (!(mstr = bm_strdup(BM_MEMORY_OTHER, string)))
         return strlen(string);
 
     char *s;
     for (s = mstr; *s; ++s) if (*s == '\t') *s = ' ';
 
     int num_char = mbstowcs(NULL, mstr, 0) + 1;
-    wchar_t *wstring = malloc((num_char + 1) * sizeof (wstring[0]));
+    wchar_t *wstring = bm_malloc(BM_MEMORY_OTHER, (num_char + 1) * sizeof (wstring[0]));
 
     if (mbstowcs(wstring, mstr, num_char) == (size_t)(-1)) {
-        free(wstring);
+        bm_free(wstring);
         int len = strlen(mstr);
-        free(mstr);
+        bm_free(mstr);
         return len;
     }
 
     int32_t length = wcswidth(wstring, num_char);
-    free(wstring);
-    free(mstr);
+    bm_free(wstring);
+    bm_free(mstr);
     return length;
 }
 
@@ -272,6 +288,54 @@ bm_utf8_rune_prev(const char *string, size_t start)
     return start - i;
 }
 
+/**
+ * Decode UTF8 rune to code point.
+ * Bytes that do not start a valid sequence decode to 0xDC00 + byte, which valid runes never decode to.
+ *
+ * @param string Buffer which contains the rune, does not need to be null terminated.
+ * @param len Bytes available in buffer, must be at least 1.
+ * @param out_u8len Reference to size_t where byte length of the rune is stored.
+ * @return Code point of the rune.
+ */
+uint32_t
+bm_utf8_rune_decode(const char *string, size_t len, size_t *out_u8len)
+{
+    assert(string && len > 0 && out_u8len);
+
+    const unsigned char *s = (const unsigned char*)string;
+    *out_u8len = 1;
+
+    if (s[0] < 0x80)
+        return s[0];
+
+    size_t n;
+    uint32_t rune;
+    if ((s[0] & 0xe0) == 0xc0 && s[0] >= 0xc2) {
+        n = 1;
+        rune = s[0] & 0x1f;
+    } else if ((s[0] & 0xf0) == 0xe0) {
+        n = 2;
+        rune = s[0] & 0x0f;
+    } else if ((s[0] & 0xf8) == 0xf0 && s[0] <= 0xf4) {
+        n = 3;
+        rune = s[0] & 0x07;
+    } else {
+        return 0xdc00 + s[0];
+    }
+
+    if (len <= n)
+        return 0xdc00 + s[0];
+
+    for (size_t i = 1; i <= n; ++i) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0xdc00 + s[0];
+        rune = (rune << 6) | (s[i] & 0x3f);
+    }
+
+    *out_u8len = n + 1;
+    return rune;
+}
+
 /**
  * Figure out how many columns are needed to display UTF8 rune.
  *
@@ -320,6 +384,7 @@ bm_utf8_rune_remove(char *string, size_t start, size_t *out_rune_width)
 
 /**
  * Insert UTF8 rune to buffer.
+ * New buffer is accounted as filter text.
  *
  * @param in_out_string Reference to buffer.
  * @param in_out_buf_size Reference to size of the buffer.
@@ -342,17 +407,17 @@ bm_utf8_rune_insert(char **in_out_string, size_t *in_out_buf_size, size_t start,
         return 0;
 
     size_t len = (*in_out_string ? strlen(*in_out_string) : 0);
-    if (!*in_out_string && !(*in_out_string = calloc(1, (*in_out_buf_size = u8len + 1))))
+    if (!*in_out_string && !(*in_out_string = bm_calloc(BM_MEMORY_FILTER, 1, (*in_out_buf_size = u8len + 1))))
         return 0;
 
     if (len + u8len >= *in_out_buf_size) {
         void *tmp;
-        if (!(tmp = realloc(*in_out_string, (*in_out_buf_size * 2)))) {
-            if (!(tmp = malloc((*in_out_buf_size * 2))))
+        if (!(tmp = bm_realloc(BM_MEMORY_FILTER, *in_out_string, (*in_out_buf_size * 2)))) {
+            if (!(tmp = bm_malloc(BM_MEMORY_FILTER, (*in_out_buf_size * 2))))
                 return 0;
 
             memcpy(tmp, *in_out_string, *in_out_buf_size);
-            free(*in_out_string);
+            bm_free(*in_out_string);
         }
 
         memset((char*)tmp + *in_out_buf_size, 0, *in_out_buf_size);
@@ -400,4 +465,61 @@ bm_unicode_insert(char **in_out_string, size_t *in_out_buf_size, size_t start, u
     return bm_utf8_rune_insert(in_out_string, in_out_buf_size, start, mb, u8len, out_rune_width);
 }
 
+/**
+ * Insert UTF8 text to buffer in one go, as when text is pasted.
+ * Line breaks and tabs are inserted as spaces, other control characters and invalid UTF8 are dropped.
+ * New buffer is accounted as filter text.
+ *
+ * @param in_out_string Reference to buffer.
+ * @param in_out_buf_size Reference to size of the buffer.
+ * @param start Start offset where to insert to. (cursor)
+ * @param text Text to insert, does not need to be null terminated.
+ * @param len Byte length of the text.
+ * @param out_width Reference to size_t, return number of columns for inserted text.
+ * @return Number of bytes inserted to buffer.
+ */
+size_t
+bm_utf8_string_insert(char **in_out_string, size_t *in_out_buf_size, size_t start, const char *text, size_t len, size_t *out_width)
+{
+    assert(in_out_string && in_out_buf_size && (text || len == 0));
+
+    if (out_width)
+        *out_width = 0;
+
+    char *clean;
+    if (!len || !(clean = bm_malloc(BM_MEMORY_FILTER, len + 1)))
+        return 0;
+
+    size_t n = 0;
+    for (size_t i = 0, u8len; i < len; i += u8len) {
+        const uint32_t rune = bm_utf8_rune_decode(text + i, len - i, &u8len);
+        if (rune == '\n' || rune == '\r' || rune == '\t') {
+            clean[n++] = ' ';
+        } else if (rune >= 0x20 && rune != 0x7f && (rune < 0x80 || rune > 0x9f) && (rune < 0xdc00 || rune > 0xdcff)) {
+            memcpy(clean + n, text + i, u8len);
+            n += u8len;
+        }
+    }
+
+    clean[n] = 0;
+
+    const size_t old_len = (*in_out_string ? strlen(*in_out_string) : 0);
+    if (!n || (old_len + n >= *in_out_buf_size && !bm_resize_buffer(BM_MEMORY_FILTER, in_out_string, in_out_buf_size, old_len + n + 1))) {
+        bm_free(clean);
+        return 0;
+    }
+
+    char *str = *in_out_string + start;
+    memmove(str + n, str, old_len - start);
+    memcpy(str, clean, n);
+    (*in_out_string)[old_len + n] = 0;
+
+    const int32_t width = bm_utf8_string_screen_width(clean);
+    if (out_width)
+        *out_width = (width > 0 ? width : 0);
+
+    bm_free(clean);
+    return n;
+}
+
 /* vim: set ts=8 sw=4 tw=0 :*/